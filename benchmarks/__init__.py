@@ -0,0 +1,137 @@
+"""Benchmarks for the jackpatch MIDI send and receive paths.
+
+Run them with `python -m benchmarks` or `python setup.py bench` against a 
+JACK server, ideally one running the dummy backend so results don't depend 
+on audio hardware. Each benchmark returns a flat dict of metrics, which are 
+collected into a JSON report that can be compared against an earlier one to 
+catch regressions. Metric names ending in "_per_second" are better when 
+higher, and all others (mostly times in seconds) are better when lower.
+"""
+
+import json
+import os
+import platform
+import subprocess
+import time
+
+# the registered benchmarks in the order they run, as (name, function) pairs
+BENCHMARKS = []
+
+def benchmark(function):
+  """Register a function as a benchmark, which takes no arguments and 
+     returns a dict mapping metric names to numbers."""
+  BENCHMARKS.append((function.__name__, function))
+  return(function)
+
+def percentile(values, fraction):
+  """Get the value at the given fraction of the way through a list of 
+     numbers when sorted."""
+  values = sorted(values)
+  if (len(values) == 0): return(None)
+  index = min(len(values) - 1, int(fraction * len(values)))
+  return(values[index])
+
+def summarize(prefix, values):
+  """Get the minimum, median, 99th percentile, and maximum of a list of 
+     numbers, as metrics named with the given prefix."""
+  return({
+    prefix+'_min': min(values),
+    prefix+'_median': percentile(values, 0.5),
+    prefix+'_p99': percentile(values, 0.99),
+    prefix+'_max': max(values) })
+
+def rate(count, seconds):
+  """Get a count per second, avoiding dividing by zero on fast runs."""
+  return(count / max(seconds, 1e-9))
+
+def wait_for_cycles(client, cycles=1, timeout=5.0):
+  """Wait for the client's process callback to run the given number of 
+     times, so anything queued before the call has been handled."""
+  start = client.stats()['cycles']
+  deadline = time.monotonic() + timeout
+  while (client.stats()['cycles'] - start < cycles):
+    if (time.monotonic() > deadline):
+      raise RuntimeError('The JACK process callback is not running')
+    time.sleep(0.001)
+
+def process_time_between(before, after):
+  """Get the average and 99th percentile of process callback times between 
+     two readings of Client.stats, in seconds."""
+  a = before['process_time']
+  b = after['process_time']
+  count = b['count'] - a['count']
+  if (count <= 0): return(None, None)
+  # the histogram buckets only ever gain counts, so we can subtract them 
+  #  to get the histogram for just the cycles in between
+  counts = dict(b['histogram'])
+  for (limit, n) in a['histogram']:
+    counts[limit] = counts.get(limit, 0) - n
+  seen = 0
+  p99 = 0.0
+  for limit in sorted(counts.keys()):
+    if (counts[limit] <= 0): continue
+    if (seen * 100 < count * 99): p99 = limit
+    seen += counts[limit]
+  avg = ((b['avg'] * b['count']) - ((a['avg'] or 0.0) * a['count'])) / count
+  return(avg, p99)
+
+def start_server(name='jackpatch-bench', rate=48000, period=256):
+  """Start a JACK server on the dummy backend and point new clients at it, 
+     returning the server process."""
+  server = subprocess.Popen(
+    [ 'jackd', '--no-realtime', '-n', name, 
+      '-d', 'dummy', '-r', str(rate), '-p', str(period) ],
+    stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+  os.environ['JACK_DEFAULT_SERVER'] = name
+  # give the server a moment to come up before anything connects to it
+  time.sleep(1.0)
+  if (server.poll() is not None):
+    raise RuntimeError('Failed to start a JACK server with the dummy backend')
+  return(server)
+
+def run(names=None, log=None):
+  """Run the named benchmarks (or all of them if no names are given), 
+     returning a report with their results."""
+  import jackpatch
+  results = dict()
+  for (name, function) in BENCHMARKS:
+    if ((names) and (name not in names)): continue
+    if (log is not None): log('running %s' % name)
+    results[name] = function()
+  return({
+    'time': time.strftime('%Y-%m-%dT%H:%M:%S'),
+    'platform': platform.platform(),
+    'python': platform.python_version(),
+    'module': getattr(jackpatch, '__file__', None),
+    'results': results })
+
+def compare(report, baseline, tolerance=0.2):
+  """Compare a report against a baseline report, returning a list of 
+     (benchmark, metric, baseline value, value) tuples for metrics that got 
+     worse by more than the given fraction."""
+  regressions = list()
+  for (name, metrics) in report['results'].items():
+    old_metrics = baseline.get('results', dict()).get(name, dict())
+    for (metric, value) in metrics.items():
+      old = old_metrics.get(metric)
+      if ((old is None) or (value is None) or (old <= 0)): continue
+      if (metric.endswith('_per_second')):
+        worse = (value < old * (1.0 - tolerance))
+      else:
+        worse = (value > old * (1.0 + tolerance))
+      if (worse): regressions.append((name, metric, old, value))
+  return(regressions)
+
+def write_report(report, path):
+  """Write a report as JSON."""
+  with open(path, 'w') as f:
+    json.dump(report, f, indent=2, sort_keys=True)
+
+def read_report(path):
+  """Read a report written by write_report."""
+  with open(path, 'r') as f:
+    return(json.load(f))
+
+# register the benchmarks
+from . import midi
+from . import graph
@@ -0,0 +1,42 @@
+"""Run the jackpatch benchmarks from the command line."""
+
+import argparse
+import sys
+
+from . import BENCHMARKS, run, compare, start_server, write_report, read_report
+
+def main(argv=None):
+  parser = argparse.ArgumentParser(prog='python -m benchmarks',
+    description='Benchmark the jackpatch MIDI send and receive paths')
+  parser.add_argument('names', nargs='*', 
+    help='benchmarks to run (default: all of them, which are %s)' % 
+      ', '.join([ name for (name, function) in BENCHMARKS ]))
+  parser.add_argument('-o', '--output', default='benchmark-results.json',
+    help='where to write the results as JSON')
+  parser.add_argument('-b', '--baseline', 
+    help='results to compare against, failing if any metric regressed')
+  parser.add_argument('-t', '--tolerance', type=float, default=0.2,
+    help='the fraction a metric can get worse by before it counts as a '
+         'regression (default: 0.2)')
+  parser.add_argument('-s', '--start-server', action='store_true',
+    help='start a JACK server with the dummy backend for the run')
+  args = parser.parse_args(argv)
+  server = start_server() if (args.start_server) else None
+  try:
+    report = run(args.names, log=lambda message: sys.stderr.write(message+'\n'))
+  finally:
+    if (server is not None):
+      server.terminate()
+      server.wait()
+  write_report(report, args.output)
+  sys.stderr.write('wrote results to %s\n' % args.output)
+  if (args.baseline):
+    regressions = compare(report, read_report(args.baseline), args.tolerance)
+    for (name, metric, old, value) in regressions:
+      sys.stderr.write('%s.%s regressed from %g to %g\n' % 
+                       (name, metric, old, value))
+    if (len(regressions) > 0): return(1)
+  return(0)
+
+if (__name__ == '__main__'):
+  sys.exit(main())
@@ -0,0 +1,36 @@
+"""Benchmarks for querying the JACK graph."""
+
+import time
+
+import jackpatch
+
+from . import benchmark, summarize
+
+@benchmark
+def get_ports():
+  """Measure how long Client.get_ports takes with different numbers of 
+     ports on the server."""
+  results = dict()
+  client = jackpatch.Client('bench-graph')
+  client.activate()
+  others = jackpatch.Client('bench-graph-ports')
+  ports = list()
+  for size in (16, 256, 1024):
+    while (len(ports) < size):
+      flags = (jackpatch.JackPortIsOutput if (len(ports) % 2 == 0) 
+               else jackpatch.JackPortIsInput)
+      ports.append(jackpatch.Port(others, 'port%d' % len(ports), flags=flags))
+    searches = (
+      ('all', dict()),
+      ('pattern', dict(name_pattern='port1[0-9]*$')),
+      ('flags', dict(flags=jackpatch.JackPortIsInput)))
+    for (search, kwargs) in searches:
+      times = list()
+      for i in range(50):
+        start = time.perf_counter()
+        client.get_ports(**kwargs)
+        times.append(time.perf_counter() - start)
+      results.update(summarize('ports_%d_%s' % (size, search), times))
+  others.close()
+  client.close()
+  return(results)
@@ -0,0 +1,146 @@
+"""Benchmarks for sending, processing, and receiving MIDI."""
+
+import time
+
+import jackpatch
+
+from . import benchmark, summarize, rate, wait_for_cycles, process_time_between
+
+# a frame offset far enough ahead that messages queued for it stay queued 
+#  for the whole benchmark
+FAR_FUTURE = 48000 * 3600
+
+# the size of receive queues, big enough to hold every message we send
+QUEUE_SIZE = 1 << 22
+
+def _client(name):
+  client = jackpatch.Client(name)
+  client.activate()
+  return(client)
+
+@benchmark
+def send_throughput():
+  """Measure how fast Port.send_at and Port.send_many queue messages, with 
+     different numbers of messages already waiting in the queue."""
+  client = _client('bench-send')
+  port = jackpatch.Port(client, 'out', flags=jackpatch.JackPortIsOutput)
+  results = dict()
+  count = 10000
+  for depth in (0, 1000, 10000, 100000):
+    port.clear_send()
+    frame = client.frame_time + FAR_FUTURE
+    for i in range(depth):
+      port.send_at((0x90, i % 128, 0x40), frame + i)
+    start = time.perf_counter()
+    for i in range(count):
+      port.send_at((0x90, i % 128, 0x40), frame + i)
+    elapsed = time.perf_counter() - start
+    results['send_at_depth_%d_per_second' % depth] = rate(count, elapsed)
+  port.clear_send()
+  # send a whole stream of messages in one call
+  stream = bytes([ 0x90, 0x3C, 0x40 ]) * count
+  start = time.perf_counter()
+  port.send_many(stream, client.frame_time + FAR_FUTURE)
+  elapsed = time.perf_counter() - start
+  results['send_many_per_second'] = rate(count, elapsed)
+  port.clear_send()
+  client.close()
+  return(results)
+
+@benchmark
+def process_cost():
+  """Measure how long the process callback takes with different numbers of 
+     ports and of messages waiting to be sent."""
+  results = dict()
+  for port_count in (1, 16, 64):
+    for pending in (0, 10000):
+      client = _client('bench-process')
+      ports = [ jackpatch.Port(client, 'out%d' % i, 
+                               flags=jackpatch.JackPortIsOutput)
+                for i in range(port_count) ]
+      ports.extend([ jackpatch.Port(client, 'in%d' % i, 
+                                    flags=jackpatch.JackPortIsInput)
+                     for i in range(port_count) ])
+      frame = client.frame_time + FAR_FUTURE
+      for port in ports[:port_count]:
+        for i in range(pending // port_count):
+          port.send_at((0x90, i % 128, 0x40), frame + i)
+      # let the callback settle before measuring it
+      wait_for_cycles(client, 10)
+      before = client.stats()
+      time.sleep(1.0)
+      after = client.stats()
+      avg, p99 = process_time_between(before, after)
+      key = 'ports_%d_pending_%d' % (port_count, pending)
+      results[key+'_avg'] = avg
+      results[key+'_p99'] = p99
+      client.close()
+  return(results)
+
+def _fill(client, source, destination, count):
+  # send messages through a loopback connection and wait for them all 
+  #  to arrive
+  name = destination.name
+  target = client.stats()['ports'][name]['received'] + count
+  frame = client.frame_time
+  for i in range(count):
+    source.send_at((0x90, i % 128, 0x40), frame + i)
+  deadline = time.monotonic() + 30.0
+  while (client.stats()['ports'][name]['received'] < target):
+    if (time.monotonic() > deadline):
+      raise RuntimeError('Timed out waiting for messages to arrive')
+    time.sleep(0.01)
+
+@benchmark
+def receive_drain():
+  """Measure how fast queued messages can be taken off an input port with 
+     Port.receive, Port.receive_event, and Port.receive_all."""
+  client = _client('bench-receive')
+  source = jackpatch.Port(client, 'out', flags=jackpatch.JackPortIsOutput)
+  destination = jackpatch.Port(client, 'in', flags=jackpatch.JackPortIsInput, 
+                               queue_size=QUEUE_SIZE)
+  client.connect(source, destination)
+  results = dict()
+  count = 20000
+  methods = (
+    ('receive', destination.receive),
+    ('receive_event', destination.receive_event))
+  for (method, receive) in methods:
+    _fill(client, source, destination, count)
+    received = 0
+    start = time.perf_counter()
+    while (receive() is not None):
+      received += 1
+    elapsed = time.perf_counter() - start
+    results[method+'_per_second'] = rate(received, elapsed)
+  _fill(client, source, destination, count)
+  start = time.perf_counter()
+  data, offsets, times = destination.receive_all()
+  elapsed = time.perf_counter() - start
+  results['receive_all_per_second'] = rate(len(times), elapsed)
+  client.close()
+  return(results)
+
+@benchmark
+def loopback_latency():
+  """Measure the time from sending a message on an output port to 
+     receiving it on an input port connected to it."""
+  client = _client('bench-latency')
+  source = jackpatch.Port(client, 'out', flags=jackpatch.JackPortIsOutput)
+  destination = jackpatch.Port(client, 'in', flags=jackpatch.JackPortIsInput)
+  client.connect(source, destination)
+  wall = list()
+  frames = list()
+  for i in range(500):
+    frame = client.frame_time
+    start = time.perf_counter()
+    source.send((0x90, i % 128, 0x40))
+    message = destination.receive(timeout=1.0, timestamps=True)
+    if (message is None):
+      raise RuntimeError('A message sent on the loopback never arrived')
+    wall.append(time.perf_counter() - start)
+    frames.append((message[2] - frame) & 0xFFFFFFFF)
+  results = summarize('latency', wall)
+  results.update(summarize('latency_frames', frames))
+  client.close()
+  return(results)
@@ -1,34 +1,149 @@
 #include <Python.h>
 #include "structmember.h"
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <regex.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <jack/jack.h>
 #include <jack/midiport.h>
 #include <jack/transport.h>
+#include <jack/ringbuffer.h>
 
 // the size of buffers to use for various purposes
 #define BUFFER_SIZE 1024
-// the maximum number of MIDI I/O ports to allow for a client
-#define MAX_PORTS_PER_CLIENT 256
+// the default size in bytes of the queue each input port stores received 
+//  MIDI events in until they're read
+#define DEFAULT_RECEIVE_QUEUE_SIZE 65536
+// the default number of frames of audio each audio port can buffer 
+//  between the process callback and Python
+#define DEFAULT_AUDIO_QUEUE_FRAMES 65536
+// the number of size classes in the arena received MIDI events are stored in
+#define RECEIVE_ARENA_CLASSES 4
+// the maximum number of routed MIDI events each output port can send 
+//  in a single block
+#define MAX_ROUTED_EVENTS_PER_BLOCK 512
+// the number of preallocated messages in each client's send pool, and the 
+//  number of data bytes each one can hold (enough for any channel message, 
+//  with longer messages like SysEx allocated separately)
+#define MESSAGE_POOL_SLOTS 16384
+#define MESSAGE_POOL_SLOT_DATA 16
+// the size in bytes of the queue a player decodes events into ahead of 
+//  the process callback, the room it has for long messages in each block, 
+//  and how many blocks ahead of the callback it decodes
+#define PLAYER_QUEUE_SIZE 65536
+#define PLAYER_SCRATCH_SIZE 4096
+#define PLAYER_LOOKAHEAD_PERIODS 4
+// the number of MIDI clock pulses per quarter note, and how many recent 
+//  pulses a clock follower averages its tempo over
+#define CLOCK_PULSES_PER_QUARTER 24
+#define CLOCK_TEMPO_PULSES 25
+// the size in bytes of the queue a recorder's ports copy received events 
+//  into, how often in milliseconds its thread writes them to disk, and 
+//  the size of the buffer it writes through
+#define RECORDER_QUEUE_SIZE 1048576
+#define RECORDER_WRITE_INTERVAL 50
+#define RECORDER_WRITE_BUFFER_SIZE 65536
+// the smallest number of entries a client's cache of Port objects can 
+//  grow to before it's swept for ports whose objects are gone
+#define PORT_CACHE_MIN_LIMIT 256
+// a receive filter that passes everything, and the bits of a filter that 
+//  hold the status nibbles and channels of messages to pass, the system 
+//  realtime messages to pass, and the largest SysEx message to pass
+#define RECEIVE_FILTER_ALL UINT64_MAX
+#define RECEIVE_FILTER_TYPES(filter) ((filter) & 0xFF)
+#define RECEIVE_FILTER_CHANNELS(filter) (((filter) >> 8) & 0xFFFF)
+#define RECEIVE_FILTER_REALTIME(filter) (((filter) >> 24) & 0xFF)
+#define RECEIVE_FILTER_SYSEX_MAX(filter) ((uint32_t)((filter) >> 32))
+// the number of buckets in the histogram of process callback durations, 
+//  which has four buckets for each power of two nanoseconds up to 2^32
+#define PROCESS_TIME_BUCKETS 128
+// policies for what to do with queued messages that are due in a block 
+//  but don't fit in the port's buffer
+#define OVERFLOW_DEFER 0
+#define OVERFLOW_DROP_OLDEST 1
+#define OVERFLOW_COALESCE 2
+// the number of messages per channel that can be coalesced, which are 
+//  the 128 control changes plus pitch bend and channel pressure
+#define COALESCE_KEYS_PER_CHANNEL 130
 // define whether to emit warnings when in a JACK processing callback
 //  (normally not a great idea because it can produce floods of warnings, but 
 //   useful when debugging)
 #define WARN_IN_PROCESS 0
 
+// THREADING ******************************************************************
+
+// free-threaded builds have no GIL to serialize the Python side of the 
+//  queues and pools the process callback shares, so each of those gets a 
+//  lock of its own; with the GIL they compile away to nothing
+#ifdef Py_GIL_DISABLED
+typedef PyMutex StateLock;
+#define StateLock_init(lock) memset((lock), 0, sizeof(PyMutex))
+#define StateLock_acquire(lock) PyMutex_Lock(lock)
+#define StateLock_release(lock) PyMutex_Unlock(lock)
+#else
+typedef struct { char unused; } StateLock;
+#define StateLock_init(lock) ((void)(lock))
+#define StateLock_acquire(lock) ((void)(lock))
+#define StateLock_release(lock) ((void)(lock))
+#endif
+// guard Python objects the GIL used to protect, on versions of Python that 
+//  need it
+#ifndef Py_BEGIN_CRITICAL_SECTION
+#define Py_BEGIN_CRITICAL_SECTION(op) {
+#define Py_END_CRITICAL_SECTION() }
+#endif
+
+// MODULE STATE ***************************************************************
+
+// define a struct to hold the module's types and exception, so each 
+//  interpreter that imports the module gets its own
+typedef struct {
+  PyObject *JackError;
+  PyTypeObject *ClientType;
+  PyTypeObject *TransportType;
+  PyTypeObject *PortType;
+  PyTypeObject *MidiEventType;
+  PyTypeObject *PlayerType;
+  PyTypeObject *RecorderType;
+  PyTypeObject *ClockType;
+  PyTypeObject *ClientGroupType;
+} ModuleState;
+
+static struct PyModuleDef jackpatch;
+
+// get the state of the module that created one of its objects, which can 
+//  only fail if the object isn't one of the module's
+static ModuleState *
+_module_state(void *object) {
+  PyObject *module = PyType_GetModuleByDef(Py_TYPE((PyObject *)object), 
+                                           &jackpatch);
+  if (module == NULL) return(NULL);
+  return((ModuleState *)PyModule_GetState(module));
+}
+
 // ERROR HANDLING *************************************************************
 
-static PyObject *JackError;
-static void _error(const char *format, ...) {
-  static char message[BUFFER_SIZE];
+// raise a JackError from the module that created the given object
+static void _error(void *owner, const char *format, ...) {
+  char message[BUFFER_SIZE];
   va_list ap;
   va_start(ap, format);
   vsnprintf(message, BUFFER_SIZE, format, ap);
   va_end(ap);
-  PyErr_SetString(JackError, message);
+  ModuleState *state = _module_state(owner);
+  if (state != NULL) PyErr_SetString(state->JackError, message);
 }
 static void _warn(const char *format, ...) {
-  static char message[BUFFER_SIZE];
+  char message[BUFFER_SIZE];
   va_list ap;
   va_start(ap, format);
   vsnprintf(message, BUFFER_SIZE, format, ap);
@@ -38,40 +153,582 @@ static void _warn(const char *format, ...) {
 
 // STORAGE TYPES **************************************************************
 
-// define a struct to store queued MIDI messages, with a self-pointer that can
-//  be used to manage the queue as a linked list
+// define a struct to store queued MIDI messages, with self-pointers that can
+//  be used to manage the queue as a linked list or as a leftist heap ordered 
+//  by time
 typedef struct {
   void *next;
+  void *left;
+  void *right;
+  int rank;
   jack_port_t *port;
+  // the absolute frame on JACK's frame clock at which to send the message
   jack_nframes_t time;
+  // a serial number that keeps messages sent at the same time in order
+  unsigned long sequence;
   size_t data_size;
+  // whether the message belongs to a pool rather than being allocated alone
+  int pooled;
   // the data goes at the end so we can allocate a variable number of bytes 
   //  for it depending on the message length; if you want to add more members
   //  to the struct, do it somewhere above here
   unsigned char data[];
 } Message;
 
-static PyTypeObject PortType;
+// define a struct to prefix received MIDI events with when storing them in a 
+//  port's receive queue, with the data immediately following it
+typedef struct {
+  // the transport frame the event arrived at
+  jack_nframes_t time;
+  // the frame on JACK's frame clock the event arrived at, and an estimate 
+  //  of the corresponding system time in microseconds
+  jack_nframes_t frame;
+  jack_time_t usecs;
+  size_t data_size;
+  // the size class and index of the arena slot holding the event's data, 
+  //  or a class of -1 if the data follows the header in the queue
+  int slot_class;
+  uint32_t slot;
+} ReceivedEvent;
+
+// define a struct to store one size class of a receive arena, which is a 
+//  block of equally sized slots with a queue of the ones that are free
+typedef struct {
+  size_t slot_size;
+  uint32_t slot_count;
+  unsigned char *memory;
+  // the indices of free slots, taken by the process callback and 
+  //  returned by Python code holding the arena's lock
+  jack_ringbuffer_t *free_slots;
+} ArenaClass;
+
+// define a struct to store received MIDI data in preallocated memory, so 
+//  events can be handed to Python without copying or allocating them
+typedef struct {
+  ArenaClass classes[RECEIVE_ARENA_CLASSES];
+  // the number of events that didn't get a slot because they were all taken
+  volatile unsigned long misses;
+  // serializes returning slots, since the free lists only support one writer
+  StateLock lock;
+} ReceiveArena;
+
+// define a struct to store preallocated messages for the send path, so 
+//  sending doesn't allocate and the process callback never calls free()
+typedef struct {
+  size_t slot_size;
+  int slot_count;
+  unsigned char *memory;
+  // pooled messages that are free to use (only touched while holding the 
+  //  pool's lock)
+  Message **free_stack;
+  int free_count;
+  // a ring of pointers to messages the process callback has sent, which 
+  //  Python recycles into the pool or frees if they were allocated alone
+  jack_ringbuffer_t *returned;
+  // serializes Python's use of the free stack and the ring's read side
+  StateLock lock;
+  // usage statistics
+  int in_use;
+  int high_water;
+  // the number of small messages allocated alone because the pool was empty
+  unsigned long misses;
+  // the number of messages too long for a pool slot
+  unsigned long large;
+  // the number of messages the process callback had to free itself because 
+  //  the return ring was full (written only by the process callback)
+  volatile unsigned long rt_frees;
+} MessagePool;
+
+// define a struct to store the timing of a process cycle, captured once at 
+//  the start of the cycle so every port sees the same values
+typedef struct {
+  jack_nframes_t nframes;
+  // the transport frame at the start of the cycle
+  jack_nframes_t transport_frame;
+  // the frame clock and system time at the start of the cycle 
+  //  and the expected system time at the start of the next one
+  jack_nframes_t frame;
+  jack_time_t usecs;
+  jack_time_t next_usecs;
+  // the transport's state and position at the start of the cycle
+  jack_transport_state_t transport_state;
+  jack_position_t transport;
+} CycleTimes;
+
+// define a struct to store the transport's state as of the last process 
+//  cycle, which the callback publishes with a sequence number that's odd 
+//  while it's writing, so readers can copy it without locking and retry 
+//  if it changed under them
+typedef struct {
+  atomic_uint sequence;
+  jack_transport_state_t state;
+  jack_position_t position;
+} TransportSnapshot;
+
+// define a struct to store a span of a tempo map, where the tempo and 
+//  meter are constant
+typedef struct {
+  // where the span starts on the transport in seconds
+  double time;
+  double beats_per_minute;
+  float beats_per_bar;
+  float beat_type;
+  // the number of bars and ticks before the span starts
+  double bars;
+  double ticks;
+} TempoSpan;
+
+// define a struct to store a tempo map the client uses to fill in 
+//  bar/beat/tick positions when it's the transport's timebase master
+typedef struct {
+  double ticks_per_beat;
+  int count;
+  TempoSpan spans[];
+} TempoMap;
+
+// define a struct to store statistics about the process callback, which 
+//  only the callback writes to so they don't need to be locked
+typedef struct {
+  // the number of cycles that were timed, and the shortest, longest, and 
+  //  total time they took in nanoseconds
+  volatile unsigned long count;
+  volatile uint64_t min_ns;
+  volatile uint64_t max_ns;
+  volatile uint64_t total_ns;
+  volatile unsigned long histogram[PROCESS_TIME_BUCKETS];
+  // the number of xruns JACK has reported (written only by the xrun callback)
+  volatile unsigned long xruns;
+} ProcessStats;
+
+// define a struct to store an event routed to an output port during the 
+//  current block, which either points at the data in the source port's 
+//  buffer or, if the data was transformed, holds it inline
+typedef struct {
+  jack_nframes_t time;
+  size_t data_size;
+  const unsigned char *data;
+  unsigned char bytes[3];
+} RoutedEvent;
+
+// define a struct to store the events a player feeds to an output port, 
+//  which the player's thread decodes ahead of time into a single-producer/
+//  single-consumer ring that the process callback routes them from
+typedef struct {
+  jack_ringbuffer_t *ring;
+  // the number of times the player asked for the ring to be discarded, 
+  //  and the number of those the process callback has carried out
+  atomic_ulong flushes;
+  atomic_ulong flushes_done;
+  // room for the current block's messages that are too long to route inline
+  //  (used only by the process callback)
+  unsigned char *scratch;
+  size_t scratch_used;
+} PlayerFeed;
+
+// define a struct to prefix events in a player feed with, 
+//  with the data immediately following it
+typedef struct {
+  // the absolute frame on JACK's frame clock to send the event at
+  jack_nframes_t frame;
+  uint32_t size;
+} PlayerRecord;
+
+// define a struct to prefix events in a recorder's queue with, 
+//  with the data immediately following it
+typedef struct {
+  // the time the event arrived on the system clock and the frame clock
+  jack_time_t usecs;
+  jack_nframes_t frame;
+  // the index of the port in the recorder's ports, and the size of the data
+  uint16_t track;
+  uint16_t size;
+} RecordedEvent;
+
+// define a struct to store where a port being recorded copies its events, 
+//  which is a single-producer/single-consumer ring shared by all the ports 
+//  in a recording (since one process callback handles all of them)
+typedef struct {
+  jack_ringbuffer_t *ring;
+  uint16_t track;
+  // whether the events should also go to the port's receive queue
+  int receive;
+  // the number of events that didn't fit in the ring, and that were too 
+  //  big to record at all (written only by the process callback)
+  volatile unsigned long overflows;
+  volatile unsigned long oversized;
+} RecorderTap;
+
+// define a struct to store the state of a MIDI clock attached to a port, 
+//  which either generates clock and MTC on an output port from the 
+//  transport, or follows clock arriving on an input port
+typedef struct {
+  int is_follower;
+  // settings for generating, where the tempo is used when no timebase 
+  //  master is giving the transport a tempo of its own, and the MTC type 
+  //  is the rate code sent with full frames, or -1 to not send MTC
+  _Atomic(double) tempo;
+  int send_clock;
+  int mtc_type;
+  double mtc_fps;
+  // the generator's state between cycles (used only by the process callback)
+  int was_rolling;
+  int has_position;
+  jack_nframes_t expected_frame;
+  unsigned char full_frame[10];
+  // the follower's recent clock pulse times, for estimating tempo
+  //  (used only by the process callback)
+  jack_time_t pulse_times[CLOCK_TEMPO_PULSES];
+  int pulse_count;
+  int pulse_index;
+  int follow_running;
+  uint64_t follow_pulses;
+  // the clock's tempo, whether it's running, and its position in quarter 
+  //  notes, published by the process callback for Python to read with a 
+  //  sequence count like the transport snapshot
+  atomic_uint sequence;
+  double published_tempo;
+  int published_running;
+  double published_position;
+} ClockState;
+
+// define a struct to store the state a client keeps for each port it manages
+typedef struct {
+  jack_port_t *port;
+  // whether the port carries audio rather than MIDI, and which way it goes
+  int is_audio;
+  int is_input;
+  // for audio ports, a single-producer/single-consumer ring of samples 
+  //  passed between the process callback and Python in the port's direction
+  jack_ringbuffer_t *audio_queue;
+  // the number of frames of silence an audio output played because its 
+  //  queue ran dry (written only by the process callback)
+  volatile unsigned long audio_underruns;
+  // the arena holding data for events in the receive queue
+  ReceiveArena *arena;
+  // the pool messages in the send queue come from
+  MessagePool *pool;
+  // a single-producer/single-consumer ring of received events, written only 
+  //  by the JACK process callback and read only by Python
+  jack_ringbuffer_t *receive_queue;
+  // the number of received events dropped because the queue was full
+  //  (written only by the JACK process callback)
+  volatile unsigned long receive_overflows;
+  // a semaphore the process callback posts when it adds events to the 
+  //  receive queue, so Python can wait for them without polling
+  sem_t receive_signal;
+  int receive_signal_pending;
+  // a heap of messages waiting to be sent, ordered by the frame they're due
+  //  (used only by the JACK process callback)
+  Message *send_queue;
+  // a lock-free stack of messages added by Python, which any number of 
+  //  threads can push onto and the process callback takes as a whole at 
+  //  the start of each block to merge into the heap
+  _Atomic(Message *) send_intake;
+  atomic_ulong send_sequence;
+  // the number of times Python asked for the send queue to be cleared, 
+  //  and the number of those the process callback has carried out
+  atomic_ulong send_clears;
+  atomic_ulong send_clears_done;
+  // the sample rate the send queue's times were computed at, so they can 
+  //  be rescaled if it changes (used only by the process callback)
+  jack_nframes_t send_rate;
+  // events routed to the port during the current block, in time order
+  //  (used only by the JACK process callback)
+  RoutedEvent *routed;
+  int routed_count;
+  // the number of routed events dropped because there wasn't room for them
+  volatile unsigned long route_overflows;
+  // the number of messages waiting in the send queue, which Python adds to 
+  //  and the process callback subtracts from
+  atomic_ulong send_queue_count;
+  // counters for the process callback to keep, which are only ever added to
+  volatile unsigned long sent;
+  volatile unsigned long received;
+  // the number of events dropped because they didn't fit in the port buffer
+  volatile unsigned long reserve_failures;
+  // the number of times a thread adding messages had to try again because 
+  //  another thread added some at the same moment
+  atomic_ulong intake_retries;
+  // what to do when queued messages don't fit in a block, the number of 
+  //  blocks that happened in, and the number of queued messages dropped 
+  //  or coalesced with later ones because of it
+  volatile int overflow_policy;
+  // whether to coalesce due messages in every block, not just on overflow
+  volatile int coalesce;
+  volatile unsigned long send_overflows;
+  volatile unsigned long send_drops;
+  volatile unsigned long coalesced;
+  // the latest message for each channel and controller while coalescing 
+  //  (used only by the process callback)
+  Message **coalesce_table;
+  // the feed of a player sending on the port, if there is one
+  _Atomic(PlayerFeed *) feed;
+  // where to copy received events if the port is being recorded
+  _Atomic(RecorderTap *) recorder;
+  // a MIDI clock generating on or following the port, if there is one
+  _Atomic(ClockState *) clock;
+  // which received events to keep, packed so the process callback reads 
+  //  the whole filter at once, and the number it discarded
+  _Atomic(uint64_t) receive_filter;
+  volatile unsigned long receive_filtered;
+  // the number of Port objects using this state, plus one while it's in 
+  //  the client's port table
+  atomic_int references;
+  // serializes Python threads reading the port's queues or clearing them, 
+  //  since each queue only supports one reader
+  StateLock lock;
+} ManagedPort;
+
+// define a struct to store the ports a client manages, which the process 
+//  callback reads while other threads swap in new tables to add or remove 
+//  ports, so it never has to wait for them
+typedef struct {
+  int send_count;
+  ManagedPort **send_ports;
+  int receive_count;
+  ManagedPort **receive_ports;
+  int audio_count;
+  ManagedPort **audio_ports;
+  ManagedPort *ports[];
+} PortTable;
+
+// define a struct to store a rule for routing MIDI from one of a client's 
+//  input ports to one of its output ports inside the process callback
+typedef struct {
+  ManagedPort *source;
+  ManagedPort *destination;
+  // a bitmask of the status nibbles (0x8-0xF) of messages to pass
+  uint16_t types;
+  // a bitmask of the source channels of channel messages to pass
+  uint16_t channels;
+  // the channel to move channel messages to, or -1 to leave them alone
+  int channel;
+  // the range of notes to pass and the number of semitones to shift them by
+  int note_low;
+  int note_high;
+  int transpose;
+  // a lookup table for note-on velocities
+  unsigned char velocity[128];
+} Route;
+
+// define a struct to store a set of routing rules that can be swapped into 
+//  the process callback as a whole
+typedef struct {
+  int count;
+  Route routes[];
+} RouteTable;
+
+// define a struct to store a pointer that's been removed from the process 
+//  callback's view but may still be in use until the current block ends
+typedef struct {
+  void *next;
+  void *pointer;
+  void (*free_pointer)(void *);
+  unsigned long cycle;
+} Retired;
+
+// define a struct to store what we know about a port on the JACK server
+typedef struct {
+  jack_port_t *port;
+  char *name;
+  char *type;
+  int flags;
+  // the ports this one is connected to
+  int connection_count;
+  int connection_capacity;
+  jack_port_t **connections;
+} PortRecord;
+
+// define a struct to store an index of the ports on the JACK server and 
+//  their connections, which JACK's notifications keep up to date so we 
+//  don't have to keep asking the server
+typedef struct {
+  pthread_mutex_t lock;
+  // whether the records reflect the server's current state
+  int is_valid;
+  // a count of notifications received, so we can tell whether anything 
+  //  changed while the index was being built
+  unsigned long changes;
+  int count;
+  int capacity;
+  PortRecord *records;
+} PortIndex;
+
 typedef struct {
   PyObject_HEAD
   // public attributes
   PyObject *name;
   PyObject *client;
   PyObject *flags;
+  PyObject *type;
   // private stuff
   jack_port_t *_port;
   int _is_mine;
+  ManagedPort *_managed;
+  PyObject *_weakrefs;
 } Port;
 
-static PyTypeObject TransportType;
 typedef struct {
   PyObject_HEAD
   // public attributes
   PyObject *client;
   // private stuff
+  // whether we hold a reference to the client, which a client's own 
+  //  transport doesn't so the two don't keep each other alive
+  char _owns_client;
 } Transport;
 
-static PyTypeObject ClientType;
+typedef struct {
+  PyObject_HEAD
+  // public attributes
+  double time;
+  jack_nframes_t frame;
+  jack_time_t usecs;
+  // private stuff
+  PyObject *_client;
+  unsigned char *_data;
+  size_t _size;
+  int _slot_class;
+  uint32_t _slot;
+  int _exports;
+} MidiEvent;
+
+// define a struct to store where decoding has got to in one track 
+//  of a standard MIDI file
+typedef struct {
+  // the next byte to decode, or NULL once the track has ended
+  const unsigned char *data;
+  const unsigned char *end;
+  // the absolute tick of the next event
+  uint64_t tick;
+  // the status byte of the last channel message, for running status
+  unsigned char status;
+} SmfTrack;
+
+// define a struct to store where decoding has got to in a standard MIDI 
+//  file, which can be copied to save and restore a position
+typedef struct {
+  // whether ticks are fractions of SMPTE frames rather than of beats
+  int is_smpte;
+  double ticks_per_beat;
+  // the length of a tick at the current tempo, 
+  //  and where the current tempo started
+  double seconds_per_tick;
+  uint64_t tempo_tick;
+  double tempo_time;
+  // the time in seconds of the last event decoded
+  double time;
+  int track_count;
+  SmfTrack tracks[];
+} SmfCursor;
+
+// define a struct to store an event decoded from a standard MIDI file, 
+//  whose data is the head followed by the body (both empty for events that 
+//  aren't sent, like meta events)
+typedef struct {
+  double time;
+  unsigned char head[3];
+  size_t head_size;
+  const unsigned char *body;
+  size_t body_size;
+} SmfEvent;
+
+typedef struct {
+  PyObject_HEAD
+  // public attributes
+  PyObject *port;
+  PyObject *path;
+  double duration;
+  char follow_transport;
+  // private stuff
+  // the memory-mapped file
+  const unsigned char *_data;
+  size_t _size;
+  // the decoder's state at the start of the file and at the start of the 
+  //  loop, and its current position (used only by the player's thread)
+  SmfCursor *_start;
+  SmfCursor *_loop_cursor;
+  SmfCursor *_cursor;
+  SmfEvent _pending;
+  int _has_pending;
+  // the feed to the port's process callback
+  PlayerFeed *_feed;
+  pthread_t _thread;
+  int _thread_running;
+  // a lock protecting everything below and a condition to wake the thread
+  pthread_mutex_t _lock;
+  pthread_cond_t _wake;
+  // requests for the thread
+  int _quit;
+  int _requested;
+  double _seek;
+  double _loop_start;
+  double _loop_end;
+  // the thread's progress: whether it's playing, whether playback is 
+  //  anchored to the frame clock and where, and the file position while 
+  //  it isn't playing
+  int _playing;
+  int _anchored;
+  jack_nframes_t _anchor_frame;
+  double _anchor_time;
+  jack_nframes_t _last_anchor_frame;
+  double _last_anchor_time;
+  double _position;
+  // whether held notes need releasing once the feed has been discarded, 
+  //  and a bitmap of the notes being held on each channel
+  int _release_pending;
+  unsigned char _held[16][16];
+  // the transport's offset from the frame clock when following it
+  jack_nframes_t _transport_offset;
+} Player;
+
+typedef struct {
+  PyObject_HEAD
+  // public attributes
+  PyObject *client;
+  PyObject *ports;
+  PyObject *path;
+  PyObject *format;
+  // private stuff
+  int _is_smf;
+  // the ports being recorded and where each copies its events, with the 
+  //  queue they all share
+  int _track_count;
+  ManagedPort **_managed;
+  RecorderTap **_taps;
+  jack_ringbuffer_t *_ring;
+  // the file being written, and for a standard MIDI file, temporary files 
+  //  holding each track and the time in ticks of its last event
+  //  (used only by the recorder's thread while it's running)
+  FILE *_file;
+  FILE **_tracks;
+  uint64_t *_track_ticks;
+  // the time recording started on the system clock
+  jack_time_t _start_usecs;
+  pthread_t _thread;
+  int _thread_running;
+  // set under the lock by the one call that gets to stop the thread, 
+  //  so no other call joins the thread too
+  int _closing;
+  // a lock and condition to stop the thread with
+  pthread_mutex_t _lock;
+  pthread_cond_t _wake;
+  int _quit;
+  // the number of events written, and the first error writing them
+  atomic_ulong _events;
+  int _error;
+} Recorder;
+
+typedef struct {
+  PyObject_HEAD
+  // public attributes
+  PyObject *port;
+  PyObject *mtc;
+  char is_follower;
+  // private stuff
+  ClockState *_state;
+} Clock;
+
 typedef struct {
   PyObject_HEAD
   // public attributes
@@ -81,1089 +738,8336 @@ typedef struct {
   PyObject *transport;
   // private stuff
   jack_client_t *_client;
-  int _send_port_count;
-  jack_port_t **_send_ports;
-  Message *_midi_send_queue_head;
-  pthread_mutex_t _midi_send_queue_lock;
-  int _receive_port_count;
-  jack_port_t **_receive_ports;
-  Message *_midi_receive_queue_head;
-  Message *_midi_receive_queue_tail;
-  pthread_mutex_t _midi_receive_queue_lock;
+  // a lock that's held exclusively while opening, closing, activating, or 
+  //  deactivating the client, and shared by calls that only use the 
+  //  connection, so those can run in parallel on different threads
+  pthread_rwlock_t _lock;
+  _Atomic(PortTable *) _ports;
+  // a pipe the process callback writes to when any port receives events,
+  //  so the client can be watched with select/poll or an event loop
+  int _notify_fds[2];
+  atomic_int _notify_pending;
+  // the rules for routing MIDI inside the process callback
+  _Atomic(RouteTable *) _routes;
+  // a count of completed process callbacks, so we can tell when it's safe 
+  //  to free things the callback might have been using
+  atomic_ulong _process_cycles;
+  Retired *_retired;
+  // serializes swapping the tables the process callback reads and 
+  //  tracking what's been retired from them
+  StateLock _state_lock;
+  // statistics about the process callback
+  ProcessStats _stats;
+  // the transport's state as of the last cycle
+  TransportSnapshot _transport;
+  // the tempo map used when the client is the timebase master
+  _Atomic(TempoMap *) _tempo_map;
+  // the server's sample rate and buffer size, cached when the client 
+  //  connects and kept up to date by JACK's notifications
+  atomic_uint _sample_rate;
+  atomic_uint _buffer_size;
+  // a Python function to call after every process cycle on a thread of 
+  //  its own, which the process callback wakes with a semaphore; the 
+  //  thread runs until the generation changes
+  PyObject *_cycle_handler;
+  pthread_t _cycle_thread;
+  int _cycle_thread_running;
+  atomic_int _cycle_generation;
+  atomic_int _cycle_enabled;
+  sem_t _cycle_signal;
+  // the frame and size of the last cycle, packed so they're read together
+  _Atomic(uint64_t) _cycle_info;
+  // the number of cycles the handler was still busy with the last one
+  volatile unsigned long _cycle_overruns;
+  // an arena for storing received MIDI data, shared by all input ports
+  ReceiveArena *_arena;
+  // a pool of messages for the send path, shared by all output ports
+  MessagePool *_pool;
+  // an index of the ports on the server and the Port objects we've made 
+  //  for them, keyed by port handle
+  PortIndex _index;
+  PyObject *_port_objects;
+  // the number of entries the Port cache can grow to before the entries 
+  //  for ports that no longer have objects are swept out
+  Py_ssize_t _port_objects_limit;
+  // the names of the default port types, shared by every Port using them
+  PyObject *_midi_type_name;
+  PyObject *_audio_type_name;
 } Client;
 
+typedef struct {
+  PyObject_HEAD
+  // public attributes
+  PyObject *name;
+  PyObject *clients;
+} ClientGroup;
+
 // FORWARD DECLARATIONS *******************************************************
 
+static PyObject * Client_activate(Client *self);
+static void Client_release_transport(Client *self);
+static PyObject * ClientGroup_close(ClientGroup *self);
+static void Client_stop_cycle_thread(Client *self);
 static PyObject * Port_new(PyTypeObject *type, PyObject *args, PyObject *kwds);
 static int Port_init(Port *self, PyObject *args, PyObject *kwds);
+static int Port_init_from_handle(Port *self, Client *client, 
+                                 jack_port_t *handle, const char *name);
 static PyObject * Transport_new(PyTypeObject *type, PyObject *args, PyObject *kwds);
 static int Transport_init(Transport *self, PyObject *args, PyObject *kwds);
 
-// CLIENT *********************************************************************
+// RING BUFFERS ***************************************************************
 
-static PyObject *
-Client_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
-  Client *self;
-  self = (Client *)type->tp_alloc(type, 0);
-  if (self != NULL) {
-    // attributes
-    self->name = Py_None;
-    self->is_open = Py_False;
-    self->is_active = Py_False;
-    self->transport = Py_None;
-    // private stuff
-    self->_send_port_count = 0;
-    self->_send_ports = malloc(sizeof(jack_port_t *) * MAX_PORTS_PER_CLIENT);
-    self->_midi_send_queue_head = NULL;
-    self->_receive_port_count = 0;
-    self->_receive_ports = malloc(sizeof(jack_port_t *) * MAX_PORTS_PER_CLIENT);
-    self->_midi_receive_queue_head = NULL;
-    self->_midi_receive_queue_tail = NULL;
+// copy data into a ring buffer's write vector at the given offset, 
+//  wrapping around into the second segment if needed
+static void
+_ringbuffer_vector_write(jack_ringbuffer_data_t *vec, size_t offset, 
+                         const void *src, size_t size) {
+  const char *c = (const char *)src;
+  if (offset < vec[0].len) {
+    size_t n = vec[0].len - offset;
+    if (n > size) n = size;
+    memcpy(vec[0].buf + offset, c, n);
+    c += n;
+    size -= n;
+    offset = 0;
   }
-  return((PyObject *)self);
+  else {
+    offset -= vec[0].len;
+  }
+  if (size > 0) memcpy(vec[1].buf + offset, c, size);
 }
 
-static int
-Client_init(Client *self, PyObject *args, PyObject *kwds) {
-  PyObject *name=NULL, *tmp;
-  static char *kwlist[] = {"name", NULL};
-  if (! PyArg_ParseTupleAndKeywords(args, kwds, "S", kwlist, 
-                                    &name))
-    return(-1);
-  tmp = self->name;
-  Py_INCREF(name);
-  self->name = name;
-  Py_XDECREF(tmp);
-  // add a transport for the client
-  Transport *transport = (Transport *)Transport_new(&TransportType, NULL, NULL);
-  if (transport != NULL) {
-    Transport_init(transport, Py_BuildValue("(O)", self), Py_BuildValue("{}"));
-    tmp = self->transport;
-    Py_INCREF(transport);
-    self->transport = (PyObject *)transport;
-    Py_XDECREF(tmp);
+// copy data out of a ring buffer's read vector at the given offset, 
+//  wrapping around into the second segment if needed
+static void
+_ringbuffer_vector_read(jack_ringbuffer_data_t *vec, size_t offset, 
+                        void *dest, size_t size) {
+  char *c = (char *)dest;
+  if (offset < vec[0].len) {
+    size_t n = vec[0].len - offset;
+    if (n > size) n = size;
+    memcpy(c, vec[0].buf + offset, n);
+    c += n;
+    size -= n;
+    offset = 0;
   }
+  else {
+    offset -= vec[0].len;
+  }
+  if (size > 0) memcpy(c, vec[1].buf + offset, size);
+}
+
+// write a received event into a ring buffer as a single record, so the 
+//  reader never sees a header without its data, which follows the header 
+//  unless it's stored elsewhere; returns 0 on success or -1 if there isn't 
+//  enough room for the whole record
+static int
+_ringbuffer_write_event(jack_ringbuffer_t *queue, ReceivedEvent *header,
+                        const unsigned char *data, size_t data_size) {
+  jack_ringbuffer_data_t vec[2];
+  size_t record_size = sizeof(ReceivedEvent) + data_size;
+  if (jack_ringbuffer_write_space(queue) < record_size) return(-1);
+  jack_ringbuffer_get_write_vector(queue, vec);
+  _ringbuffer_vector_write(vec, 0, header, sizeof(ReceivedEvent));
+  _ringbuffer_vector_write(vec, sizeof(ReceivedEvent), data, data_size);
+  jack_ringbuffer_write_advance(queue, record_size);
   return(0);
 }
 
-// make sure the client is connected to the JACK server
-static PyObject *
-Client_open(Client *self) {
-  if (self->_client == NULL) {
-    jack_status_t status;
-    self->_client = jack_client_open(PyUnicode_AsUTF8(self->name), 
-      JackNoStartServer, &status);
-    if ((status & JackServerFailed) != 0) {
-      _error("%s", "Failed to connect to the JACK server");
+// RECEIVE ARENA **************************************************************
+
+// the slot sizes and counts of each arena size class, tuned so channel 
+//  messages never run out and a few large SysEx dumps can be held at once
+static const size_t _arena_slot_sizes[RECEIVE_ARENA_CLASSES] = 
+  { 16, 256, 4096, 65536 };
+static const uint32_t _arena_slot_counts[RECEIVE_ARENA_CLASSES] = 
+  { 4096, 512, 64, 8 };
+
+static void ReceiveArena_free(ReceiveArena *arena);
+
+// allocate an arena with all its slots free
+static ReceiveArena *
+ReceiveArena_new(void) {
+  int c;
+  uint32_t i;
+  ReceiveArena *arena = (ReceiveArena *)calloc(1, sizeof(ReceiveArena));
+  if (arena == NULL) return(NULL);
+  for (c = 0; c < RECEIVE_ARENA_CLASSES; c++) {
+    ArenaClass *class = &(arena->classes[c]);
+    class->slot_size = _arena_slot_sizes[c];
+    class->slot_count = _arena_slot_counts[c];
+    class->memory = (unsigned char *)malloc(
+      class->slot_size * class->slot_count);
+    class->free_slots = jack_ringbuffer_create(
+      sizeof(uint32_t) * (class->slot_count + 1));
+    if ((class->memory == NULL) || (class->free_slots == NULL)) {
+      ReceiveArena_free(arena);
       return(NULL);
     }
-    else if ((status & JackServerError) != 0) {
-      _error("%s", "Failed to communicate with the JACK server");
-      return(NULL);
+    // keep everything the process callback touches in memory
+    mlock(class->memory, class->slot_size * class->slot_count);
+    jack_ringbuffer_mlock(class->free_slots);
+    for (i = 0; i < class->slot_count; i++) {
+      jack_ringbuffer_write(class->free_slots, (const char *)&i, 
+                            sizeof(uint32_t));
     }
-    else if ((status & JackFailure) != 0) {
-      _error("%s", "Failed to create a JACK client");
-      return(NULL);
+  }
+  return(arena);
+}
+
+// free an arena and all its slots
+static void
+ReceiveArena_free(ReceiveArena *arena) {
+  int c;
+  if (arena == NULL) return;
+  for (c = 0; c < RECEIVE_ARENA_CLASSES; c++) {
+    ArenaClass *class = &(arena->classes[c]);
+    if (class->memory != NULL) {
+      munlock(class->memory, class->slot_size * class->slot_count);
+      free(class->memory);
     }
-    self->is_open = Py_True;
+    if (class->free_slots != NULL) jack_ringbuffer_free(class->free_slots);
   }
-  Py_RETURN_NONE;
+  free(arena);
 }
 
-// close a client's connection to JACK server
-static PyObject *
-Client_close(Client *self) {
-  if (self->_client != NULL) {
-    jack_client_close(self->_client);
-    self->_client = NULL;
-    self->is_open = Py_False;
+// take a free slot big enough for the given number of bytes, returning its 
+//  memory or NULL if there are none (for use in the process callback only)
+static unsigned char *
+ReceiveArena_take(ReceiveArena *arena, size_t size, int *slot_class, 
+                  uint32_t *slot) {
+  int c;
+  if (arena == NULL) return(NULL);
+  for (c = 0; c < RECEIVE_ARENA_CLASSES; c++) {
+    ArenaClass *class = &(arena->classes[c]);
+    if (class->slot_size < size) continue;
+    if (jack_ringbuffer_read(class->free_slots, (char *)slot, 
+                             sizeof(uint32_t)) == sizeof(uint32_t)) {
+      *slot_class = c;
+      return(class->memory + (class->slot_size * (*slot)));
+    }
   }
-  Py_RETURN_NONE;
+  arena->misses++;
+  return(NULL);
 }
 
-// send queued messages for one of a client's ports
+// get the memory for a slot
+static inline unsigned char *
+ReceiveArena_slot(ReceiveArena *arena, int slot_class, uint32_t slot) {
+  ArenaClass *class = &(arena->classes[slot_class]);
+  return(class->memory + (class->slot_size * slot));
+}
+
+// return a slot to its free list
 static void
-Client_send_messages_for_port(Client *self, jack_port_t *port, 
-                              jack_nframes_t nframes) {
-  unsigned char *buffer;
-  // get a writable buffer for the port
-  void *port_buffer = jack_port_get_buffer(port, nframes);
-  if (port_buffer == NULL) {
-    #ifdef WARN_IN_PROCESS
-      _warn("Failed to get port buffer for sending");
-    #endif
-    return;
+ReceiveArena_give(ReceiveArena *arena, int slot_class, uint32_t slot) {
+  if ((arena == NULL) || (slot_class < 0)) return;
+  StateLock_acquire(&(arena->lock));
+  jack_ringbuffer_write(arena->classes[slot_class].free_slots, 
+                        (const char *)&slot, sizeof(uint32_t));
+  StateLock_release(&(arena->lock));
+}
+
+// get the size of a received event's record in its queue
+static inline size_t
+_received_record_size(const ReceivedEvent *header) {
+  return(sizeof(ReceivedEvent) + 
+         ((header->slot_class < 0) ? header->data_size : 0));
+}
+
+// copy a received event's data out of its arena slot or queue record
+static void
+_received_event_read(ReceiveArena *arena, jack_ringbuffer_data_t *vec, 
+                     size_t offset, const ReceivedEvent *header, void *dest) {
+  if (header->slot_class >= 0) {
+    memcpy(dest, ReceiveArena_slot(arena, header->slot_class, header->slot), 
+           header->data_size);
   }
-  // clear the buffer for writing
-  jack_midi_clear_buffer(port_buffer);
-  // if the queue is empty, we can skip traversing it
-  if (self->_midi_send_queue_head == NULL) return;
-  // ensure the send queue isn't changed while we're traversing it
-  pthread_mutex_t *lock = &(self->_midi_send_queue_lock);
-  pthread_mutex_lock(lock);
-  // send messages
-  Message *last = NULL;
-  Message *message = self->_midi_send_queue_head;
-  Message *next = NULL;
-  int port_send_count = 0;
-  jack_nframes_t last_time = 0;
-  while (message != NULL) {
-    // get messages for the current port
-    if (message->port == port) {
-      // if this message overlaps with another's time, 
-      //  delay it enough that they don't overlap
-      if ((port_send_count > 0) && (message->time <= last_time)) {
-        message->time = last_time + 1;
-      }
-      // get messages that fall in the current block
-      if (message->time < nframes) {
-        buffer = jack_midi_event_reserve(
-          port_buffer, message->time, message->data_size);
-        if (buffer != NULL) {
-          memcpy(buffer, message->data, message->data_size);
-        }
-        else {
-          #ifdef WARN_IN_PROCESS
-            _warn("Failed to allocate a buffer to write a message into");
-          #endif
-        }
-        // keep track of the time of the last message
-        port_send_count++;
-        last_time = message->time;
-        // remove the message from the queue once sent
-        next = (Message *)message->next;
-        message->next = NULL;
-        if (last != NULL) last->next = next;
-        if (message == self->_midi_send_queue_head) {
-          self->_midi_send_queue_head = next;
-        }
-        free(message);
-        message = next;
-        continue;
-      }
-      // shift the times of remaining messages so they get sent in later blocks
-      message->time -= nframes;
-    }
-    // traverse the linked list
-    last = message;
-    message = (Message *)message->next;
+  else {
+    _ringbuffer_vector_read(vec, offset + sizeof(ReceivedEvent), 
+                            dest, header->data_size);
   }
-  // release the queue for changes
-  pthread_mutex_unlock(lock);
 }
 
-// receive and enqueue messages for one of a client's ports
+// discard the given number of bytes of records from the front of a receive 
+//  queue, returning their arena slots
 static void
-Client_receive_messages_for_port(Client *self, jack_port_t *port, 
-                                 jack_nframes_t nframes) {
-  int i;
-  int result;
-  Message *message = NULL;
-  // get a readable buffer for the port
-  void *port_buffer = jack_port_get_buffer(port, nframes);
-  if (port_buffer == NULL) {
-    #ifdef WARN_IN_PROCESS
-      _warn("Failed to get port buffer for receiving");
-    #endif
-    return;
-  }
-  // get the number of events to receive for this block
-  int event_count = jack_midi_get_event_count(port_buffer);
-  // if there are no events for the port, we can skip receiving
-  if (event_count == 0) return;
-  // get the time at the start of the block so event times are synced 
-  //  to the transport
-  jack_position_t pos;
-  jack_transport_query(self->_client, &pos);
-  jack_nframes_t start_frame = pos.frame;
-  // make sure the queue doesn't get changed while we're adding to it
-  pthread_mutex_t *lock = &(self->_midi_receive_queue_lock);
-  pthread_mutex_lock(lock);
-  // receive events
-  jack_midi_event_t event;
-  for (i = 0; i < event_count; i++) {
-    result = jack_midi_event_get(&event, port_buffer, i);
-    if (result != 0) {
-      #ifdef WARN_IN_PROCESS
-        _warn("Failed to get an event at index %d", i);
-      #endif
-      continue;
-    }
-    // allocate a message to store the event
-    message = (Message *)malloc(sizeof(Message) + 
-                (sizeof(unsigned char) * event.size));
-    if (message == NULL) {
-      #ifdef WARN_IN_PROCESS
-        _warn("Failed to allocate memory for the message at index %d "
-              "with data size %d", i, event.size);
-      #endif
-      continue;
-    }
-    // set up the message
-    message->next = NULL;
-    message->port = port;
-    message->time = start_frame + event.time;
-    message->data_size = event.size;
-    memcpy(message->data, event.buffer, event.size);
-    // attach it to the queue
-    if (self->_midi_receive_queue_head == NULL) {
-      self->_midi_receive_queue_head = message;
-    }
-    if (self->_midi_receive_queue_tail != NULL) {
-      self->_midi_receive_queue_tail->next = message;
-    }
-    self->_midi_receive_queue_tail = message;
+_received_events_discard(ReceiveArena *arena, jack_ringbuffer_t *queue, 
+                         size_t bytes) {
+  jack_ringbuffer_data_t vec[2];
+  ReceivedEvent header;
+  size_t offset = 0;
+  jack_ringbuffer_get_read_vector(queue, vec);
+  while (offset + sizeof(ReceivedEvent) <= bytes) {
+    _ringbuffer_vector_read(vec, offset, &header, sizeof(ReceivedEvent));
+    ReceiveArena_give(arena, header.slot_class, header.slot);
+    offset += _received_record_size(&header);
   }
-  // free the queue for updates
-  pthread_mutex_unlock(lock);
+  jack_ringbuffer_read_advance(queue, offset);
 }
 
-// process a block of events for a client
-static int
-Client_process(jack_nframes_t nframes, void *self_ptr) {
+// MESSAGE POOL ***************************************************************
+
+static void MessagePool_free(MessagePool *pool);
+
+// allocate a pool with all its messages free
+static MessagePool *
+MessagePool_new(void) {
   int i;
-  jack_port_t *port;
-  Client *self = (Client *)self_ptr;
-  if (self == NULL) return(-1);
-  // send queued messages
-  for (i = 0; i < self->_send_port_count; i++) {
-    port = self->_send_ports[i];
-    Client_send_messages_for_port(self, port, nframes);
+  MessagePool *pool = (MessagePool *)calloc(1, sizeof(MessagePool));
+  if (pool == NULL) return(NULL);
+  pool->slot_size = sizeof(Message) + MESSAGE_POOL_SLOT_DATA;
+  // keep slots aligned for the pointers at the start of each message
+  pool->slot_size = ((pool->slot_size + sizeof(void *) - 1) / 
+    sizeof(void *)) * sizeof(void *);
+  pool->slot_count = MESSAGE_POOL_SLOTS;
+  pool->memory = (unsigned char *)malloc(pool->slot_size * pool->slot_count);
+  pool->free_stack = (Message **)malloc(sizeof(Message *) * pool->slot_count);
+  // leave room in the return ring for every pooled message plus as many 
+  //  separately allocated ones, so pooled messages always fit
+  pool->returned = jack_ringbuffer_create(
+    sizeof(Message *) * ((2 * pool->slot_count) + 1));
+  if ((pool->memory == NULL) || (pool->free_stack == NULL) || 
+      (pool->returned == NULL)) {
+    MessagePool_free(pool);
+    return(NULL);
   }
-  // enqueue received messages
-  for (i = 0; i < self->_receive_port_count; i++) {
-    port = self->_receive_ports[i];
-    Client_receive_messages_for_port(self, port, nframes);
+  // keep everything the process callback touches in memory
+  mlock(pool->memory, pool->slot_size * pool->slot_count);
+  jack_ringbuffer_mlock(pool->returned);
+  // stack the slots so the lowest addresses get used first
+  for (i = 0; i < pool->slot_count; i++) {
+    pool->free_stack[i] = (Message *)(pool->memory + 
+      (pool->slot_size * (pool->slot_count - 1 - i)));
   }
-  return(0);
+  pool->free_count = pool->slot_count;
+  return(pool);
 }
 
-// start processing events for a client
-static PyObject *
-Client_activate(Client *self) {
-  int result;
-  Client_open(self);
-  if (self->_client == NULL) return(NULL);
-  if (self->is_active != Py_True) {
-    // connect a callback for processing MIDI messages
-    result = jack_set_process_callback(self->_client, Client_process, self);
-    if (result != 0) {
-      _warn("Failed to set a callback for the JACK client (error %i), "
-            "MIDI send/receive will be disabled", result);
-    }
-    result = jack_activate(self->_client);
-    if (result != 0) {
-      _error("Failed to activate the JACK client (error %i)", result);
-      return(NULL);
+// recycle messages the process callback has sent (only while holding 
+//  the pool's lock, since the free stack and the ring's read side aren't 
+//  shared)
+static void
+MessagePool_collect(MessagePool *pool) {
+  Message *message;
+  while (jack_ringbuffer_read(pool->returned, (char *)&message, 
+                              sizeof(Message *)) == sizeof(Message *)) {
+    if (message->pooled) {
+      pool->free_stack[pool->free_count++] = message;
+      pool->in_use--;
     }
-    self->is_active = Py_True;
+    else free(message);
   }
-  Py_RETURN_NONE;
+}
+static void
+MessagePool_drain(MessagePool *pool) {
+  if ((pool == NULL) || (pool->returned == NULL)) return;
+  StateLock_acquire(&(pool->lock));
+  MessagePool_collect(pool);
+  StateLock_release(&(pool->lock));
 }
 
-// stop processing events for a client
-static PyObject *
-Client_deactivate(Client *self) {
-  if ((self->is_active == Py_True) && (self->_client != NULL)) {
-    int result = jack_deactivate(self->_client);
-    if (result != 0) {
-      _error("Failed to deactivate the JACK client (error %i)", result);
-      return(NULL);
+// free a pool, including any separately allocated messages it's holding
+static void
+MessagePool_free(MessagePool *pool) {
+  if (pool == NULL) return;
+  MessagePool_drain(pool);
+  if (pool->memory != NULL) {
+    munlock(pool->memory, pool->slot_size * pool->slot_count);
+    free(pool->memory);
+  }
+  free(pool->free_stack);
+  if (pool->returned != NULL) jack_ringbuffer_free(pool->returned);
+  free(pool);
+}
+
+// get a message with room for the given number of data bytes, taking it 
+//  from the pool if it fits or allocating it otherwise
+static Message *
+MessagePool_get(MessagePool *pool, size_t bytes) {
+  Message *message = NULL;
+  if ((pool != NULL) && (bytes > MESSAGE_POOL_SLOT_DATA)) {
+    StateLock_acquire(&(pool->lock));
+    pool->large++;
+    StateLock_release(&(pool->lock));
+  }
+  else if (pool != NULL) {
+    StateLock_acquire(&(pool->lock));
+    if (pool->free_count == 0) MessagePool_collect(pool);
+    if (pool->free_count > 0) {
+      message = pool->free_stack[--pool->free_count];
+      message->pooled = 1;
+      pool->in_use++;
+      if (pool->in_use > pool->high_water) pool->high_water = pool->in_use;
+      StateLock_release(&(pool->lock));
+      return(message);
     }
-    self->is_active = Py_False;
+    pool->misses++;
+    StateLock_release(&(pool->lock));
   }
-  Py_RETURN_NONE;
+  message = malloc(sizeof(Message) + (sizeof(unsigned char) * bytes));
+  if (message == NULL) return(NULL);
+  message->pooled = 0;
+  return(message);
 }
 
-// use a client to list ports (this will also list ports owned by other 
-//  clients unless the "mine" parameter is set to True)
-static PyObject *
-Client_get_ports(Client *self, PyObject *args, PyObject *kwds) {
-  int i;
-  const char *name_pattern = NULL;
-  const char *type_pattern = NULL;
-  unsigned long flags = 0;
-  PyObject *mine = NULL;
-  static char *kwlist[] = {"name_pattern", "type_pattern", "flags", "mine", NULL};
-  if (! PyArg_ParseTupleAndKeywords(args, kwds, "|sskO", kwlist, 
-                                    &name_pattern, &type_pattern, &flags, &mine))
+// return a message that was never handed to the process callback
+static void
+MessagePool_put(MessagePool *pool, Message *message) {
+  if (message == NULL) return;
+  if (message->pooled) {
+    StateLock_acquire(&(pool->lock));
+    pool->free_stack[pool->free_count++] = message;
+    pool->in_use--;
+    StateLock_release(&(pool->lock));
+  }
+  else free(message);
+}
+
+// hand a sent message back to Python to be recycled 
+//  (for use in the process callback only)
+static void
+MessagePool_recycle(MessagePool *pool, Message *message) {
+  size_t space;
+  if (pool == NULL) {
+    free(message);
+    return;
+  }
+  space = jack_ringbuffer_write_space(pool->returned);
+  // pooled messages always have room, but separately allocated ones 
+  //  can't take up the space reserved for them
+  if ((message->pooled) || 
+      (space >= sizeof(Message *) * (pool->slot_count + 1))) {
+    jack_ringbuffer_write(pool->returned, (const char *)&message, 
+                          sizeof(Message *));
+  }
+  else {
+    pool->rt_frees++;
+    free(message);
+  }
+}
+
+// SEND SCHEDULING ************************************************************
+
+// return whether absolute frame a comes before frame b, allowing for JACK's
+//  frame counter to wrap around
+static inline int
+_frame_before(jack_nframes_t a, jack_nframes_t b) {
+  return((int32_t)(a - b) < 0);
+}
+
+// return whether message a should be sent before message b
+static inline int
+_message_before(Message *a, Message *b) {
+  if (a->time != b->time) return(_frame_before(a->time, b->time));
+  return(a->sequence < b->sequence);
+}
+
+static inline int
+_message_rank(Message *message) {
+  return((message == NULL) ? 0 : message->rank);
+}
+
+// merge two leftist heaps of messages, returning the new root; this only 
+//  walks the right spines of the heaps, which are at most logarithmic 
+//  in length, so it's cheap enough to use from the process callback
+static Message *
+_message_heap_merge(Message *a, Message *b) {
+  Message *tmp;
+  if (a == NULL) return(b);
+  if (b == NULL) return(a);
+  if (_message_before(b, a)) {
+    tmp = a; a = b; b = tmp;
+  }
+  a->right = _message_heap_merge((Message *)a->right, b);
+  if (_message_rank((Message *)a->left) < _message_rank((Message *)a->right)) {
+    tmp = (Message *)a->left;
+    a->left = a->right;
+    a->right = tmp;
+  }
+  a->rank = _message_rank((Message *)a->right) + 1;
+  return(a);
+}
+
+// add a message to a heap, returning the new root
+static Message *
+_message_heap_push(Message *heap, Message *message) {
+  message->left = NULL;
+  message->right = NULL;
+  message->rank = 1;
+  return(_message_heap_merge(heap, message));
+}
+
+// remove the earliest message from a heap, returning the new root
+static Message *
+_message_heap_pop(Message *heap) {
+  Message *root = _message_heap_merge(
+    (Message *)heap->left, (Message *)heap->right);
+  heap->left = NULL;
+  heap->right = NULL;
+  return(root);
+}
+
+// scale the times of messages in a heap that are still to come by a ratio, 
+//  relative to the given frame, which keeps them in the same order so the 
+//  heap stays valid; this uses the messages' list links as a stack instead 
+//  of recursing down the heap's left spines
+static void
+_message_heap_rescale(Message *heap, jack_nframes_t now, double ratio) {
+  Message *stack = heap;
+  Message *message;
+  if (heap != NULL) heap->next = NULL;
+  while ((message = stack) != NULL) {
+    stack = (Message *)message->next;
+    message->next = NULL;
+    int32_t delta = (int32_t)(message->time - now);
+    if (delta > 0) {
+      double scaled = (double)delta * ratio;
+      if (scaled > (double)INT32_MAX) scaled = (double)INT32_MAX;
+      message->time = now + (jack_nframes_t)scaled;
+    }
+    if (message->left != NULL) {
+      ((Message *)message->left)->next = stack;
+      stack = (Message *)message->left;
+    }
+    if (message->right != NULL) {
+      ((Message *)message->right)->next = stack;
+      stack = (Message *)message->right;
+    }
+  }
+}
+
+// free every message in a heap without recursing down its 
+//  (possibly long) left spines
+static void
+_message_heap_free(MessagePool *pool, Message *heap) {
+  Message *child;
+  while (heap != NULL) {
+    if (heap->left != NULL) {
+      // rotate the left child up so the tree becomes a list we can unwind
+      child = (Message *)heap->left;
+      heap->left = child->right;
+      child->right = heap;
+      heap = child;
+    }
+    else {
+      child = (Message *)heap->right;
+      MessagePool_put(pool, heap);
+      heap = child;
+    }
+  }
+}
+
+// hand every message in a heap back to be recycled, the same way 
+//  _message_heap_free does it, returning the number of messages 
+//  (for use in the process callback only)
+static unsigned long
+_message_heap_recycle(MessagePool *pool, Message *heap) {
+  Message *child;
+  unsigned long count = 0;
+  while (heap != NULL) {
+    if (heap->left != NULL) {
+      child = (Message *)heap->left;
+      heap->left = child->right;
+      child->right = heap;
+      heap = child;
+    }
+    else {
+      child = (Message *)heap->right;
+      MessagePool_recycle(pool, heap);
+      heap = child;
+      count++;
+    }
+  }
+  return(count);
+}
+
+// MANAGED PORTS **************************************************************
+
+static void ManagedPort_free(ManagedPort *managed);
+
+// allocate state for a port the client will manage; MIDI input ports get 
+//  a receive queue of the given size in bytes and MIDI output ports get room 
+//  for routed events, while audio ports get a queue of the given number 
+//  of frames
+static ManagedPort *
+ManagedPort_new(jack_port_t *port, unsigned long flags, int is_audio, 
+                size_t queue_size) {
+  ManagedPort *managed = (ManagedPort *)malloc(sizeof(ManagedPort));
+  if (managed == NULL) return(NULL);
+  managed->port = port;
+  managed->is_audio = is_audio;
+  managed->is_input = ((flags & JackPortIsInput) != 0);
+  managed->audio_queue = NULL;
+  managed->audio_underruns = 0;
+  managed->arena = NULL;
+  managed->pool = NULL;
+  managed->routed = NULL;
+  managed->routed_count = 0;
+  managed->route_overflows = 0;
+  atomic_init(&(managed->send_queue_count), 0);
+  managed->sent = 0;
+  managed->received = 0;
+  managed->reserve_failures = 0;
+  atomic_init(&(managed->intake_retries), 0);
+  managed->overflow_policy = OVERFLOW_DEFER;
+  managed->coalesce = 0;
+  managed->send_overflows = 0;
+  managed->send_drops = 0;
+  managed->coalesced = 0;
+  managed->coalesce_table = NULL;
+  atomic_init(&(managed->feed), NULL);
+  atomic_init(&(managed->recorder), NULL);
+  atomic_init(&(managed->clock), NULL);
+  atomic_init(&(managed->receive_filter), RECEIVE_FILTER_ALL);
+  managed->receive_filtered = 0;
+  atomic_init(&(managed->references), 0);
+  StateLock_init(&(managed->lock));
+  managed->receive_queue = NULL;
+  managed->receive_overflows = 0;
+  managed->receive_signal_pending = 0;
+  managed->send_queue = NULL;
+  atomic_init(&(managed->send_intake), NULL);
+  atomic_init(&(managed->send_sequence), 0);
+  atomic_init(&(managed->send_clears), 0);
+  atomic_init(&(managed->send_clears_done), 0);
+  managed->send_rate = 0;
+  sem_init(&(managed->receive_signal), 0, 0);
+  if (is_audio) {
+    // leave room for one more byte than the samples, since a ring buffer 
+    //  can never be completely full
+    managed->audio_queue = jack_ringbuffer_create(
+      (sizeof(jack_default_audio_sample_t) * queue_size) + 1);
+    if (managed->audio_queue == NULL) {
+      ManagedPort_free(managed);
+      return(NULL);
+    }
+    jack_ringbuffer_mlock(managed->audio_queue);
+    return(managed);
+  }
+  if ((flags & JackPortIsInput) != 0) {
+    managed->receive_queue = jack_ringbuffer_create(queue_size);
+    if (managed->receive_queue == NULL) {
+      ManagedPort_free(managed);
+      return(NULL);
+    }
+    // keep the queue from being paged out so the process callback never 
+    //  faults on it
+    jack_ringbuffer_mlock(managed->receive_queue);
+  }
+  if ((flags & JackPortIsOutput) != 0) {
+    managed->routed = (RoutedEvent *)malloc(
+      sizeof(RoutedEvent) * MAX_ROUTED_EVENTS_PER_BLOCK);
+    managed->coalesce_table = (Message **)calloc(
+      16 * COALESCE_KEYS_PER_CHANNEL, sizeof(Message *));
+    if ((managed->routed == NULL) || (managed->coalesce_table == NULL)) {
+      ManagedPort_free(managed);
+      return(NULL);
+    }
+  }
+  return(managed);
+}
+
+// free state for a managed port
+static void
+ManagedPort_free(ManagedPort *managed) {
+  if (managed == NULL) return;
+  if (managed->receive_queue != NULL) {
+    // return the arena slots of any events still in the queue
+    _received_events_discard(managed->arena, managed->receive_queue, 
+      jack_ringbuffer_read_space(managed->receive_queue));
+    jack_ringbuffer_free(managed->receive_queue);
+    managed->receive_queue = NULL;
+  }
+  if (managed->audio_queue != NULL) {
+    jack_ringbuffer_free(managed->audio_queue);
+    managed->audio_queue = NULL;
+  }
+  _message_heap_free(managed->pool, managed->send_queue);
+  managed->send_queue = NULL;
+  Message *message = atomic_exchange(&(managed->send_intake), NULL);
+  while (message != NULL) {
+    Message *next = (Message *)message->next;
+    MessagePool_put(managed->pool, message);
+    message = next;
+  }
+  free(managed->routed);
+  managed->routed = NULL;
+  free(managed->coalesce_table);
+  managed->coalesce_table = NULL;
+  sem_destroy(&(managed->receive_signal));
+  free(managed);
+}
+
+// drop a reference to a port's state, freeing it if nothing's using it
+static void
+ManagedPort_release(ManagedPort *managed) {
+  if (managed == NULL) return;
+  if (atomic_fetch_sub(&(managed->references), 1) <= 1) {
+    ManagedPort_free(managed);
+  }
+}
+
+// allocate a port table with room for the given numbers of ports
+static PortTable *
+PortTable_new(int send_count, int receive_count, int audio_count) {
+  PortTable *table = (PortTable *)malloc(sizeof(PortTable) + 
+    (sizeof(ManagedPort *) * (send_count + receive_count + audio_count)));
+  if (table == NULL) return(NULL);
+  table->send_count = send_count;
+  table->send_ports = &(table->ports[0]);
+  table->receive_count = receive_count;
+  table->receive_ports = &(table->ports[send_count]);
+  table->audio_count = audio_count;
+  table->audio_ports = &(table->ports[send_count + receive_count]);
+  return(table);
+}
+
+// make a copy of a port table with a port added or removed
+static PortTable *
+PortTable_with(PortTable *table, ManagedPort *add, ManagedPort *remove) {
+  int i;
+  int send_count = (table != NULL) ? table->send_count : 0;
+  int receive_count = (table != NULL) ? table->receive_count : 0;
+  int audio_count = (table != NULL) ? table->audio_count : 0;
+  int is_audio = (add != NULL) && (add->is_audio);
+  int is_input = (add != NULL) && (! is_audio) && (add->is_input);
+  int is_output = (add != NULL) && (! is_audio) && (! is_input);
+  PortTable *copy = PortTable_new(
+    send_count + (is_output ? 1 : 0),
+    receive_count + (is_input ? 1 : 0),
+    audio_count + (is_audio ? 1 : 0));
+  if (copy == NULL) return(NULL);
+  copy->send_count = 0;
+  copy->receive_count = 0;
+  copy->audio_count = 0;
+  for (i = 0; i < send_count; i++) {
+    if (table->send_ports[i] == remove) continue;
+    copy->send_ports[copy->send_count++] = table->send_ports[i];
+  }
+  for (i = 0; i < receive_count; i++) {
+    if (table->receive_ports[i] == remove) continue;
+    copy->receive_ports[copy->receive_count++] = table->receive_ports[i];
+  }
+  for (i = 0; i < audio_count; i++) {
+    if (table->audio_ports[i] == remove) continue;
+    copy->audio_ports[copy->audio_count++] = table->audio_ports[i];
+  }
+  if (add != NULL) {
+    if (is_audio) copy->audio_ports[copy->audio_count++] = add;
+    else if (is_input) copy->receive_ports[copy->receive_count++] = add;
+    else copy->send_ports[copy->send_count++] = add;
+  }
+  return(copy);
+}
+
+// ROUTING ********************************************************************
+
+// add an event to the events routed to an output port in this block, 
+//  keeping them in time order and placing it after any at the same time; 
+//  if bytes is non-NULL the event's data is copied from it
+static void
+_routed_event_add(ManagedPort *destination, jack_nframes_t time, 
+                  const unsigned char *data, size_t data_size, 
+                  const unsigned char *bytes) {
+  if (destination->routed_count >= MAX_ROUTED_EVENTS_PER_BLOCK) {
+    destination->route_overflows++;
+    return;
+  }
+  RoutedEvent *routed = destination->routed;
+  int i = destination->routed_count;
+  while ((i > 0) && (routed[i - 1].time > time)) {
+    routed[i] = routed[i - 1];
+    i--;
+  }
+  routed[i].time = time;
+  routed[i].data_size = data_size;
+  if (bytes != NULL) {
+    memcpy(routed[i].bytes, bytes, data_size);
+    routed[i].data = NULL;
+  }
+  else {
+    routed[i].data = data;
+  }
+  destination->routed_count++;
+}
+
+// get the data for a routed event
+static inline const unsigned char *
+_routed_event_data(RoutedEvent *routed) {
+  return((routed->data != NULL) ? routed->data : routed->bytes);
+}
+
+// route the events a player has decoded for an output port that are due 
+//  in this block, or discard them all if the player asked for that
+static void
+_route_player_feed(ManagedPort *managed, PlayerFeed *feed, 
+                   jack_nframes_t start_frame, jack_nframes_t nframes) {
+  jack_ringbuffer_t *ring = feed->ring;
+  unsigned long flushes = atomic_load_explicit(&(feed->flushes), 
+                                               memory_order_acquire);
+  if (flushes != atomic_load_explicit(&(feed->flushes_done), 
+                                      memory_order_relaxed)) {
+    jack_ringbuffer_read_advance(ring, jack_ringbuffer_read_space(ring));
+    atomic_store_explicit(&(feed->flushes_done), flushes, 
+                          memory_order_release);
+    return;
+  }
+  jack_nframes_t end_frame = start_frame + nframes;
+  jack_ringbuffer_data_t vec[2];
+  PlayerRecord record;
+  unsigned char bytes[3];
+  feed->scratch_used = 0;
+  while (jack_ringbuffer_read_space(ring) >= sizeof(PlayerRecord)) {
+    // the player writes events as whole records, so if we can see the 
+    //  header we can see the data
+    jack_ringbuffer_get_read_vector(ring, vec);
+    _ringbuffer_vector_read(vec, 0, &record, sizeof(PlayerRecord));
+    if (! _frame_before(record.frame, end_frame)) break;
+    // send events that were due in an earlier block as soon as possible
+    jack_nframes_t time = _frame_before(record.frame, start_frame) ? 
+      0 : record.frame - start_frame;
+    if (record.size <= sizeof(bytes)) {
+      _ringbuffer_vector_read(vec, sizeof(PlayerRecord), bytes, record.size);
+      _routed_event_add(managed, time, NULL, record.size, bytes);
+    }
+    else if (feed->scratch_used + record.size <= PLAYER_SCRATCH_SIZE) {
+      unsigned char *data = feed->scratch + feed->scratch_used;
+      _ringbuffer_vector_read(vec, sizeof(PlayerRecord), data, record.size);
+      _routed_event_add(managed, time, data, record.size, NULL);
+      feed->scratch_used += record.size;
+    }
+    else managed->route_overflows++;
+    jack_ringbuffer_read_advance(ring, sizeof(PlayerRecord) + record.size);
+  }
+}
+
+// publish a clock's tempo, whether it's running, and its position in 
+//  quarter notes for Python to read (called only by the process callback)
+static void
+_clock_publish(ClockState *clock, double tempo, int running, 
+               double position) {
+  unsigned int sequence = atomic_load_explicit(&(clock->sequence), 
+                                               memory_order_relaxed);
+  atomic_store_explicit(&(clock->sequence), sequence + 1, 
+                        memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  clock->published_tempo = tempo;
+  clock->published_running = running;
+  clock->published_position = position;
+  atomic_store_explicit(&(clock->sequence), sequence + 2, 
+                        memory_order_release);
+}
+
+// fill in an MTC full frame message for a frame count at a clock's rate
+static void
+_clock_full_frame(ClockState *clock, uint64_t frames, unsigned char *hours, 
+                  unsigned char *minutes, unsigned char *seconds, 
+                  unsigned char *frame) {
+  int fps = (int)ceil(clock->mtc_fps - 0.01);
+  // drop-frame timecode skips the first two frame numbers of every minute 
+  //  except every tenth one, to keep up with 29.97 frames per second
+  if (clock->mtc_type == 2) {
+    uint64_t tens = frames / 17982;
+    uint64_t rest = frames % 17982;
+    frames += (18 * tens) + ((rest >= 2) ? (2 * ((rest - 2) / 1798)) : 0);
+  }
+  *frame = (unsigned char)(frames % fps);
+  uint64_t total_seconds = frames / fps;
+  *seconds = (unsigned char)(total_seconds % 60);
+  *minutes = (unsigned char)((total_seconds / 60) % 60);
+  *hours = (unsigned char)((total_seconds / 3600) % 24);
+}
+
+// add clock and timecode messages for a clock generator on an output port 
+//  to the events routed to it in this block, following the transport
+static void
+_route_clock(ManagedPort *managed, ClockState *clock, 
+             const CycleTimes *cycle, jack_nframes_t rate) {
+  if ((clock->is_follower) || (rate == 0)) return;
+  const jack_position_t *pos = &(cycle->transport);
+  jack_nframes_t nframes = cycle->nframes;
+  int rolling = (cycle->transport_state == JackTransportRolling);
+  // find the tempo in quarter notes and the position in quarter notes, 
+  //  from the timebase master if there is one
+  double quarters_per_second, quarters;
+  if ((pos->valid & JackPositionBBT) && (pos->beats_per_minute > 0.0) && 
+      (pos->beat_type > 0.0) && (pos->ticks_per_beat > 0.0)) {
+    double quarters_per_beat = 4.0 / pos->beat_type;
+    quarters_per_second = (pos->beats_per_minute / 60.0) * quarters_per_beat;
+    quarters = ((((double)(pos->bar - 1) * pos->beats_per_bar) + 
+                 (double)(pos->beat - 1) + 
+                 (pos->tick / pos->ticks_per_beat)) * quarters_per_beat);
+  }
+  else {
+    quarters_per_second = atomic_load_explicit(&(clock->tempo), 
+                                               memory_order_relaxed) / 60.0;
+    quarters = ((double)pos->frame / (double)rate) * quarters_per_second;
+  }
+  if (quarters < 0.0) quarters = 0.0;
+  // see whether the transport moved other than by playing
+  int jumped = (clock->has_position) && 
+    (pos->frame != clock->expected_frame);
+  clock->has_position = 1;
+  clock->expected_frame = pos->frame + (rolling ? nframes : 0);
+  // tell the receiver where we are when the transport starts or moves
+  unsigned char message[3];
+  int started = (rolling) && (! clock->was_rolling);
+  int stopped = (! rolling) && (clock->was_rolling);
+  if ((stopped) || ((jumped) && (rolling) && (! started))) {
+    message[0] = 0xFC;
+    _routed_event_add(managed, 0, NULL, 1, message);
+  }
+  if ((started) && (pos->frame == 0)) {
+    message[0] = 0xFA;
+    _routed_event_add(managed, 0, NULL, 1, message);
+  }
+  else if ((started) || (jumped)) {
+    // song position pointers count sixteenth notes
+    double sixteenths = floor(quarters * 4.0);
+    unsigned int position = (sixteenths < 16383.0) ? 
+      (unsigned int)sixteenths : 16383;
+    message[0] = 0xF2;
+    message[1] = position & 0x7F;
+    message[2] = (position >> 7) & 0x7F;
+    _routed_event_add(managed, 0, NULL, 3, message);
+    if (rolling) {
+      message[0] = 0xFB;
+      _routed_event_add(managed, 0, NULL, 1, message);
+    }
+  }
+  double seconds = (double)pos->frame / (double)rate;
+  if ((clock->mtc_type >= 0) && ((started) || (jumped))) {
+    unsigned char *full = clock->full_frame;
+    full[0] = 0xF0;
+    full[1] = 0x7F;
+    full[2] = 0x7F;
+    full[3] = 0x01;
+    full[4] = 0x01;
+    _clock_full_frame(clock, (uint64_t)(seconds * clock->mtc_fps), 
+                      &(full[5]), &(full[6]), &(full[7]), &(full[8]));
+    full[5] |= (unsigned char)(clock->mtc_type << 5);
+    full[9] = 0xF7;
+    _routed_event_add(managed, 0, full, sizeof(clock->full_frame), NULL);
+  }
+  clock->was_rolling = rolling;
+  _clock_publish(clock, quarters_per_second * 60.0, rolling, quarters);
+  if (! rolling) return;
+  // send clock pulses that fall in this block
+  double offset;
+  if ((clock->send_clock) && (quarters_per_second > 0.0)) {
+    double pulses = quarters * (double)CLOCK_PULSES_PER_QUARTER;
+    double frames_per_pulse = (double)rate / 
+      (quarters_per_second * (double)CLOCK_PULSES_PER_QUARTER);
+    offset = (ceil(pulses - 1.0e-9) - pulses) * frames_per_pulse;
+    message[0] = 0xF8;
+    while (offset < (double)nframes) {
+      _routed_event_add(managed, (jack_nframes_t)offset, NULL, 1, message);
+      offset += frames_per_pulse;
+    }
+  }
+  // send MTC quarter frames that fall in this block, each carrying one 
+  //  nibble of the time at the start of its group of eight
+  if (clock->mtc_type >= 0) {
+    double quarter_frames_per_second = clock->mtc_fps * 4.0;
+    double quarter_frames = seconds * quarter_frames_per_second;
+    double index = ceil(quarter_frames - 1.0e-9);
+    double frames_per_quarter_frame = 
+      (double)rate / quarter_frames_per_second;
+    offset = (index - quarter_frames) * frames_per_quarter_frame;
+    while (offset < (double)nframes) {
+      uint64_t quarter_frame = (uint64_t)index;
+      int piece = (int)(quarter_frame % 8);
+      unsigned char hours, minutes, secs, frame;
+      _clock_full_frame(clock, (quarter_frame - piece) / 4, 
+                        &hours, &minutes, &secs, &frame);
+      unsigned char value = 0;
+      switch (piece) {
+        case 0: value = frame & 0x0F; break;
+        case 1: value = frame >> 4; break;
+        case 2: value = secs & 0x0F; break;
+        case 3: value = secs >> 4; break;
+        case 4: value = minutes & 0x0F; break;
+        case 5: value = minutes >> 4; break;
+        case 6: value = hours & 0x0F; break;
+        case 7: value = (hours >> 4) | (clock->mtc_type << 1); break;
+      }
+      message[0] = 0xF1;
+      message[1] = (unsigned char)((piece << 4) | value);
+      _routed_event_add(managed, (jack_nframes_t)offset, NULL, 2, message);
+      index += 1.0;
+      offset += frames_per_quarter_frame;
+    }
+  }
+}
+
+// apply a route to the events arriving at its source port in this block
+static void
+_route_messages(Route *route, jack_nframes_t nframes) {
+  void *port_buffer = jack_port_get_buffer(route->source->port, nframes);
+  if (port_buffer == NULL) return;
+  int event_count = jack_midi_get_event_count(port_buffer);
+  int i;
+  unsigned char bytes[3];
+  unsigned char status, kind;
+  int changed, note;
+  jack_midi_event_t event;
+  for (i = 0; i < event_count; i++) {
+    if (jack_midi_event_get(&event, port_buffer, i) != 0) continue;
+    if (event.size == 0) continue;
+    status = event.buffer[0];
+    // JACK never gives us running status, so skip anything malformed
+    if (status < 0x80) continue;
+    kind = status >> 4;
+    if ((route->types & (1 << (kind - 0x8))) == 0) continue;
+    // pass system messages through unchanged
+    if (kind == 0xF) {
+      _routed_event_add(route->destination, event.time, 
+                        event.buffer, event.size, NULL);
+      continue;
+    }
+    if ((route->channels & (1 << (status & 0x0F))) == 0) continue;
+    // channel messages are never longer than 3 bytes
+    if (event.size > 3) continue;
+    memcpy(bytes, event.buffer, event.size);
+    changed = 0;
+    if (route->channel >= 0) {
+      bytes[0] = (status & 0xF0) | route->channel;
+      changed = 1;
+    }
+    // filter and transform notes, including polyphonic aftertouch
+    if ((kind <= 0xA) && (event.size >= 2)) {
+      note = bytes[1];
+      if ((note < route->note_low) || (note > route->note_high)) continue;
+      note += route->transpose;
+      if ((note < 0) || (note > 127)) continue;
+      if (note != bytes[1]) {
+        bytes[1] = (unsigned char)note;
+        changed = 1;
+      }
+      // apply the velocity curve to note-ons, never turning them into 
+      //  note-offs
+      if ((kind == 0x9) && (event.size >= 3) && (bytes[2] > 0)) {
+        unsigned char velocity = route->velocity[bytes[2] & 0x7F];
+        if (velocity != bytes[2]) {
+          bytes[2] = velocity;
+          changed = 1;
+        }
+      }
+    }
+    _routed_event_add(route->destination, event.time, 
+                      event.buffer, event.size, changed ? bytes : NULL);
+  }
+}
+
+// get the state for a port that can be used as either end of a route
+static ManagedPort *
+_route_port(Client *client, PyObject *port_obj, int direction, 
+            const char *key) {
+  if ((port_obj == NULL) || 
+      (! PyObject_TypeCheck(port_obj, _module_state(client)->PortType))) {
+    PyErr_Format(PyExc_TypeError, "The route's %s must be a Port", key);
     return(NULL);
-  // see if we're only listing the ports of this client
-  int mine_only = (mine != NULL) ? PyObject_IsTrue(mine) : 0;
-  // make sure we're connected to JACK
-  Client_open(self);
-  if (self->_client == NULL) return(NULL);
-  // get a list of port names
-  const char **ports = jack_get_ports(self->_client, 
-    name_pattern, type_pattern, flags);
-  // convert the port names into a list of Port objects
-  PyObject *return_list = PyList_New(0);
-  if (return_list == NULL) return(NULL);
-  if (! ports) return(return_list);
-  for (i = 0; ports[i]; ++i) {
-    // discard outside ports if requested
-    if (mine_only) {
-      jack_port_t *port_handle = jack_port_by_name(self->_client, ports[i]);
-      if ((port_handle == NULL) || 
-          (! jack_port_is_mine(self->_client, port_handle))) {
-        continue;
+  }
+  Port *port = (Port *)port_obj;
+  if ((port->client != (PyObject *)client) || (! port->_is_mine) || 
+      (port->_managed == NULL)) {
+    PyErr_Format(PyExc_ValueError, 
+      "The route's %s must be a port created by this client", key);
+    return(NULL);
+  }
+  if (port->_managed->is_audio) {
+    PyErr_Format(PyExc_ValueError, "The route's %s must be a MIDI port", key);
+    return(NULL);
+  }
+  if ((jack_port_flags(port->_port) & direction) == 0) {
+    PyErr_Format(PyExc_ValueError, "The route's %s must be an %s port", 
+      key, (direction == JackPortIsInput) ? "input" : "output");
+    return(NULL);
+  }
+  return(port->_managed);
+}
+
+// get an integer from a route's (or other dict's) settings if it's there, 
+//  checking its range
+static int
+_route_int(PyObject *spec, const char *owner, const char *key, 
+           int low, int high, int *value) {
+  PyObject *obj = PyDict_GetItemString(spec, key);
+  if ((obj == NULL) || (obj == Py_None)) return(0);
+  long n = PyLong_AsLong(obj);
+  if ((n == -1) && (PyErr_Occurred())) return(-1);
+  if ((n < low) || (n > high)) {
+    PyErr_Format(PyExc_ValueError, 
+      "The %s's %s must be between %d and %d", owner, key, low, high);
+    return(-1);
+  }
+  *value = (int)n;
+  return(0);
+}
+
+// get a bitmask from a sequence of integers in a route's (or other dict's) 
+//  settings, offsetting each by the given amount and checking its range
+static int
+_route_mask(PyObject *spec, const char *owner, const char *key, 
+            int low, int high, int shift, uint16_t *mask) {
+  PyObject *obj = PyDict_GetItemString(spec, key);
+  if ((obj == NULL) || (obj == Py_None)) return(0);
+  PyObject *seq = PySequence_Fast(obj, "");
+  if (seq == NULL) {
+    PyErr_Format(PyExc_TypeError, 
+      "The %s's %s must be a sequence of integers", owner, key);
+    return(-1);
+  }
+  *mask = 0;
+  Py_ssize_t i;
+  Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+  for (i = 0; i < count; i++) {
+    long n = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+    if ((n == -1) && (PyErr_Occurred())) goto error;
+    if ((n < low) || (n > high)) {
+      PyErr_Format(PyExc_ValueError, 
+        "Values in the %s's %s must be between %d and %d", 
+        owner, key, low, high);
+      goto error;
+    }
+    *mask |= (uint16_t)(1 << ((n >> shift) - (low >> shift)));
+  }
+  Py_DECREF(seq);
+  return(0);
+error:
+  Py_DECREF(seq);
+  return(-1);
+}
+
+// compile a dict of settings into a route
+static int
+_route_from_dict(Client *client, PyObject *spec, Route *route) {
+  if (! PyDict_Check(spec)) {
+    PyErr_SetString(PyExc_TypeError, "Each route must be a dict");
+    return(-1);
+  }
+  route->source = _route_port(client, PyDict_GetItemString(spec, "source"), 
+                              JackPortIsInput, "source");
+  if (route->source == NULL) return(-1);
+  route->destination = _route_port(client, 
+    PyDict_GetItemString(spec, "destination"), 
+    JackPortIsOutput, "destination");
+  if (route->destination == NULL) return(-1);
+  // by default, pass everything through unchanged
+  route->types = 0xFF;
+  route->channels = 0xFFFF;
+  route->channel = -1;
+  route->note_low = 0;
+  route->note_high = 127;
+  route->transpose = 0;
+  int i;
+  for (i = 0; i < 128; i++) route->velocity[i] = (unsigned char)i;
+  if (_route_mask(spec, "route", "types", 0x80, 0xFF, 4, 
+                  &(route->types)) < 0) return(-1);
+  if (_route_mask(spec, "route", "channels", 0, 15, 0, 
+                  &(route->channels)) < 0) return(-1);
+  if (_route_int(spec, "route", "channel", 0, 15, &(route->channel)) < 0) 
+    return(-1);
+  if (_route_int(spec, "route", "transpose", -127, 127, 
+                 &(route->transpose)) < 0) return(-1);
+  PyObject *notes = PyDict_GetItemString(spec, "notes");
+  if ((notes != NULL) && (notes != Py_None)) {
+    if (! PyArg_ParseTuple(notes, "ii;The route's notes must be a "
+                                  "(low, high) tuple", 
+                           &(route->note_low), &(route->note_high))) {
+      return(-1);
+    }
+    if ((route->note_low < 0) || (route->note_low > 127) || 
+        (route->note_high < 0) || (route->note_high > 127)) {
+      PyErr_SetString(PyExc_ValueError, 
+        "The route's notes must be between 0 and 127");
+      return(-1);
+    }
+    if (route->note_low > route->note_high) {
+      PyErr_SetString(PyExc_ValueError, 
+        "The route's low note must not be higher than its high note");
+      return(-1);
+    }
+  }
+  PyObject *velocity = PyDict_GetItemString(spec, "velocity");
+  if ((velocity != NULL) && (velocity != Py_None)) {
+    PyObject *seq = PySequence_Fast(velocity, 
+      "The route's velocity must be a sequence of 128 integers");
+    if (seq == NULL) return(-1);
+    if (PySequence_Fast_GET_SIZE(seq) != 128) {
+      Py_DECREF(seq);
+      PyErr_SetString(PyExc_ValueError, 
+        "The route's velocity must be a sequence of 128 integers");
+      return(-1);
+    }
+    for (i = 0; i < 128; i++) {
+      long n = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+      if ((n == -1) && (PyErr_Occurred())) {
+        Py_DECREF(seq);
+        return(-1);
+      }
+      if ((n < 1) || (n > 127)) {
+        Py_DECREF(seq);
+        PyErr_SetString(PyExc_ValueError, 
+          "Values in the route's velocity must be between 1 and 127");
+        return(-1);
+      }
+      route->velocity[i] = (unsigned char)n;
+    }
+    Py_DECREF(seq);
+  }
+  return(0);
+}
+
+// PORT INDEX *****************************************************************
+
+// free the memory used by a port record
+static void
+_port_record_free(PortRecord *record) {
+  free(record->name);
+  free(record->type);
+  free(record->connections);
+  record->name = NULL;
+  record->type = NULL;
+  record->connections = NULL;
+  record->connection_count = 0;
+  record->connection_capacity = 0;
+}
+
+// add a port to the ones a record is connected to, returning -1 on failure
+static int
+_port_record_link(PortRecord *record, jack_port_t *other) {
+  int i;
+  for (i = 0; i < record->connection_count; i++) {
+    if (record->connections[i] == other) return(0);
+  }
+  if (record->connection_count >= record->connection_capacity) {
+    int capacity = (record->connection_capacity > 0) ? 
+      record->connection_capacity * 2 : 4;
+    jack_port_t **connections = (jack_port_t **)realloc(
+      record->connections, sizeof(jack_port_t *) * capacity);
+    if (connections == NULL) return(-1);
+    record->connections = connections;
+    record->connection_capacity = capacity;
+  }
+  record->connections[record->connection_count++] = other;
+  return(0);
+}
+
+// remove a port from the ones a record is connected to, keeping the order
+static void
+_port_record_unlink(PortRecord *record, jack_port_t *other) {
+  int i;
+  for (i = 0; i < record->connection_count; i++) {
+    if (record->connections[i] == other) {
+      record->connection_count--;
+      memmove(&(record->connections[i]), &(record->connections[i + 1]), 
+              sizeof(jack_port_t *) * (record->connection_count - i));
+      return;
+    }
+  }
+}
+
+// remove all records from an index
+static void
+PortIndex_clear(PortIndex *index) {
+  int i;
+  for (i = 0; i < index->count; i++) {
+    _port_record_free(&(index->records[i]));
+  }
+  free(index->records);
+  index->records = NULL;
+  index->count = 0;
+  index->capacity = 0;
+}
+
+// find the record for a port, returning its position or -1 if there's none
+static int
+PortIndex_find(PortIndex *index, jack_port_t *port) {
+  int i;
+  for (i = 0; i < index->count; i++) {
+    if (index->records[i].port == port) return(i);
+  }
+  return(-1);
+}
+
+// find the record for a port by name, returning its position or -1
+static int
+PortIndex_find_name(PortIndex *index, const char *name) {
+  int i;
+  for (i = 0; i < index->count; i++) {
+    if (strcmp(index->records[i].name, name) == 0) return(i);
+  }
+  return(-1);
+}
+
+// add a record for a port, returning it or NULL on failure
+static PortRecord *
+PortIndex_add(PortIndex *index, jack_port_t *port) {
+  if (index->count >= index->capacity) {
+    int capacity = (index->capacity > 0) ? index->capacity * 2 : 64;
+    PortRecord *records = (PortRecord *)realloc(index->records, 
+      sizeof(PortRecord) * capacity);
+    if (records == NULL) return(NULL);
+    index->records = records;
+    index->capacity = capacity;
+  }
+  PortRecord *record = &(index->records[index->count]);
+  record->port = port;
+  record->name = strdup(jack_port_name(port));
+  record->type = strdup(jack_port_type(port));
+  record->flags = jack_port_flags(port);
+  record->connection_count = 0;
+  record->connection_capacity = 0;
+  record->connections = NULL;
+  if ((record->name == NULL) || (record->type == NULL)) {
+    _port_record_free(record);
+    return(NULL);
+  }
+  index->count++;
+  return(record);
+}
+
+// remove the record at the given position along with any connections to it,
+//  keeping the rest in the order they were registered
+static void
+PortIndex_remove(PortIndex *index, int position) {
+  int i;
+  jack_port_t *port = index->records[position].port;
+  _port_record_free(&(index->records[position]));
+  index->count--;
+  memmove(&(index->records[position]), &(index->records[position + 1]), 
+          sizeof(PortRecord) * (index->count - position));
+  for (i = 0; i < index->count; i++) {
+    _port_record_unlink(&(index->records[i]), port);
+  }
+}
+
+// record that two ports have been connected or disconnected, 
+//  returning -1 on failure
+static int
+PortIndex_connect(PortIndex *index, jack_port_t *a, jack_port_t *b, 
+                  int connected) {
+  int i = PortIndex_find(index, a);
+  int j = PortIndex_find(index, b);
+  if ((i < 0) || (j < 0)) return(-1);
+  if (connected) {
+    if (_port_record_link(&(index->records[i]), b) < 0) return(-1);
+    if (_port_record_link(&(index->records[j]), a) < 0) return(-1);
+  }
+  else {
+    _port_record_unlink(&(index->records[i]), b);
+    _port_record_unlink(&(index->records[j]), a);
+  }
+  return(0);
+}
+
+// fill an empty index by asking the server about all its ports, 
+//  returning -1 on failure (this makes blocking calls, so it should be 
+//  called without holding the GIL)
+static int
+PortIndex_build(PortIndex *index, jack_client_t *client) {
+  int i, j;
+  int result = 0;
+  const char **names = jack_get_ports(client, NULL, NULL, 0);
+  if (names == NULL) return(0);
+  for (i = 0; names[i]; i++) {
+    jack_port_t *port = jack_port_by_name(client, names[i]);
+    if (port == NULL) continue;
+    if (PortIndex_add(index, port) == NULL) {
+      result = -1;
+      break;
+    }
+  }
+  jack_free(names);
+  for (i = 0; (result == 0) && (i < index->count); i++) {
+    PortRecord *record = &(index->records[i]);
+    const char **connections = jack_port_get_all_connections(
+      client, record->port);
+    if (connections == NULL) continue;
+    for (j = 0; connections[j]; j++) {
+      jack_port_t *other = jack_port_by_name(client, connections[j]);
+      if ((other != NULL) && (_port_record_link(record, other) < 0)) {
+        result = -1;
+        break;
       }
     }
-    Port *port = (Port *)Port_new(&PortType, NULL, NULL);
-    if (port != NULL) {
-      PyObject *name = PyUnicode_FromString(ports[i]);
-      Port_init(port, Py_BuildValue("(O,S)", self, name), Py_BuildValue("{}"));
-      Py_XDECREF(name);
-      if (PyList_Append(return_list, (PyObject *)port) < 0) {
-        _error("Failed to append a port to the list");
-        Py_DECREF(return_list);
-        jack_free(ports);
-        return(NULL);
-      }
+    jack_free(connections);
+  }
+  return(result);
+}
+
+// define a struct to store a port selected from the index, so that we can 
+//  make Port objects for it after releasing the index
+typedef struct {
+  jack_port_t *port;
+  char *name;
+} PortMatch;
+
+// free a list of selected ports
+static void
+_port_matches_free(PortMatch *matches, int count) {
+  int i;
+  if (matches == NULL) return;
+  for (i = 0; i < count; i++) free(matches[i].name);
+  free(matches);
+}
+
+// CLIENT *********************************************************************
+
+static PyObject *
+Client_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+  Client *self;
+  self = (Client *)type->tp_alloc(type, 0);
+  if (self != NULL) {
+    // attributes
+    Py_INCREF(Py_None);
+    self->name = Py_None;
+    self->is_open = Py_False;
+    self->is_active = Py_False;
+    Py_INCREF(Py_None);
+    self->transport = Py_None;
+    // private stuff
+    atomic_init(&(self->_ports), NULL);
+    atomic_init(&(self->_notify_pending), 0);
+    atomic_init(&(self->_routes), NULL);
+    atomic_init(&(self->_process_cycles), 0);
+    self->_retired = NULL;
+    StateLock_init(&(self->_state_lock));
+    memset(&(self->_stats), 0, sizeof(ProcessStats));
+    memset(&(self->_transport), 0, sizeof(TransportSnapshot));
+    atomic_init(&(self->_transport.sequence), 0);
+    atomic_init(&(self->_tempo_map), NULL);
+    atomic_init(&(self->_sample_rate), 0);
+    atomic_init(&(self->_buffer_size), 0);
+    self->_arena = NULL;
+    self->_pool = NULL;
+    self->_cycle_handler = NULL;
+    self->_cycle_thread_running = 0;
+    atomic_init(&(self->_cycle_generation), 0);
+    atomic_init(&(self->_cycle_enabled), 0);
+    atomic_init(&(self->_cycle_info), 0);
+    self->_cycle_overruns = 0;
+    sem_init(&(self->_cycle_signal), 0, 0);
+    pthread_rwlock_init(&(self->_lock), NULL);
+    pthread_mutex_init(&(self->_index.lock), NULL);
+    self->_index.is_valid = 0;
+    self->_index.changes = 0;
+    self->_index.count = 0;
+    self->_index.capacity = 0;
+    self->_index.records = NULL;
+    self->_port_objects = PyDict_New();
+    self->_port_objects_limit = PORT_CACHE_MIN_LIMIT;
+    self->_midi_type_name = NULL;
+    self->_audio_type_name = NULL;
+    // make both ends of the notification pipe nonblocking, so the process 
+    //  callback can't block on a full pipe and draining it can't hang
+    if (pipe(self->_notify_fds) == 0) {
+      fcntl(self->_notify_fds[0], F_SETFL, O_NONBLOCK);
+      fcntl(self->_notify_fds[1], F_SETFL, O_NONBLOCK);
+      fcntl(self->_notify_fds[0], F_SETFD, FD_CLOEXEC);
+      fcntl(self->_notify_fds[1], F_SETFD, FD_CLOEXEC);
+    }
+    else {
+      self->_notify_fds[0] = -1;
+      self->_notify_fds[1] = -1;
+    }
+  }
+  return((PyObject *)self);
+}
+
+static int
+Client_init(Client *self, PyObject *args, PyObject *kwds) {
+  PyObject *name=NULL, *tmp;
+  static char *kwlist[] = {"name", NULL};
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "U", kwlist, 
+                                    &name))
+    return(-1);
+  tmp = self->name;
+  Py_INCREF(name);
+  self->name = name;
+  Py_XDECREF(tmp);
+  // add a transport for the client
+  Transport *transport = (Transport *)Transport_new(
+    _module_state(self)->TransportType, NULL, NULL);
+  if (transport != NULL) {
+    // set up the transport directly rather than building arguments for 
+    //  it, pointing it back at the client without taking a reference
+    Py_DECREF(transport->client);
+    transport->client = (PyObject *)self;
+    transport->_owns_client = 0;
+    Client_release_transport(self);
+    self->transport = (PyObject *)transport;
+  }
+  return(0);
+}
+
+// let go of the client's own transport, pointing it at None if something 
+//  else is keeping it alive so it can't be used to reach a freed client
+static void
+Client_release_transport(Client *self) {
+  Transport *transport = (Transport *)self->transport;
+  self->transport = NULL;
+  if ((transport != NULL) && ((PyObject *)transport != Py_None) && 
+      (! transport->_owns_client)) {
+    Py_INCREF(Py_None);
+    transport->client = Py_None;
+    transport->_owns_client = 1;
+  }
+  Py_XDECREF(transport);
+}
+
+// get the state the client keeps for one of its ports, 
+//  or NULL if it isn't managing that port
+static ManagedPort *
+Client_find_managed_port(Client *self, jack_port_t *port) {
+  int i;
+  PortTable *table = atomic_load(&(self->_ports));
+  if (table == NULL) return(NULL);
+  for (i = 0; i < table->receive_count; i++) {
+    if (table->receive_ports[i]->port == port) return(table->receive_ports[i]);
+  }
+  for (i = 0; i < table->send_count; i++) {
+    if (table->send_ports[i]->port == port) return(table->send_ports[i]);
+  }
+  for (i = 0; i < table->audio_count; i++) {
+    if (table->audio_ports[i]->port == port) return(table->audio_ports[i]);
+  }
+  return(NULL);
+}
+
+// reset the notification pipe so it doesn't stay readable once events 
+//  have been taken off the queues; this drains the pipe before clearing the 
+//  flag so the process callback can never leave the flag set with the 
+//  pipe empty
+static void
+Client_acknowledge_notification(Client *self) {
+  char drain[64];
+  if (atomic_load(&(self->_notify_pending)) == 0) return;
+  if (self->_notify_fds[0] >= 0) {
+    while (read(self->_notify_fds[0], drain, sizeof(drain)) > 0) { }
+  }
+  atomic_store(&(self->_notify_pending), 0);
+}
+
+// get a file descriptor that becomes readable when any of the client's ports 
+//  receive events, for use with select, poll, or an asyncio event loop
+static PyObject *
+Client_fileno(Client *self) {
+  if (self->_notify_fds[0] < 0) {
+    _error(self, "Failed to create a notification pipe for the client");
+    return(NULL);
+  }
+  // the process callback only writes to the pipe while the client is active
+  Client_activate(self);
+  if (self->is_active != Py_True) return(NULL);
+  return(PyLong_FromLong(self->_notify_fds[0]));
+}
+
+// free things retired from the process callback once it can no longer be 
+//  using them, or all of them if force is set and we know it isn't running
+static void
+Client_reclaim(Client *self, int force) {
+  unsigned long cycle = atomic_load_explicit(&(self->_process_cycles), 
+                                             memory_order_acquire);
+  int idle = force || (self->is_active != Py_True);
+  StateLock_acquire(&(self->_state_lock));
+  Retired **link = &(self->_retired);
+  Retired *retired;
+  while ((retired = *link) != NULL) {
+    // since process callbacks never overlap, any callback that started 
+    //  before the pointer was retired has finished once the count moves
+    if (idle || (retired->cycle != cycle)) {
+      *link = retired->next;
+      retired->free_pointer(retired->pointer);
+      free(retired);
+    }
+    else link = (Retired **)&(retired->next);
+  }
+  StateLock_release(&(self->_state_lock));
+}
+
+// hand a pointer removed from the process callback's view to be freed once 
+//  the callback is done with it, returning -1 if we couldn't track it
+static int
+Client_retire(Client *self, void *pointer, void (*free_pointer)(void *)) {
+  if (pointer == NULL) return(0);
+  Retired *retired = (Retired *)malloc(sizeof(Retired));
+  if (retired == NULL) return(-1);
+  retired->pointer = pointer;
+  retired->free_pointer = free_pointer;
+  retired->cycle = atomic_load_explicit(&(self->_process_cycles), 
+                                        memory_order_acquire);
+  StateLock_acquire(&(self->_state_lock));
+  retired->next = self->_retired;
+  self->_retired = retired;
+  StateLock_release(&(self->_state_lock));
+  Client_reclaim(self, 0);
+  return(0);
+}
+
+// replace the rules for routing MIDI between the client's ports
+static PyObject *
+Client_set_routes(Client *self, PyObject *args, PyObject *kwds) {
+  PyObject *routes_obj = NULL;
+  static char *kwlist[] = { "routes", NULL };
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "O", kwlist, &routes_obj)) {
+    return(NULL);
+  }
+  RouteTable *routes = NULL;
+  if (routes_obj != Py_None) {
+    PyObject *seq = PySequence_Fast(routes_obj, 
+      "Routes must be a sequence of dicts");
+    if (seq == NULL) return(NULL);
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+    if (count > 0) {
+      routes = (RouteTable *)malloc(sizeof(RouteTable) + 
+                                    (sizeof(Route) * count));
+      if (routes == NULL) {
+        Py_DECREF(seq);
+        return(PyErr_NoMemory());
+      }
+      routes->count = (int)count;
+      Py_ssize_t i;
+      for (i = 0; i < count; i++) {
+        if (_route_from_dict(self, PySequence_Fast_GET_ITEM(seq, i), 
+                             &(routes->routes[i])) < 0) {
+          free(routes);
+          Py_DECREF(seq);
+          return(NULL);
+        }
+      }
+    }
+    Py_DECREF(seq);
+  }
+  // swap in the new table and keep the old one until the callback is done
+  StateLock_acquire(&(self->_state_lock));
+  RouteTable *old = atomic_exchange(&(self->_routes), routes);
+  StateLock_release(&(self->_state_lock));
+  if (Client_retire(self, old, free) < 0) {
+    // if we can't track it, it's safer to leak it than to free it early
+    return(PyErr_NoMemory());
+  }
+  Py_RETURN_NONE;
+}
+
+// start managing a port, returning -1 on failure
+static int
+Client_add_managed_port(Client *self, ManagedPort *managed) {
+  StateLock_acquire(&(self->_state_lock));
+  PortTable *old = atomic_load(&(self->_ports));
+  PortTable *table = PortTable_with(old, managed, NULL);
+  if (table != NULL) {
+    atomic_store_explicit(&(self->_ports), table, memory_order_release);
+  }
+  StateLock_release(&(self->_state_lock));
+  if (table == NULL) return(-1);
+  managed->references++;
+  // if we can't track the old table, it's safer to leak it than free it early
+  Client_retire(self, old, free);
+  return(0);
+}
+
+// wait until the process callback can no longer be using anything that's 
+//  been removed from its view, giving up if the server seems to be stuck
+static void
+Client_synchronize(Client *self) {
+  if (self->is_active != Py_True) return;
+  unsigned long cycle = atomic_load(&(self->_process_cycles));
+  int i;
+  Py_BEGIN_ALLOW_THREADS
+  for (i = 0; i < 1000; i++) {
+    if (atomic_load(&(self->_process_cycles)) != cycle) break;
+    usleep(1000);
+  }
+  Py_END_ALLOW_THREADS
+}
+
+// stop managing a port, returning once the process callback is done with it
+static int
+Client_remove_managed_port(Client *self, ManagedPort *managed) {
+  int i;
+  StateLock_acquire(&(self->_state_lock));
+  PortTable *old = atomic_load(&(self->_ports));
+  PortTable *table = PortTable_with(old, NULL, managed);
+  if (table == NULL) {
+    StateLock_release(&(self->_state_lock));
+    return(-1);
+  }
+  // drop any routes that use the port
+  RouteTable *old_routes = atomic_load(&(self->_routes));
+  RouteTable *routes = NULL;
+  if (old_routes != NULL) {
+    routes = (RouteTable *)malloc(sizeof(RouteTable) + 
+                                  (sizeof(Route) * old_routes->count));
+    if (routes == NULL) {
+      StateLock_release(&(self->_state_lock));
+      free(table);
+      return(-1);
+    }
+    routes->count = 0;
+    for (i = 0; i < old_routes->count; i++) {
+      Route *route = &(old_routes->routes[i]);
+      if ((route->source == managed) || (route->destination == managed)) {
+        continue;
+      }
+      routes->routes[routes->count++] = *route;
+    }
+    if (routes->count == 0) {
+      free(routes);
+      routes = NULL;
+    }
+  }
+  atomic_store_explicit(&(self->_routes), routes, memory_order_release);
+  atomic_store_explicit(&(self->_ports), table, memory_order_release);
+  StateLock_release(&(self->_state_lock));
+  Client_retire(self, old_routes, free);
+  Client_retire(self, old, free);
+  Client_synchronize(self);
+  Client_reclaim(self, 0);
+  managed->references--;
+  return(0);
+}
+
+// take the client's lock, releasing the GIL while we wait for it so a thread 
+//  holding the lock can always get the GIL back; since the GIL is never held 
+//  while waiting for the lock, the two can't deadlock
+static void
+Client_lock(Client *self, int exclusive) {
+  Py_BEGIN_ALLOW_THREADS
+  if (exclusive) pthread_rwlock_wrlock(&(self->_lock));
+  else pthread_rwlock_rdlock(&(self->_lock));
+  Py_END_ALLOW_THREADS
+}
+static void
+Client_unlock(Client *self) {
+  pthread_rwlock_unlock(&(self->_lock));
+}
+
+// mark the port index as out of date, for when we stop getting notifications
+static void
+Client_invalidate_index(Client *self) {
+  pthread_mutex_lock(&(self->_index.lock));
+  self->_index.is_valid = 0;
+  pthread_mutex_unlock(&(self->_index.lock));
+}
+
+// make sure the client is connected to the JACK server, 
+//  with the client's lock held exclusively
+static int
+Client_open_locked(Client *self) {
+  if (self->_client != NULL) return(0);
+  const char *name = PyUnicode_AsUTF8(self->name);
+  if (name == NULL) return(-1);
+  jack_client_t *client;
+  jack_status_t status;
+  Py_BEGIN_ALLOW_THREADS
+  client = jack_client_open(name, JackNoStartServer, &status);
+  Py_END_ALLOW_THREADS
+  if ((status & JackServerFailed) != 0) {
+    _error(self, "%s", "Failed to connect to the JACK server");
+  }
+  else if ((status & JackServerError) != 0) {
+    _error(self, "%s", "Failed to communicate with the JACK server");
+  }
+  else if ((status & JackFailure) != 0) {
+    _error(self, "%s", "Failed to create a JACK client");
+  }
+  else if (client != NULL) {
+    self->_client = client;
+    self->is_open = Py_True;
+    atomic_store(&(self->_sample_rate), jack_get_sample_rate(client));
+    atomic_store(&(self->_buffer_size), jack_get_buffer_size(client));
+    return(0);
+  }
+  if (client != NULL) jack_client_close(client);
+  return(-1);
+}
+
+// get the server's sample rate, which is cached when the client connects 
+//  so converting times doesn't need a call into JACK
+static inline jack_nframes_t
+Client_sample_rate(Client *self) {
+  return(atomic_load_explicit(&(self->_sample_rate), memory_order_relaxed));
+}
+
+// make sure the client is connected to the JACK server
+static PyObject *
+Client_open(Client *self) {
+  Client_lock(self, 1);
+  int result = Client_open_locked(self);
+  Client_unlock(self);
+  if (result < 0) return(NULL);
+  Py_RETURN_NONE;
+}
+
+// close a client's connection to JACK server
+static PyObject *
+Client_close(Client *self) {
+  // stop calling the cycle handler, since there won't be any more cycles
+  Client_stop_cycle_thread(self);
+  Client_lock(self, 1);
+  if (self->_client != NULL) {
+    jack_client_t *client = self->_client;
+    Py_BEGIN_ALLOW_THREADS
+    jack_client_close(client);
+    Py_END_ALLOW_THREADS
+    self->_client = NULL;
+    self->is_open = Py_False;
+    self->is_active = Py_False;
+    Client_invalidate_index(self);
+  }
+  Client_unlock(self);
+  Py_RETURN_NONE;
+}
+
+// get whether a controller's value stands on its own, rather than 
+//  selecting a bank or parameter that later messages depend on, adjusting 
+//  one, or changing the channel's mode, any of which need every message 
+//  kept in order
+static inline int
+_coalesce_controller(int controller) {
+  switch (controller) {
+    // bank select, most and least significant bytes
+    case 0: case 32:
+    // data entry, increment, and decrement
+    case 6: case 38: case 96: case 97:
+    // NRPN and RPN select
+    case 98: case 99: case 100: case 101:
+      return(0);
+  }
+  // channel mode messages
+  return(controller < 120);
+}
+
+// get the key a message can be coalesced by, which identifies its channel 
+//  and controller, or -1 if it can't be coalesced
+static inline int
+_coalesce_key(Message *message) {
+  if (message->data_size < 2) return(-1);
+  unsigned char status = message->data[0];
+  int base = (status & 0x0F) * COALESCE_KEYS_PER_CHANNEL;
+  int controller;
+  switch (status & 0xF0) {
+    case 0xB0:
+      if (message->data_size != 3) return(-1);
+      controller = message->data[1] & 0x7F;
+      if (! _coalesce_controller(controller)) return(-1);
+      return(base + controller);
+    case 0xE0:
+      if (message->data_size != 3) return(-1);
+      return(base + 128);
+    case 0xD0:
+      if (message->data_size != 2) return(-1);
+      return(base + 129);
+  }
+  return(-1);
+}
+
+// forget the messages that could be replaced by later ones on the channel 
+//  a message that can't be coalesced is for, or on every channel for a 
+//  system message other than real-time ones, so nothing coalesced moves 
+//  past it
+static inline void
+_coalesce_barrier(Message **table, Message *message) {
+  if (message->data_size < 1) return;
+  unsigned char status = message->data[0];
+  if ((status >= 0x80) && (status < 0xF0)) {
+    memset(table + ((status & 0x0F) * COALESCE_KEYS_PER_CHANNEL), 0, 
+           sizeof(Message *) * COALESCE_KEYS_PER_CHANNEL);
+  }
+  else if ((status >= 0xF0) && (status < 0xF8)) {
+    memset(table, 0, sizeof(Message *) * 16 * COALESCE_KEYS_PER_CHANNEL);
+  }
+}
+
+// make sure the times in a port's send queue are for the given sample rate, 
+//  rescaling the ones still to come if the rate changed since they were 
+//  queued (with the send queue locked)
+static void
+_send_queue_set_rate(ManagedPort *managed, jack_nframes_t rate, 
+                     jack_nframes_t now) {
+  if ((managed->send_rate == rate) || (rate == 0)) return;
+  if (managed->send_rate != 0) {
+    _message_heap_rescale(managed->send_queue, now, 
+                          (double)rate / (double)managed->send_rate);
+  }
+  managed->send_rate = rate;
+}
+
+// count messages taken off a port's send queue (in the process callback)
+static inline void
+_send_queue_taken(ManagedPort *managed, unsigned long count) {
+  atomic_fetch_sub_explicit(&(managed->send_queue_count), count, 
+                            memory_order_relaxed);
+}
+
+// merge the messages Python has added to a port since the last block into 
+//  its send queue, first clearing the queue if Python asked for that and 
+//  rescaling it if the sample rate changed; taking the whole intake in one 
+//  exchange means the callback never waits for a producer 
+//  (for use in the process callback only)
+static void
+_send_queue_merge_intake(ManagedPort *managed, jack_nframes_t rate, 
+                         jack_nframes_t now) {
+  Message *message, *next;
+  unsigned long clears = atomic_load_explicit(&(managed->send_clears), 
+                                              memory_order_acquire);
+  if (clears != atomic_load_explicit(&(managed->send_clears_done), 
+                                     memory_order_relaxed)) {
+    _send_queue_taken(managed, 
+      _message_heap_recycle(managed->pool, managed->send_queue));
+    managed->send_queue = NULL;
+    message = atomic_exchange_explicit(&(managed->send_intake), NULL, 
+                                       memory_order_acquire);
+    for (; message != NULL; message = next) {
+      next = (Message *)message->next;
+      MessagePool_recycle(managed->pool, message);
+      _send_queue_taken(managed, 1);
+    }
+    atomic_store_explicit(&(managed->send_clears_done), clears, 
+                          memory_order_release);
+  }
+  _send_queue_set_rate(managed, rate, now);
+  message = atomic_exchange_explicit(&(managed->send_intake), NULL, 
+                                     memory_order_acquire);
+  for (; message != NULL; message = next) {
+    next = (Message *)message->next;
+    message->next = NULL;
+    managed->send_queue = _message_heap_push(managed->send_queue, message);
+  }
+}
+
+// drop queued messages due before the given frame that are replaced by 
+//  later ones for the same channel and controller (for use in the process 
+//  callback only, with the send queue locked)
+static void
+_send_queue_coalesce(ManagedPort *managed, jack_nframes_t end_frame) {
+  Message *message;
+  Message *head = NULL;
+  Message *tail = NULL;
+  int key;
+  if (managed->coalesce_table == NULL) return;
+  while (((message = managed->send_queue) != NULL) && 
+         (_frame_before(message->time, end_frame))) {
+    managed->send_queue = _message_heap_pop(message);
+    message->next = NULL;
+    if (tail != NULL) tail->next = message;
+    else head = message;
+    tail = message;
+    // mark any earlier message with the same key as replaced, unless 
+    //  there's a message that can't be coalesced between them
+    key = _coalesce_key(message);
+    if (key < 0) {
+      _coalesce_barrier(managed->coalesce_table, message);
+      continue;
+    }
+    if (managed->coalesce_table[key] != NULL) {
+      managed->coalesce_table[key]->rank = 0;
+    }
+    managed->coalesce_table[key] = message;
+  }
+  // put back everything that wasn't replaced, in its original order
+  while (head != NULL) {
+    message = head;
+    head = (Message *)message->next;
+    message->next = NULL;
+    key = _coalesce_key(message);
+    if (key >= 0) managed->coalesce_table[key] = NULL;
+    if (message->rank == 0) {
+      _send_queue_taken(managed, 1);
+      managed->coalesced++;
+      MessagePool_recycle(managed->pool, message);
+    }
+    else {
+      managed->send_queue = _message_heap_push(managed->send_queue, message);
+    }
+  }
+}
+
+// apply a port's overflow policy to queued messages that were due in a 
+//  block but didn't fit in it (for use in the process callback only, 
+//  with the send queue locked)
+static void
+_send_queue_overflow(ManagedPort *managed, jack_nframes_t start_frame, 
+                     jack_nframes_t end_frame) {
+  Message *message;
+  managed->send_overflows++;
+  switch (managed->overflow_policy) {
+    // drop messages that were already late when the block started, so 
+    //  a burst can't build up a backlog that delays everything after it
+    case OVERFLOW_DROP_OLDEST:
+      while (((message = managed->send_queue) != NULL) && 
+             (_frame_before(message->time, start_frame))) {
+        managed->send_queue = _message_heap_pop(message);
+        _send_queue_taken(managed, 1);
+        managed->send_drops++;
+        MessagePool_recycle(managed->pool, message);
+      }
+      break;
+    // keep only the latest of the due messages for each channel and 
+    //  controller, since those replace each other's values anyway
+    case OVERFLOW_COALESCE:
+      _send_queue_coalesce(managed, end_frame);
+      break;
+    // otherwise leave the rest of the queue to be sent as soon as possible
+    default:
+      break;
+  }
+}
+
+// send queued messages for one of a client's ports
+static void
+Client_send_messages_for_port(Client *self, ManagedPort *managed, 
+                              const CycleTimes *cycle) {
+  jack_nframes_t start_frame = cycle->frame;
+  jack_nframes_t nframes = cycle->nframes;
+  unsigned char *buffer;
+  // get a writable buffer for the port
+  void *port_buffer = jack_port_get_buffer(managed->port, nframes);
+  if (port_buffer == NULL) {
+    #if WARN_IN_PROCESS
+      _warn("Failed to get port buffer for sending");
+    #endif
+    managed->route_overflows += managed->routed_count;
+    managed->routed_count = 0;
+    return;
+  }
+  // clear the buffer for writing
+  jack_midi_clear_buffer(port_buffer);
+  // take in whatever Python has queued since the last block
+  _send_queue_merge_intake(managed, 
+    atomic_load_explicit(&(self->_sample_rate), memory_order_relaxed), 
+    start_frame);
+  // add anything a player has decoded for this block to the routed events
+  PlayerFeed *feed = atomic_load_explicit(&(managed->feed), 
+                                          memory_order_acquire);
+  if (feed != NULL) _route_player_feed(managed, feed, start_frame, nframes);
+  // likewise for clock and timecode
+  ClockState *clock = atomic_load_explicit(&(managed->clock), 
+                                           memory_order_acquire);
+  if (clock != NULL) {
+    _route_clock(managed, clock, cycle, 
+      atomic_load_explicit(&(self->_sample_rate), memory_order_relaxed));
+  }
+  // if there's nothing queued or routed, we can skip the rest
+  int routed_index = 0;
+  int routed_count = managed->routed_count;
+  managed->routed_count = 0;
+  if ((managed->send_queue == NULL) && (routed_count == 0)) return;
+  // send messages that are due before the end of this block, which are 
+  //  always at the top of the heap, so we never touch any others, and 
+  //  merge them with any routed events in time order
+  jack_nframes_t end_frame = start_frame + nframes;
+  // if the port is set to coalesce, thin out the due messages first so 
+  //  superseded values never take up room in the buffer
+  if ((managed->coalesce) && (managed->send_queue != NULL) && 
+      (_frame_before(managed->send_queue->time, end_frame))) {
+    _send_queue_coalesce(managed, end_frame);
+  }
+  Message *message;
+  RoutedEvent *routed;
+  const unsigned char *data;
+  size_t data_size;
+  int port_send_count = 0;
+  jack_nframes_t time;
+  jack_nframes_t message_time = 0;
+  jack_nframes_t last_time = 0;
+  while (1) {
+    message = managed->send_queue;
+    if ((message != NULL) && (! _frame_before(message->time, end_frame))) {
+      message = NULL;
+    }
+    if (message != NULL) {
+      // send messages that came due in a previous block as soon as possible
+      message_time = _frame_before(message->time, start_frame) ? 
+        0 : message->time - start_frame;
+    }
+    routed = (routed_index < routed_count) ? 
+      &(managed->routed[routed_index]) : NULL;
+    if ((message == NULL) && (routed == NULL)) break;
+    // take whichever comes first, preferring queued messages on a tie
+    if ((message != NULL) && 
+        ((routed == NULL) || (message_time <= routed->time))) {
+      routed = NULL;
+      time = message_time;
+      data = message->data;
+      data_size = message->data_size;
+    }
+    else {
+      message = NULL;
+      time = routed->time;
+      data = _routed_event_data(routed);
+      data_size = routed->data_size;
+    }
+    // JACK allows any number of events at the same frame as long as 
+    //  they're in order, so events only ever need to wait for the ones 
+    //  before them, never be spread out
+    if ((port_send_count > 0) && (time < last_time)) time = last_time;
+    if (data_size > jack_midi_max_event_size(port_buffer)) buffer = NULL;
+    else buffer = jack_midi_event_reserve(port_buffer, time, data_size);
+    if (buffer != NULL) {
+      memcpy(buffer, data, data_size);
+      managed->sent++;
+      // keep track of the time of the last message
+      port_send_count++;
+      last_time = time;
+    }
+    // if the buffer is full, apply the port's overflow policy to what's 
+    //  left of the queue; routed events point into this block's input, 
+    //  so those can't wait and have to be dropped
+    else if (port_send_count > 0) {
+      _send_queue_overflow(managed, start_frame, end_frame);
+      managed->route_overflows += routed_count - routed_index;
+      break;
+    }
+    // if the event doesn't fit in an empty buffer it never will, 
+    //  so drop it rather than letting it hold up the queue
+    else {
+      managed->reserve_failures++;
+      #if WARN_IN_PROCESS
+        _warn("Failed to allocate a buffer to write a message into");
+      #endif
+    }
+    if (message != NULL) {
+      // remove the message from the queue once sent
+      managed->send_queue = _message_heap_pop(message);
+      _send_queue_taken(managed, 1);
+      MessagePool_recycle(managed->pool, message);
+    }
+    else routed_index++;
+  }
+}
+
+// follow a system message arriving on a port with a clock follower, 
+//  estimating the tempo from the times of the last few clock pulses
+static void
+_clock_follow(ClockState *clock, const unsigned char *data, size_t size, 
+              jack_time_t usecs) {
+  switch (data[0]) {
+    case 0xF8:
+      // start estimating over after a long gap, since the clock stopped
+      if ((clock->pulse_count > 0) && 
+          (usecs - clock->pulse_times[clock->pulse_index] > 1000000)) {
+        clock->pulse_count = 0;
+      }
+      clock->pulse_index = (clock->pulse_index + 1) % CLOCK_TEMPO_PULSES;
+      clock->pulse_times[clock->pulse_index] = usecs;
+      if (clock->pulse_count < CLOCK_TEMPO_PULSES) clock->pulse_count++;
+      if (clock->follow_running) clock->follow_pulses++;
+      break;
+    // the sender may not have kept time while it was stopped, 
+    //  so estimate the tempo over again when it starts
+    case 0xFA:
+      clock->follow_running = 1;
+      clock->follow_pulses = 0;
+      clock->pulse_count = 0;
+      break;
+    case 0xFB:
+      clock->follow_running = 1;
+      clock->pulse_count = 0;
+      break;
+    case 0xFC:
+      clock->follow_running = 0;
+      break;
+    case 0xF2:
+      // song position pointers count sixteenth notes
+      if (size < 3) return;
+      clock->follow_pulses = 
+        (uint64_t)((data[1] & 0x7F) | ((data[2] & 0x7F) << 7)) * 
+        (CLOCK_PULSES_PER_QUARTER / 4);
+      break;
+    default:
+      return;
+  }
+  // keep the last estimate until there are enough pulses for a new one
+  double tempo = clock->published_tempo;
+  if (clock->pulse_count >= 2) {
+    int oldest = (clock->pulse_index + CLOCK_TEMPO_PULSES - 
+                  (clock->pulse_count - 1)) % CLOCK_TEMPO_PULSES;
+    double elapsed = (double)(clock->pulse_times[clock->pulse_index] - 
+                              clock->pulse_times[oldest]);
+    if (elapsed > 0.0) {
+      tempo = (60000000.0 * (double)(clock->pulse_count - 1)) / 
+        (elapsed * (double)CLOCK_PULSES_PER_QUARTER);
+    }
+  }
+  _clock_publish(clock, tempo, clock->follow_running, 
+    (double)clock->follow_pulses / (double)CLOCK_PULSES_PER_QUARTER);
+}
+
+// check whether a port's receive filter passes an event
+static inline int
+_receive_filter_passes(uint64_t filter, const unsigned char *data, 
+                       size_t size) {
+  if (size == 0) return(0);
+  unsigned char status = data[0];
+  if (status >= 0xF8) {
+    return((RECEIVE_FILTER_REALTIME(filter) & (1 << (status - 0xF8))) != 0);
+  }
+  if (status < 0x80) return(1);
+  if ((RECEIVE_FILTER_TYPES(filter) & (1 << ((status >> 4) - 0x8))) == 0) {
+    return(0);
+  }
+  if (status == 0xF0) return(size <= RECEIVE_FILTER_SYSEX_MAX(filter));
+  if (status > 0xF0) return(1);
+  return((RECEIVE_FILTER_CHANNELS(filter) & (1 << (status & 0x0F))) != 0);
+}
+
+// copy a received event into a recorder's queue, dropping it if the 
+//  queue is full so the process callback never waits for the disk
+static void
+_recorder_write(RecorderTap *tap, const ReceivedEvent *header, 
+                const unsigned char *data, size_t size) {
+  RecordedEvent record;
+  size_t record_size = sizeof(RecordedEvent) + size;
+  // the size has to fit in the record's header (and the raw format's)
+  if (size > UINT16_MAX) {
+    tap->oversized++;
+    return;
+  }
+  if (jack_ringbuffer_write_space(tap->ring) < record_size) {
+    tap->overflows++;
+    return;
+  }
+  record.usecs = header->usecs;
+  record.frame = header->frame;
+  record.track = tap->track;
+  record.size = (uint16_t)size;
+  jack_ringbuffer_data_t vec[2];
+  jack_ringbuffer_get_write_vector(tap->ring, vec);
+  _ringbuffer_vector_write(vec, 0, &record, sizeof(RecordedEvent));
+  _ringbuffer_vector_write(vec, sizeof(RecordedEvent), data, size);
+  jack_ringbuffer_write_advance(tap->ring, record_size);
+}
+
+// receive and enqueue messages for one of a client's ports, returning the 
+//  number of events added to its queue
+static int
+Client_receive_messages_for_port(Client *self, ManagedPort *managed, 
+                                 const CycleTimes *cycle) {
+  jack_nframes_t nframes = cycle->nframes;
+  int i;
+  int result;
+  // get a readable buffer for the port
+  void *port_buffer = jack_port_get_buffer(managed->port, nframes);
+  if (port_buffer == NULL) {
+    #if WARN_IN_PROCESS
+      _warn("Failed to get port buffer for receiving");
+    #endif
+    return(0);
+  }
+  // get the number of events to receive for this block
+  int event_count = jack_midi_get_event_count(port_buffer);
+  // if there are no events for the port, we can skip receiving
+  if (event_count == 0) return(0);
+  int received_count = 0;
+  // receive events
+  jack_ringbuffer_t *queue = managed->receive_queue;
+  RecorderTap *tap = atomic_load_explicit(&(managed->recorder), 
+                                          memory_order_acquire);
+  uint64_t filter = atomic_load_explicit(&(managed->receive_filter), 
+                                         memory_order_relaxed);
+  ClockState *clock = atomic_load_explicit(&(managed->clock), 
+                                           memory_order_acquire);
+  jack_midi_event_t event;
+  ReceivedEvent header;
+  double usecs_per_frame = 
+    (double)(cycle->next_usecs - cycle->usecs) / (double)nframes;
+  for (i = 0; i < event_count; i++) {
+    result = jack_midi_event_get(&event, port_buffer, i);
+    if (result != 0) {
+      #if WARN_IN_PROCESS
+        _warn("Failed to get an event at index %d", i);
+      #endif
+      continue;
+    }
+    // let a clock follower see clock messages even if they're filtered out
+    if ((clock != NULL) && (event.size > 0) && (event.buffer[0] >= 0xF2)) {
+      _clock_follow(clock, event.buffer, event.size, cycle->usecs + 
+        (jack_time_t)(usecs_per_frame * (double)event.time));
+    }
+    // skip events the port isn't interested in before copying anything
+    if ((filter != RECEIVE_FILTER_ALL) && 
+        (! _receive_filter_passes(filter, event.buffer, event.size))) {
+      managed->receive_filtered++;
+      continue;
+    }
+    // copy the event into the port's queue, dropping it if the queue is full
+    //  so we never have to allocate or wait for the reader here
+    // stamp the event with times synced to the transport and the system
+    header.time = cycle->transport_frame + event.time;
+    header.frame = cycle->frame + event.time;
+    header.usecs = cycle->usecs + 
+      (jack_time_t)(usecs_per_frame * (double)event.time);
+    header.data_size = event.size;
+    header.slot_class = -1;
+    header.slot = 0;
+    if (tap != NULL) {
+      _recorder_write(tap, &header, event.buffer, event.size);
+      if (! tap->receive) continue;
+    }
+    // store the data in the arena if there's room in the queue for its 
+    //  header (so we never have to give the slot back from here), and 
+    //  otherwise inline in the queue after the header
+    unsigned char *slot = NULL;
+    if (jack_ringbuffer_write_space(queue) >= sizeof(ReceivedEvent)) {
+      slot = ReceiveArena_take(managed->arena, event.size, 
+                               &(header.slot_class), &(header.slot));
+    }
+    if (slot != NULL) {
+      memcpy(slot, event.buffer, event.size);
+      result = _ringbuffer_write_event(queue, &header, NULL, 0);
+    }
+    else {
+      result = _ringbuffer_write_event(queue, &header, 
+                                       event.buffer, event.size);
+    }
+    if (result != 0) {
+      managed->receive_overflows++;
+      #if WARN_IN_PROCESS
+        _warn("Dropped the message at index %d with data size %d because "
+              "the receive queue is full", i, event.size);
+      #endif
+    }
+    else received_count++;
+  }
+  // mark the port so anything waiting on it gets woken at the end of the block
+  if (received_count > 0) managed->receive_signal_pending = 1;
+  managed->received += received_count;
+  return(received_count);
+}
+
+// move a block of audio between one of a client's audio ports and its 
+//  queue, dropping input that doesn't fit and playing silence when there's 
+//  no output queued; returns 1 if an input port got new audio
+static int
+Client_process_audio_port(Client *self, ManagedPort *managed, 
+                          jack_nframes_t nframes) {
+  jack_default_audio_sample_t *buffer = 
+    (jack_default_audio_sample_t *)jack_port_get_buffer(managed->port, nframes);
+  if (buffer == NULL) return(0);
+  jack_ringbuffer_t *queue = managed->audio_queue;
+  size_t bytes = sizeof(jack_default_audio_sample_t) * nframes;
+  if (managed->is_input) {
+    // keep blocks whole so the audio Python reads only ever has gaps 
+    //  between blocks
+    if (jack_ringbuffer_write_space(queue) < bytes) {
+      managed->receive_overflows += nframes;
+      return(0);
+    }
+    jack_ringbuffer_write(queue, (const char *)buffer, bytes);
+    managed->received += nframes;
+    return(1);
+  }
+  size_t available = jack_ringbuffer_read_space(queue);
+  available -= available % sizeof(jack_default_audio_sample_t);
+  if (available > bytes) available = bytes;
+  jack_ringbuffer_read(queue, (char *)buffer, available);
+  if (available < bytes) {
+    memset((char *)buffer + available, 0, bytes - available);
+    managed->audio_underruns += 
+      (bytes - available) / sizeof(jack_default_audio_sample_t);
+  }
+  managed->sent += available / sizeof(jack_default_audio_sample_t);
+  return(0);
+}
+
+// publish the transport's state for this cycle, for readers to copy 
+//  with Client_read_transport
+static void
+Client_publish_transport(Client *self, jack_transport_state_t state, 
+                         const jack_position_t *pos) {
+  TransportSnapshot *snapshot = &(self->_transport);
+  unsigned int sequence = atomic_load_explicit(&(snapshot->sequence), 
+                                               memory_order_relaxed);
+  atomic_store_explicit(&(snapshot->sequence), sequence + 1, 
+                        memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  snapshot->state = state;
+  snapshot->position = *pos;
+  atomic_store_explicit(&(snapshot->sequence), sequence + 2, 
+                        memory_order_release);
+}
+
+// copy the transport's state as of the last cycle, returning -1 if the 
+//  client isn't active or no cycle has published it yet (this doesn't need 
+//  the GIL, so the player's thread can use it)
+static int
+Client_read_transport(Client *self, jack_transport_state_t *state, 
+                      jack_position_t *pos) {
+  if (self->is_active != Py_True) return(-1);
+  TransportSnapshot *snapshot = &(self->_transport);
+  unsigned int before, after;
+  do {
+    before = atomic_load_explicit(&(snapshot->sequence), 
+                                  memory_order_acquire);
+    *state = snapshot->state;
+    *pos = snapshot->position;
+    atomic_thread_fence(memory_order_acquire);
+    after = atomic_load_explicit(&(snapshot->sequence), 
+                                 memory_order_relaxed);
+  } while ((before != after) || ((before & 1) != 0));
+  // the sequence is still zero until the first cycle publishes
+  return((before != 0) ? 0 : -1);
+}
+
+// fill in the bar/beat/tick position from the client's tempo map when it's 
+//  the timebase master; this runs on the process thread right after the 
+//  process callback, so the cycle count protects the map like anything 
+//  else the callback uses
+static void
+Client_timebase(jack_transport_state_t state, jack_nframes_t nframes, 
+                jack_position_t *pos, int new_pos, void *self_ptr) {
+  Client *self = (Client *)self_ptr;
+  TempoMap *map = atomic_load_explicit(&(self->_tempo_map), 
+                                       memory_order_acquire);
+  if ((map == NULL) || (map->count == 0) || (pos->frame_rate == 0)) {
+    pos->valid &= ~JackPositionBBT;
+    return;
+  }
+  double time = (double)pos->frame / (double)pos->frame_rate;
+  // find the last span that starts at or before the position
+  int low = 0, high = map->count - 1;
+  while (low < high) {
+    int middle = (low + high + 1) / 2;
+    if (map->spans[middle].time <= time) low = middle;
+    else high = middle - 1;
+  }
+  TempoSpan *span = &(map->spans[low]);
+  double beats = (time > span->time) ? 
+    ((time - span->time) * span->beats_per_minute / 60.0) : 0.0;
+  double bars = span->bars + (beats / span->beats_per_bar);
+  double whole_bars = floor(bars);
+  double beat = (bars - whole_bars) * span->beats_per_bar;
+  double whole_beats = floor(beat);
+  double tick = (beat - whole_beats) * map->ticks_per_beat;
+  if (tick >= map->ticks_per_beat) tick = map->ticks_per_beat - 1.0;
+  pos->bar = (int32_t)whole_bars + 1;
+  pos->beat = (int32_t)whole_beats + 1;
+  pos->tick = (int32_t)tick;
+  pos->bar_start_tick = span->ticks + 
+    ((whole_bars - span->bars) * span->beats_per_bar * map->ticks_per_beat);
+  pos->beats_per_bar = span->beats_per_bar;
+  pos->beat_type = span->beat_type;
+  pos->ticks_per_beat = map->ticks_per_beat;
+  pos->beats_per_minute = span->beats_per_minute;
+  pos->valid |= JackPositionBBT;
+}
+
+// capture the timing of the current process cycle
+static void
+Client_capture_cycle(Client *self, jack_nframes_t nframes, 
+                     CycleTimes *cycle) {
+  jack_position_t pos;
+  jack_nframes_t frame;
+  jack_time_t usecs, next_usecs;
+  float period_usecs;
+  cycle->nframes = nframes;
+  jack_transport_state_t state = jack_transport_query(self->_client, &pos);
+  cycle->transport_frame = pos.frame;
+  cycle->transport_state = state;
+  cycle->transport = pos;
+  Client_publish_transport(self, state, &pos);
+  if (jack_get_cycle_times(self->_client, &frame, &usecs, &next_usecs, 
+                           &period_usecs) == 0) {
+    cycle->frame = frame;
+    cycle->usecs = usecs;
+    cycle->next_usecs = next_usecs;
+  }
+  else {
+    // fall back on estimating the times if the backend can't tell us
+    cycle->frame = jack_last_frame_time(self->_client);
+    cycle->usecs = jack_frames_to_time(self->_client, cycle->frame);
+    cycle->next_usecs = jack_frames_to_time(self->_client, 
+                                            cycle->frame + nframes);
+  }
+}
+
+// process a block of events for a client's ports
+static void
+Client_process_ports(Client *self, jack_nframes_t nframes) {
+  int i;
+  // get the timing of this block once for all ports, so queued messages 
+  //  can be placed in it by their absolute times and received ones stamped
+  CycleTimes cycle;
+  Client_capture_cycle(self, nframes, &cycle);
+  // get the ports to process, which stay valid until we finish this cycle
+  PortTable *ports = atomic_load_explicit(&(self->_ports), 
+                                          memory_order_acquire);
+  if (ports == NULL) return;
+  // enqueue received messages
+  int received_count = 0;
+  for (i = 0; i < ports->receive_count; i++) {
+    received_count += Client_receive_messages_for_port(
+      self, ports->receive_ports[i], &cycle);
+  }
+  if (received_count > 0) {
+    // make the notification pipe readable if it isn't already
+    if ((self->_notify_fds[1] >= 0) && 
+        (atomic_exchange(&(self->_notify_pending), 1) == 0)) {
+      if (write(self->_notify_fds[1], "", 1) < 0) {
+        atomic_store(&(self->_notify_pending), 0);
+      }
+    }
+    // wake anything waiting on ports that got events; we do this after 
+    //  writing to the pipe so a woken reader can acknowledge the pipe too,
+    //  and avoid letting the semaphores count up while nobody's listening
+    ManagedPort *managed;
+    int waiting;
+    for (i = 0; i < ports->receive_count; i++) {
+      managed = ports->receive_ports[i];
+      if (! managed->receive_signal_pending) continue;
+      managed->receive_signal_pending = 0;
+      waiting = 0;
+      if ((sem_getvalue(&(managed->receive_signal), &waiting) == 0) && 
+          (waiting <= 0)) {
+        sem_post(&(managed->receive_signal));
+      }
+    }
+  }
+  // pass audio to and from Python, waking anything waiting to read it
+  for (i = 0; i < ports->audio_count; i++) {
+    ManagedPort *managed = ports->audio_ports[i];
+    int waiting = 0;
+    if ((Client_process_audio_port(self, managed, nframes)) && 
+        (sem_getvalue(&(managed->receive_signal), &waiting) == 0) && 
+        (waiting <= 0)) {
+      sem_post(&(managed->receive_signal));
+    }
+  }
+  // route received messages to output ports
+  RouteTable *routes = atomic_load_explicit(&(self->_routes), 
+                                            memory_order_acquire);
+  if (routes != NULL) {
+    for (i = 0; i < routes->count; i++) {
+      _route_messages(&(routes->routes[i]), nframes);
+    }
+  }
+  // send queued and routed messages
+  for (i = 0; i < ports->send_count; i++) {
+    Client_send_messages_for_port(self, ports->send_ports[i], &cycle);
+  }
+}
+
+// get the histogram bucket for a duration in nanoseconds
+static inline int
+_process_time_bucket(uint64_t ns) {
+  int bit;
+  if (ns < 4) return((int)ns);
+  if (ns >= ((uint64_t)1 << 32)) return(PROCESS_TIME_BUCKETS - 1);
+  bit = 63 - __builtin_clzll(ns);
+  return(((bit - 1) * 4) + (int)((ns >> (bit - 2)) & 3));
+}
+
+// get the longest duration in nanoseconds that goes in a histogram bucket
+static uint64_t
+_process_time_bucket_limit(int bucket) {
+  if (bucket < 4) return((uint64_t)bucket);
+  int bit = (bucket / 4) + 1;
+  return((((uint64_t)(5 + (bucket % 4))) << (bit - 2)) - 1);
+}
+
+// get the time in nanoseconds on a monotonic clock
+static inline uint64_t
+_monotonic_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return(((uint64_t)now.tv_sec * 1000000000ULL) + (uint64_t)now.tv_nsec);
+}
+
+// process a block of events for a client, timing how long it takes
+static int
+Client_process(jack_nframes_t nframes, void *self_ptr) {
+  Client *self = (Client *)self_ptr;
+  if (self == NULL) return(-1);
+  uint64_t start = _monotonic_ns();
+  Client_process_ports(self, nframes);
+  uint64_t duration = _monotonic_ns() - start;
+  ProcessStats *stats = &(self->_stats);
+  if ((stats->count == 0) || (duration < stats->min_ns)) {
+    stats->min_ns = duration;
+  }
+  if (duration > stats->max_ns) stats->max_ns = duration;
+  stats->total_ns += duration;
+  stats->histogram[_process_time_bucket(duration)]++;
+  stats->count++;
+  // wake the cycle handler's thread, unless it's still handling the 
+  //  last cycle, in which case it'll see this one when it's done
+  if (atomic_load_explicit(&(self->_cycle_enabled), memory_order_acquire)) {
+    int waiting = 0;
+    atomic_store_explicit(&(self->_cycle_info), 
+      ((uint64_t)jack_last_frame_time(self->_client) << 32) | nframes, 
+      memory_order_release);
+    if (sem_getvalue(&(self->_cycle_signal), &waiting) != 0) waiting = 0;
+    if (waiting <= 0) sem_post(&(self->_cycle_signal));
+    else self->_cycle_overruns++;
+  }
+  // let other threads know we're done with anything we loaded this cycle
+  atomic_fetch_add_explicit(&(self->_process_cycles), 1, 
+                            memory_order_release);
+  return(0);
+}
+
+// count xruns reported by JACK
+static int
+Client_xrun(void *self_ptr) {
+  Client *self = (Client *)self_ptr;
+  self->_stats.xruns++;
+  return(0);
+}
+
+// keep the cached sample rate current; send queues are rescaled the next 
+//  time they're locked, so nothing here has to touch them
+static int
+Client_sample_rate_changed(jack_nframes_t sample_rate, void *self_ptr) {
+  Client *self = (Client *)self_ptr;
+  atomic_store(&(self->_sample_rate), sample_rate);
+  return(0);
+}
+
+// keep the cached buffer size current
+static int
+Client_buffer_size_changed(jack_nframes_t buffer_size, void *self_ptr) {
+  Client *self = (Client *)self_ptr;
+  atomic_store(&(self->_buffer_size), buffer_size);
+  return(0);
+}
+
+// update the port index when a port is registered or unregistered
+static void
+Client_port_registered(jack_port_id_t port_id, int registered, 
+                       void *self_ptr) {
+  Client *self = (Client *)self_ptr;
+  PortIndex *index = &(self->_index);
+  jack_port_t *port = jack_port_by_id(self->_client, port_id);
+  pthread_mutex_lock(&(index->lock));
+  index->changes++;
+  if (index->is_valid) {
+    int position = (port != NULL) ? PortIndex_find(index, port) : -1;
+    if (port == NULL) index->is_valid = 0;
+    else if (registered) {
+      if ((position < 0) && (PortIndex_add(index, port) == NULL)) {
+        index->is_valid = 0;
+      }
+    }
+    else if (position >= 0) PortIndex_remove(index, position);
+  }
+  pthread_mutex_unlock(&(index->lock));
+}
+
+// update the port index when ports are connected or disconnected
+static void
+Client_ports_connected(jack_port_id_t a_id, jack_port_id_t b_id, 
+                       int connected, void *self_ptr) {
+  Client *self = (Client *)self_ptr;
+  PortIndex *index = &(self->_index);
+  jack_port_t *a = jack_port_by_id(self->_client, a_id);
+  jack_port_t *b = jack_port_by_id(self->_client, b_id);
+  pthread_mutex_lock(&(index->lock));
+  index->changes++;
+  if (index->is_valid) {
+    if ((a == NULL) || (b == NULL) || 
+        (PortIndex_connect(index, a, b, connected) < 0)) {
+      index->is_valid = 0;
+    }
+  }
+  pthread_mutex_unlock(&(index->lock));
+}
+
+// update the port index when a port is renamed
+static void
+Client_port_renamed(jack_port_id_t port_id, const char *old_name, 
+                    const char *new_name, void *self_ptr) {
+  Client *self = (Client *)self_ptr;
+  PortIndex *index = &(self->_index);
+  jack_port_t *port = jack_port_by_id(self->_client, port_id);
+  pthread_mutex_lock(&(index->lock));
+  index->changes++;
+  if (index->is_valid) {
+    int position = (port != NULL) ? PortIndex_find(index, port) : -1;
+    char *name = (position >= 0) ? strdup(new_name) : NULL;
+    if (name == NULL) index->is_valid = 0;
+    else {
+      free(index->records[position].name);
+      index->records[position].name = name;
+    }
+  }
+  pthread_mutex_unlock(&(index->lock));
+}
+
+// start processing events for a client
+static PyObject *
+Client_activate(Client *self) {
+  int result;
+  // skip locking in the common case where there's nothing to do
+  if (self->is_active == Py_True) Py_RETURN_NONE;
+  Client_lock(self, 1);
+  if (Client_open_locked(self) < 0) {
+    Client_unlock(self);
+    return(NULL);
+  }
+  if (self->is_active != Py_True) {
+    jack_client_t *client = self->_client;
+    int callback_result;
+    Py_BEGIN_ALLOW_THREADS
+    // connect a callback for processing MIDI messages
+    callback_result = jack_set_process_callback(client, Client_process, self);
+    // count xruns for the client's statistics
+    jack_set_xrun_callback(client, Client_xrun, self);
+    // keep the cached sample rate and buffer size current
+    jack_set_sample_rate_callback(client, Client_sample_rate_changed, self);
+    jack_set_buffer_size_callback(client, Client_buffer_size_changed, self);
+    // keep the port index up to date (if these fail, we'll just end up 
+    //  rebuilding the index every time it's used)
+    if ((jack_set_port_registration_callback(
+           client, Client_port_registered, self) != 0) ||
+        (jack_set_port_connect_callback(
+           client, Client_ports_connected, self) != 0) ||
+        (jack_set_port_rename_callback(
+           client, Client_port_renamed, self) != 0)) {
+      jack_set_port_registration_callback(client, NULL, NULL);
+      jack_set_port_connect_callback(client, NULL, NULL);
+      jack_set_port_rename_callback(client, NULL, NULL);
+    }
+    result = jack_activate(client);
+    Py_END_ALLOW_THREADS
+    if (callback_result != 0) {
+      _warn("Failed to set a callback for the JACK client (error %i), "
+            "MIDI send/receive will be disabled", callback_result);
+    }
+    if (result != 0) {
+      Client_unlock(self);
+      _error(self, "Failed to activate the JACK client (error %i)", result);
+      return(NULL);
+    }
+    self->is_active = Py_True;
+  }
+  Client_unlock(self);
+  Py_RETURN_NONE;
+}
+
+// stop processing events for a client
+static PyObject *
+Client_deactivate(Client *self) {
+  int result = 0;
+  Client_lock(self, 1);
+  if ((self->is_active == Py_True) && (self->_client != NULL)) {
+    jack_client_t *client = self->_client;
+    Py_BEGIN_ALLOW_THREADS
+    result = jack_deactivate(client);
+    Py_END_ALLOW_THREADS
+    if (result == 0) {
+      self->is_active = Py_False;
+      Client_invalidate_index(self);
+    }
+  }
+  Client_unlock(self);
+  if (result != 0) {
+    _error(self, "Failed to deactivate the JACK client (error %i)", result);
+    return(NULL);
+  }
+  Py_RETURN_NONE;
+}
+
+// make sure the client's port index is up to date, returning -1 on failure
+static int
+Client_index_ports(Client *self) {
+  int attempt;
+  PortIndex *index = &(self->_index);
+  // we only get notifications while the client is active
+  Client_activate(self);
+  if (self->is_active != Py_True) return(-1);
+  Client_lock(self, 0);
+  pthread_mutex_lock(&(index->lock));
+  int is_valid = index->is_valid;
+  pthread_mutex_unlock(&(index->lock));
+  for (attempt = 0; (! is_valid) && (self->_client != NULL); attempt++) {
+    // build a new index without holding the lock or the GIL, since it 
+    //  takes a lot of calls to the server
+    pthread_mutex_lock(&(index->lock));
+    unsigned long changes = index->changes;
+    pthread_mutex_unlock(&(index->lock));
+    PortIndex built = { .count = 0, .capacity = 0, .records = NULL };
+    jack_client_t *client = self->_client;
+    int result;
+    Py_BEGIN_ALLOW_THREADS
+    result = PortIndex_build(&built, client);
+    Py_END_ALLOW_THREADS
+    if (result < 0) {
+      PortIndex_clear(&built);
+      Client_unlock(self);
+      PyErr_NoMemory();
+      return(-1);
+    }
+    // install the new index, and if nothing changed while we were building
+    //  it, let notifications keep it up to date from here on; if the graph 
+    //  keeps changing, we'll use what we have and rebuild next time
+    pthread_mutex_lock(&(index->lock));
+    int is_current = (index->changes == changes);
+    if ((is_current) || (attempt >= 8)) {
+      PortRecord *records = index->records;
+      index->records = built.records;
+      built.records = records;
+      int count = index->count;
+      index->count = built.count;
+      built.count = count;
+      int capacity = index->capacity;
+      index->capacity = built.capacity;
+      built.capacity = capacity;
+      index->is_valid = is_current;
+      is_valid = 1;
+    }
+    pthread_mutex_unlock(&(index->lock));
+    PortIndex_clear(&built);
+  }
+  Client_unlock(self);
+  return(0);
+}
+
+// get a weak reference's target as a new reference, or NULL if it's gone
+static PyObject *
+_weakref_get(PyObject *ref) {
+  #if PY_VERSION_HEX >= 0x030D0000
+    PyObject *obj = NULL;
+    if (PyWeakref_GetRef(ref, &obj) < 0) PyErr_Clear();
+    return(obj);
+  #else
+    PyObject *obj = PyWeakref_GetObject(ref);
+    if ((obj == NULL) || (obj == Py_None)) return(NULL);
+    Py_INCREF(obj);
+    return(obj);
+  #endif
+}
+
+// remove entries from the client's Port cache whose objects are gone, 
+//  so ports that come and go don't make it grow forever
+static void
+Client_prune_port_objects(Client *self) {
+  PyObject *dead = PyList_New(0);
+  if (dead == NULL) {
+    PyErr_Clear();
+    return;
+  }
+  PyObject *key, *ref;
+  Py_ssize_t position = 0;
+  while (PyDict_Next(self->_port_objects, &position, &key, &ref)) {
+    PyObject *obj = _weakref_get(ref);
+    if (obj != NULL) Py_DECREF(obj);
+    else if (PyList_Append(dead, key) < 0) PyErr_Clear();
+  }
+  Py_ssize_t i;
+  for (i = 0; i < PyList_GET_SIZE(dead); i++) {
+    if (PyDict_DelItem(self->_port_objects, PyList_GET_ITEM(dead, i)) < 0) {
+      PyErr_Clear();
+    }
+  }
+  Py_DECREF(dead);
+  // let the cache grow to twice its live size before sweeping again, 
+  //  so the cost of sweeping is spread over the ports added
+  Py_ssize_t size = PyDict_Size(self->_port_objects);
+  self->_port_objects_limit = (size * 2 > PORT_CACHE_MIN_LIMIT) ? 
+    size * 2 : PORT_CACHE_MIN_LIMIT;
+}
+
+// remember a Port object so the client can hand it out again
+static void
+Client_intern_port(Client *self, Port *port) {
+  if ((self->_port_objects == NULL) || (port->_port == NULL)) return;
+  PyObject *key = PyLong_FromVoidPtr(port->_port);
+  PyObject *ref = (key != NULL) ? 
+    PyWeakref_NewRef((PyObject *)port, NULL) : NULL;
+  Py_BEGIN_CRITICAL_SECTION(self);
+  if (ref != NULL) PyDict_SetItem(self->_port_objects, key, ref);
+  else PyErr_Clear();
+  if (PyDict_Size(self->_port_objects) > self->_port_objects_limit) {
+    Client_prune_port_objects(self);
+  }
+  Py_END_CRITICAL_SECTION();
+  Py_XDECREF(ref);
+  Py_XDECREF(key);
+}
+
+// get the name of a port type as a new reference, sharing one string 
+//  between all the ports of each default type
+static PyObject *
+Client_type_name(Client *self, const char *type) {
+  PyObject **cached = NULL;
+  if (strcmp(type, JACK_DEFAULT_MIDI_TYPE) == 0) {
+    cached = &(self->_midi_type_name);
+  }
+  else if (strcmp(type, JACK_DEFAULT_AUDIO_TYPE) == 0) {
+    cached = &(self->_audio_type_name);
+  }
+  if (cached == NULL) return(PyUnicode_FromString(type));
+  PyObject *name;
+  Py_BEGIN_CRITICAL_SECTION(self);
+  if (*cached == NULL) *cached = PyUnicode_FromString(type);
+  name = *cached;
+  Py_XINCREF(name);
+  Py_END_CRITICAL_SECTION();
+  return(name);
+}
+
+// get the Port object for a port handle, reusing one we've already made 
+//  if it's still around (only while holding the client's critical section)
+static Port *
+Client_find_port_object(Client *self, jack_port_t *handle, const char *name) {
+  PyObject *key = PyLong_FromVoidPtr(handle);
+  if (key == NULL) return(NULL);
+  PyObject *ref = (self->_port_objects != NULL) ? 
+    PyDict_GetItem(self->_port_objects, key) : NULL;
+  Port *port = (ref != NULL) ? (Port *)_weakref_get(ref) : NULL;
+  Py_DECREF(key);
+  if (port != NULL) {
+    // pick up any change in the port's name, and since JACK can hand a 
+    //  port's handle to a new port once it's gone, its flags and type too
+    const char *old_name = PyUnicode_AsUTF8(port->name);
+    if ((old_name == NULL) || (strcmp(old_name, name) != 0)) {
+      PyErr_Clear();
+      PyObject *new_name = PyUnicode_FromString(name);
+      PyObject *new_flags = PyLong_FromLong(jack_port_flags(handle));
+      PyObject *new_type = Client_type_name(self, jack_port_type(handle));
+      if ((new_name == NULL) || (new_flags == NULL) || (new_type == NULL)) {
+        Py_XDECREF(new_name);
+        Py_XDECREF(new_flags);
+        Py_XDECREF(new_type);
+        Py_DECREF(port);
+        return(NULL);
+      }
+      PyObject *tmp = port->name;
+      port->name = new_name;
+      Py_XDECREF(tmp);
+      tmp = port->flags;
+      port->flags = new_flags;
+      Py_XDECREF(tmp);
+      tmp = port->type;
+      port->type = new_type;
+      Py_XDECREF(tmp);
+    }
+    return(port);
+  }
+  port = (Port *)Port_new(_module_state(self)->PortType, NULL, NULL);
+  if (port == NULL) return(NULL);
+  if (Port_init_from_handle(port, self, handle, name) < 0) {
+    Py_DECREF(port);
+    return(NULL);
+  }
+  return(port);
+}
+static Port *
+Client_port_object(Client *self, jack_port_t *handle, const char *name) {
+  Port *port;
+  // look up and add to the cache as one step, so threads asking for the 
+  //  same port get the same object
+  Py_BEGIN_CRITICAL_SECTION(self);
+  port = Client_find_port_object(self, handle, name);
+  Py_END_CRITICAL_SECTION();
+  return(port);
+}
+
+// make a list of Port objects from selected ports
+static PyObject *
+Client_port_list(Client *self, PortMatch *matches, int count) {
+  int i;
+  PyObject *return_list = PyList_New(count);
+  if (return_list == NULL) return(NULL);
+  for (i = 0; i < count; i++) {
+    Port *port = Client_port_object(self, matches[i].port, matches[i].name);
+    if (port == NULL) {
+      Py_DECREF(return_list);
+      return(NULL);
+    }
+    // the list takes our reference
+    PyList_SET_ITEM(return_list, i, (PyObject *)port);
+  }
+  return(return_list);
+}
+
+// use a client to list ports (this will also list ports owned by other 
+//  clients unless the "mine" parameter is set to True)
+static PyObject *
+Client_get_ports(Client *self, PyObject *args, PyObject *kwds) {
+  int i;
+  const char *name_pattern = NULL;
+  const char *type_pattern = NULL;
+  unsigned long flags = 0;
+  PyObject *mine = NULL;
+  static char *kwlist[] = {"name_pattern", "type_pattern", "flags", "mine", NULL};
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "|sskO", kwlist, 
+                                    &name_pattern, &type_pattern, &flags, &mine))
+    return(NULL);
+  // see if we're only listing the ports of this client
+  int mine_only = (mine != NULL) ? PyObject_IsTrue(mine) : 0;
+  // match ports the same way JACK does
+  regex_t name_regex, type_regex;
+  int use_name = ((name_pattern != NULL) && (name_pattern[0] != '\0'));
+  int use_type = ((type_pattern != NULL) && (type_pattern[0] != '\0'));
+  if ((use_name) && 
+      (regcomp(&name_regex, name_pattern, REG_EXTENDED | REG_NOSUB) != 0)) {
+    PyErr_Format(PyExc_ValueError, "Invalid name pattern \"%s\"", 
+                 name_pattern);
+    return(NULL);
+  }
+  if ((use_type) && 
+      (regcomp(&type_regex, type_pattern, REG_EXTENDED | REG_NOSUB) != 0)) {
+    if (use_name) regfree(&name_regex);
+    PyErr_Format(PyExc_ValueError, "Invalid type pattern \"%s\"", 
+                 type_pattern);
+    return(NULL);
+  }
+  PortMatch *matches = NULL;
+  int match_count = 0;
+  if (Client_index_ports(self) < 0) goto done;
+  // select matching ports from the index
+  PortIndex *index = &(self->_index);
+  pthread_mutex_lock(&(index->lock));
+  matches = (PortMatch *)malloc(sizeof(PortMatch) * (index->count + 1));
+  for (i = 0; (matches != NULL) && (i < index->count); i++) {
+    PortRecord *record = &(index->records[i]);
+    if ((record->flags & flags) != flags) continue;
+    if ((use_name) && 
+        (regexec(&name_regex, record->name, 0, NULL, 0) != 0)) continue;
+    if ((use_type) && 
+        (regexec(&type_regex, record->type, 0, NULL, 0) != 0)) continue;
+    if ((mine_only) && 
+        (! jack_port_is_mine(self->_client, record->port))) continue;
+    matches[match_count].port = record->port;
+    matches[match_count].name = strdup(record->name);
+    if (matches[match_count].name == NULL) {
+      _port_matches_free(matches, match_count);
+      matches = NULL;
+      break;
+    }
+    match_count++;
+  }
+  pthread_mutex_unlock(&(index->lock));
+  if (matches == NULL) PyErr_NoMemory();
+done:
+  if (use_name) regfree(&name_regex);
+  if (use_type) regfree(&type_regex);
+  if (matches == NULL) return(NULL);
+  // convert the matches into a list of Port objects
+  PyObject *return_list = Client_port_list(self, matches, match_count);
+  _port_matches_free(matches, match_count);
+  return(return_list);
+}
+
+// use a client to make a connection between two ports
+static PyObject *
+Client_connect(Client *self, PyObject *args, PyObject *kwds) {
+  Port *source = NULL;
+  Port *destination = NULL;
+  static char *kwlist[] = {"source", "destination", NULL};
+  PyTypeObject *port_type = _module_state(self)->PortType;
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "O!O!", kwlist, 
+                                  port_type, &source, port_type, &destination))
+    return(NULL);
+  const char *source_name = PyUnicode_AsUTF8(source->name);
+  const char *destination_name = PyUnicode_AsUTF8(destination->name);
+  if ((source_name == NULL) || (destination_name == NULL)) return(NULL);
+  Client_activate(self);
+  if (self->is_active != Py_True) return(NULL);
+  // other threads can make connections with the same client at the same time,
+  //  but the client can't be closed or deactivated underneath us
+  int result = -1;
+  Client_lock(self, 0);
+  if ((self->_client != NULL) && (self->is_active == Py_True)) {
+    jack_client_t *client = self->_client;
+    Py_BEGIN_ALLOW_THREADS
+    result = jack_connect(client, source_name, destination_name);
+    Py_END_ALLOW_THREADS
+  }
+  Client_unlock(self);
+  if ((result == 0) || (result == EEXIST)) Py_RETURN_TRUE;
+  else {
+    _warn("Failed to connect JACK ports (error %i)", result);
+    Py_RETURN_FALSE;
+  }
+}
+
+// use a client to break the connection between two ports, if any
+static PyObject *
+Client_disconnect(Client *self, PyObject *args, PyObject *kwds) {
+  Port *source = NULL;
+  Port *destination = NULL;
+  static char *kwlist[] = {"source", "destination", NULL};
+  PyTypeObject *port_type = _module_state(self)->PortType;
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "O!O!", kwlist, 
+                                  port_type, &source, port_type, &destination))
+    return(NULL);
+  const char *source_name = PyUnicode_AsUTF8(source->name);
+  const char *destination_name = PyUnicode_AsUTF8(destination->name);
+  if ((source_name == NULL) || (destination_name == NULL)) return(NULL);
+  Client_activate(self);
+  if (self->is_active != Py_True) return(NULL);
+  // other threads can make connections with the same client at the same time,
+  //  but the client can't be closed or deactivated underneath us
+  int result = -1;
+  Client_lock(self, 0);
+  if ((self->_client != NULL) && (self->is_active == Py_True)) {
+    jack_client_t *client = self->_client;
+    Py_BEGIN_ALLOW_THREADS
+    result = jack_disconnect(client, source_name, destination_name);
+    Py_END_ALLOW_THREADS
+  }
+  Client_unlock(self);
+  if ((result == 0) || (result == EEXIST)) Py_RETURN_TRUE;
+  else {
+    _warn("Failed to disconnect JACK ports (error %i)", result);
+    Py_RETURN_FALSE;
+  }
+}
+
+// define a struct to store a connection to make or break as part of a patch
+typedef struct {
+  PyObject *source;
+  PyObject *destination;
+  jack_port_t *source_port;
+  jack_port_t *destination_port;
+  // whether this is a connection to make, and whether it's already there
+  int connect;
+  int exists;
+  int result;
+} PatchChange;
+
+// get the name of a port given as a Port object or a string, 
+//  returning a new reference or NULL on failure
+static PyObject *
+_patch_port_name(Client *client, PyObject *obj) {
+  if (PyObject_TypeCheck(obj, _module_state(client)->PortType)) {
+    obj = ((Port *)obj)->name;
+  }
+  if (! PyUnicode_Check(obj)) {
+    PyErr_SetString(PyExc_TypeError, 
+      "Connections must be pairs of Port objects or port names");
+    return(NULL);
+  }
+  Py_INCREF(obj);
+  return(obj);
+}
+
+// free a list of patch changes
+static void
+_patch_changes_free(PatchChange *changes, Py_ssize_t count) {
+  Py_ssize_t i;
+  if (changes == NULL) return;
+  for (i = 0; i < count; i++) {
+    Py_XDECREF(changes[i].source);
+    Py_XDECREF(changes[i].destination);
+  }
+  free(changes);
+}
+
+// see whether a list of patch changes already includes a connection
+static int
+_patch_changes_find(PatchChange *changes, Py_ssize_t count, 
+                    jack_port_t *source, jack_port_t *destination) {
+  Py_ssize_t i;
+  for (i = 0; i < count; i++) {
+    if ((changes[i].source_port == source) && 
+        (changes[i].destination_port == destination)) return(1);
+  }
+  return(0);
+}
+
+// make the connections between ports match the given list of 
+//  (source, destination) pairs, connecting any that are missing and 
+//  disconnecting anything else connected to the ports involved
+static PyObject *
+Client_apply_patch(Client *self, PyObject *args, PyObject *kwds) {
+  Py_ssize_t i;
+  int j;
+  PyObject *connections = NULL;
+  int prune = 1;
+  static char *kwlist[] = {"connections", "prune", NULL};
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "O|p", kwlist, 
+                                    &connections, &prune))
+    return(NULL);
+  PyObject *seq = PySequence_Fast(connections, 
+    "Connections must be a sequence of (source, destination) pairs");
+  if (seq == NULL) return(NULL);
+  Py_ssize_t desired_count = PySequence_Fast_GET_SIZE(seq);
+  Py_ssize_t count = 0;
+  Py_ssize_t capacity = desired_count + 16;
+  PatchChange *changes = (PatchChange *)malloc(
+    sizeof(PatchChange) * capacity);
+  if (changes == NULL) {
+    Py_DECREF(seq);
+    return(PyErr_NoMemory());
+  }
+  // get the names of the desired connections
+  for (i = 0; i < desired_count; i++) {
+    PyObject *pair = PySequence_Fast_GET_ITEM(seq, i);
+    PatchChange *change = &(changes[count]);
+    change->source = NULL;
+    change->destination = NULL;
+    if ((! PySequence_Check(pair)) || (PySequence_Size(pair) != 2)) {
+      PyErr_SetString(PyExc_TypeError, 
+        "Connections must be pairs of Port objects or port names");
+      goto error;
+    }
+    PyObject *source = PySequence_GetItem(pair, 0);
+    PyObject *destination = PySequence_GetItem(pair, 1);
+    if ((source != NULL) && (destination != NULL)) {
+      change->source = _patch_port_name(self, source);
+      if (change->source != NULL) {
+        change->destination = _patch_port_name(self, destination);
+      }
+    }
+    Py_XDECREF(source);
+    Py_XDECREF(destination);
+    count++;
+    if (change->destination == NULL) goto error;
+    change->connect = 1;
+    change->exists = 0;
+    change->result = -1;
+  }
+  Py_CLEAR(seq);
+  // compare the desired connections with the ones we know about
+  if (Client_index_ports(self) < 0) goto error;
+  PortIndex *index = &(self->_index);
+  pthread_mutex_lock(&(index->lock));
+  Py_ssize_t desired_end = count;
+  for (i = 0; i < desired_end; i++) {
+    int source = PortIndex_find_name(index, 
+      PyUnicode_AsUTF8(changes[i].source));
+    int destination = PortIndex_find_name(index, 
+      PyUnicode_AsUTF8(changes[i].destination));
+    changes[i].source_port = (source >= 0) ? 
+      index->records[source].port : NULL;
+    changes[i].destination_port = (destination >= 0) ? 
+      index->records[destination].port : NULL;
+    if ((source < 0) || (destination < 0)) continue;
+    PortRecord *record = &(index->records[source]);
+    for (j = 0; j < record->connection_count; j++) {
+      if (record->connections[j] == changes[i].destination_port) {
+        changes[i].exists = 1;
+        changes[i].result = 0;
+      }
+    }
+  }
+  // find connections to break
+  for (i = 0; (prune) && (i < desired_end); i++) {
+    jack_port_t *ends[2] = { changes[i].source_port, 
+                             changes[i].destination_port };
+    int k;
+    for (k = 0; k < 2; k++) {
+      int position = (ends[k] != NULL) ? PortIndex_find(index, ends[k]) : -1;
+      if (position < 0) continue;
+      PortRecord *record = &(index->records[position]);
+      for (j = 0; j < record->connection_count; j++) {
+        jack_port_t *source = (k == 0) ? ends[k] : record->connections[j];
+        jack_port_t *destination = (k == 0) ? record->connections[j] : ends[k];
+        if (_patch_changes_find(changes, count, source, destination)) continue;
+        int other = PortIndex_find(index, record->connections[j]);
+        if (other < 0) continue;
+        if (count >= capacity) {
+          capacity *= 2;
+          PatchChange *grown = (PatchChange *)realloc(changes, 
+            sizeof(PatchChange) * capacity);
+          if (grown == NULL) {
+            pthread_mutex_unlock(&(index->lock));
+            PyErr_NoMemory();
+            goto error;
+          }
+          changes = grown;
+        }
+        PatchChange *change = &(changes[count]);
+        change->source = PyUnicode_FromString(
+          (k == 0) ? record->name : index->records[other].name);
+        change->destination = PyUnicode_FromString(
+          (k == 0) ? index->records[other].name : record->name);
+        change->source_port = source;
+        change->destination_port = destination;
+        change->connect = 0;
+        change->exists = 1;
+        change->result = -1;
+        count++;
+        if ((change->source == NULL) || (change->destination == NULL)) {
+          pthread_mutex_unlock(&(index->lock));
+          goto error;
+        }
+      }
+    }
+  }
+  pthread_mutex_unlock(&(index->lock));
+  // get all the names before releasing the GIL
+  const char **names = (const char **)malloc(sizeof(char *) * 2 * count);
+  if (names == NULL) {
+    PyErr_NoMemory();
+    goto error;
+  }
+  for (i = 0; i < count; i++) {
+    names[i * 2] = PyUnicode_AsUTF8(changes[i].source);
+    names[(i * 2) + 1] = PyUnicode_AsUTF8(changes[i].destination);
+    if ((names[i * 2] == NULL) || (names[(i * 2) + 1] == NULL)) {
+      free(names);
+      goto error;
+    }
+  }
+  // make the changes in one go, breaking connections first
+  Client_lock(self, 0);
+  if ((self->_client != NULL) && (self->is_active == Py_True)) {
+    jack_client_t *client = self->_client;
+    Py_BEGIN_ALLOW_THREADS
+    for (i = desired_end; i < count; i++) {
+      changes[i].result = jack_disconnect(client, 
+        names[i * 2], names[(i * 2) + 1]);
+    }
+    for (i = 0; i < desired_end; i++) {
+      if (changes[i].exists) continue;
+      changes[i].result = jack_connect(client, 
+        names[i * 2], names[(i * 2) + 1]);
+      if (changes[i].result == EEXIST) changes[i].result = 0;
+    }
+    Py_END_ALLOW_THREADS
+  }
+  Client_unlock(self);
+  free(names);
+  // report what happened to each connection
+  PyObject *results = PyList_New(count);
+  if (results == NULL) goto error;
+  for (i = 0; i < count; i++) {
+    const char *action = (! changes[i].connect) ? "disconnect" : 
+      (changes[i].exists ? "keep" : "connect");
+    PyObject *result = Py_BuildValue("(OOsO)", 
+      changes[i].source, changes[i].destination, action, 
+      (changes[i].result == 0) ? Py_True : Py_False);
+    if (result == NULL) {
+      Py_DECREF(results);
+      goto error;
+    }
+    PyList_SET_ITEM(results, i, result);
+  }
+  _patch_changes_free(changes, count);
+  return(results);
+error:
+  Py_XDECREF(seq);
+  _patch_changes_free(changes, count);
+  return(NULL);
+}
+
+// gather everything the client's input ports have received into a dict 
+//  mapping ports to what their receive_all or read methods return
+static PyObject *
+Client_cycle_inputs(Client *self) {
+  int i;
+  PyObject *inputs = PyDict_New();
+  if (inputs == NULL) return(NULL);
+  PortTable *table = atomic_load(&(self->_ports));
+  if (table == NULL) return(inputs);
+  for (i = 0; i < table->receive_count + table->audio_count; i++) {
+    ManagedPort *managed = (i < table->receive_count) ? 
+      table->receive_ports[i] : table->audio_ports[i - table->receive_count];
+    if ((managed->port == NULL) || (! managed->is_input)) continue;
+    // skip ports with nothing to read
+    jack_ringbuffer_t *queue = managed->is_audio ? 
+      managed->audio_queue : managed->receive_queue;
+    if (jack_ringbuffer_read_space(queue) == 0) continue;
+    Port *port = Client_port_object(self, managed->port, 
+                                    jack_port_name(managed->port));
+    if (port == NULL) {
+      Py_DECREF(inputs);
+      return(NULL);
+    }
+    PyObject *received;
+    if (managed->is_audio) {
+      received = PyObject_CallMethod((PyObject *)port, "read", NULL);
+    }
+    else {
+      PyObject *no_args = PyTuple_New(0);
+      PyObject *kwargs = Py_BuildValue("{s:O}", "timestamps", Py_True);
+      PyObject *method = PyObject_GetAttrString((PyObject *)port, 
+                                                "receive_all");
+      received = ((no_args != NULL) && (kwargs != NULL) && (method != NULL)) ? 
+        PyObject_Call(method, no_args, kwargs) : NULL;
+      Py_XDECREF(no_args);
+      Py_XDECREF(kwargs);
+      Py_XDECREF(method);
+    }
+    if ((received == NULL) || 
+        (PyDict_SetItem(inputs, (PyObject *)port, received) < 0)) {
+      Py_XDECREF(received);
+      Py_DECREF(port);
+      Py_DECREF(inputs);
+      return(NULL);
+    }
+    Py_DECREF(received);
+    Py_DECREF(port);
+  }
+  return(inputs);
+}
+
+// call the cycle handler for the last cycle (only while holding the GIL)
+static void
+Client_call_cycle_handler(Client *self) {
+  PyObject *handler;
+  Py_BEGIN_CRITICAL_SECTION(self);
+  handler = self->_cycle_handler;
+  Py_XINCREF(handler);
+  Py_END_CRITICAL_SECTION();
+  if (handler == NULL) return;
+  uint64_t info = atomic_load(&(self->_cycle_info));
+  jack_nframes_t frame = (jack_nframes_t)(info >> 32);
+  jack_nframes_t nframes = (jack_nframes_t)(info & 0xFFFFFFFF);
+  PyObject *inputs = Client_cycle_inputs(self);
+  PyObject *result = NULL;
+  if (inputs != NULL) {
+    result = PyObject_CallFunction(handler, "kkO", 
+      (unsigned long)frame, (unsigned long)nframes, inputs);
+    Py_DECREF(inputs);
+  }
+  // there's nobody to raise errors to on this thread, so report them 
+  //  and keep going
+  if (result == NULL) PyErr_WriteUnraisable(handler);
+  Py_XDECREF(result);
+  Py_DECREF(handler);
+}
+
+// define a struct to pass a client to its cycle handler's thread
+typedef struct {
+  Client *client;
+  int generation;
+  PyInterpreterState *interpreter;
+} CycleThreadArgs;
+
+// run the cycle handler each time the process callback signals the thread
+static void *
+Client_cycle_thread(void *args_ptr) {
+  CycleThreadArgs *args = (CycleThreadArgs *)args_ptr;
+  Client *self = args->client;
+  int generation = args->generation;
+  // run in the interpreter that started the thread, which may not be the 
+  //  main one
+  PyThreadState *thread_state = PyThreadState_New(args->interpreter);
+  free(args);
+  while (atomic_load(&(self->_cycle_generation)) == generation) {
+    if (sem_wait(&(self->_cycle_signal)) != 0) continue;
+    if (atomic_load(&(self->_cycle_generation)) != generation) break;
+    PyEval_RestoreThread(thread_state);
+    Client_call_cycle_handler(self);
+    PyEval_SaveThread();
+  }
+  // drop the thread's reference to the client
+  PyEval_RestoreThread(thread_state);
+  Py_DECREF((PyObject *)self);
+  PyThreadState_Clear(thread_state);
+  PyThreadState_DeleteCurrent();
+  return(NULL);
+}
+
+// start the cycle handler's thread if it isn't running, returning 0 on 
+//  success or -1 with an exception set
+static int
+Client_start_cycle_thread(Client *self) {
+  if (self->_cycle_thread_running) return(0);
+  CycleThreadArgs *args = (CycleThreadArgs *)malloc(sizeof(CycleThreadArgs));
+  if (args == NULL) {
+    PyErr_NoMemory();
+    return(-1);
+  }
+  // the thread holds a reference to the client so the client outlives it
+  Py_INCREF((PyObject *)self);
+  args->client = self;
+  args->generation = atomic_load(&(self->_cycle_generation));
+  args->interpreter = PyInterpreterState_Get();
+  int result = pthread_create(&(self->_cycle_thread), NULL, 
+                              Client_cycle_thread, args);
+  if (result != 0) {
+    free(args);
+    Py_DECREF((PyObject *)self);
+    _error(self, "Failed to start a thread for the cycle handler (error %i)", 
+           result);
+    return(-1);
+  }
+  self->_cycle_thread_running = 1;
+  return(0);
+}
+
+// stop the cycle handler's thread if it's running, waiting for it to 
+//  finish unless it's the thread calling this
+static void
+Client_stop_cycle_thread(Client *self) {
+  if (! self->_cycle_thread_running) return;
+  atomic_store(&(self->_cycle_enabled), 0);
+  atomic_fetch_add(&(self->_cycle_generation), 1);
+  sem_post(&(self->_cycle_signal));
+  pthread_t thread = self->_cycle_thread;
+  self->_cycle_thread_running = 0;
+  if (pthread_equal(pthread_self(), thread)) {
+    pthread_detach(thread);
+  }
+  else {
+    Py_BEGIN_ALLOW_THREADS
+    pthread_join(thread, NULL);
+    Py_END_ALLOW_THREADS
+  }
+}
+
+// set a function to call after every process cycle, or None to stop
+static PyObject *
+Client_set_cycle_handler(Client *self, PyObject *args, PyObject *kwds) {
+  PyObject *handler = NULL;
+  static char *kwlist[] = { "handler", NULL };
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "O", kwlist, &handler)) {
+    return(NULL);
+  }
+  if ((handler != Py_None) && (! PyCallable_Check(handler))) {
+    PyErr_SetString(PyExc_TypeError, 
+      "Client.set_cycle_handler expects a callable or None");
+    return(NULL);
+  }
+  PyObject *tmp;
+  if (handler == Py_None) {
+    Client_stop_cycle_thread(self);
+    Py_BEGIN_CRITICAL_SECTION(self);
+    tmp = self->_cycle_handler;
+    self->_cycle_handler = NULL;
+    Py_END_CRITICAL_SECTION();
+    Py_XDECREF(tmp);
+    Py_RETURN_NONE;
+  }
+  Py_INCREF(handler);
+  Py_BEGIN_CRITICAL_SECTION(self);
+  tmp = self->_cycle_handler;
+  self->_cycle_handler = handler;
+  Py_END_CRITICAL_SECTION();
+  Py_XDECREF(tmp);
+  Client_activate(self);
+  if (self->is_active != Py_True) return(NULL);
+  if (Client_start_cycle_thread(self) < 0) return(NULL);
+  atomic_store(&(self->_cycle_enabled), 1);
+  Py_RETURN_NONE;
+}
+
+// start recording MIDI received on some of the client's ports to a file, 
+//  returning a Recorder
+static PyObject *
+Client_record(Client *self, PyObject *args, PyObject *kwds) {
+  PyObject *client_args = Py_BuildValue("(O)", self);
+  if (client_args == NULL) return(NULL);
+  PyObject *recorder_args = PySequence_Concat(client_args, args);
+  Py_DECREF(client_args);
+  if (recorder_args == NULL) return(NULL);
+  PyTypeObject *recorder_type = _module_state(self)->RecorderType;
+  PyObject *recorder = PyObject_Call((PyObject *)recorder_type, 
+                                     recorder_args, kwds);
+  Py_DECREF(recorder_args);
+  return(recorder);
+}
+
+// get statistics for the client's send pool and receive arena, so their 
+//  sizes can be checked against what a program actually needs
+static PyObject *
+Client_pool_stats(Client *self) {
+  int c;
+  PyObject *send = Py_None;
+  PyObject *receive = Py_None;
+  MessagePool *pool = self->_pool;
+  ReceiveArena *arena = self->_arena;
+  if (pool != NULL) {
+    // recycle sent messages first so the counts are current, and copy 
+    //  them out under the lock so they're consistent with each other
+    StateLock_acquire(&(pool->lock));
+    MessagePool_collect(pool);
+    int in_use = pool->in_use;
+    int high_water = pool->high_water;
+    unsigned long misses = pool->misses;
+    unsigned long large = pool->large;
+    StateLock_release(&(pool->lock));
+    send = Py_BuildValue("{s:n,s:i,s:i,s:i,s:k,s:k,s:k}", 
+      "slot_size", (Py_ssize_t)MESSAGE_POOL_SLOT_DATA, 
+      "slots", pool->slot_count, 
+      "in_use", in_use, 
+      "high_water", high_water, 
+      "misses", misses, 
+      "large", large, 
+      "rt_frees", pool->rt_frees);
+    if (send == NULL) return(NULL);
+  }
+  else Py_INCREF(send);
+  if (arena != NULL) {
+    PyObject *classes = PyList_New(RECEIVE_ARENA_CLASSES);
+    if (classes == NULL) {
+      Py_DECREF(send);
+      return(NULL);
+    }
+    for (c = 0; c < RECEIVE_ARENA_CLASSES; c++) {
+      ArenaClass *class = &(arena->classes[c]);
+      PyObject *item = Py_BuildValue("{s:n,s:k,s:n}", 
+        "slot_size", (Py_ssize_t)class->slot_size, 
+        "slots", (unsigned long)class->slot_count, 
+        "free", (Py_ssize_t)(jack_ringbuffer_read_space(class->free_slots) / 
+                            sizeof(uint32_t)));
+      if (item == NULL) {
+        Py_DECREF(classes);
+        Py_DECREF(send);
+        return(NULL);
+      }
+      PyList_SET_ITEM(classes, c, item);
+    }
+    receive = Py_BuildValue("{s:N,s:k}", 
+      "classes", classes, "misses", arena->misses);
+    if (receive == NULL) {
+      Py_DECREF(send);
+      return(NULL);
+    }
+  }
+  else Py_INCREF(receive);
+  return(Py_BuildValue("{s:N,s:N}", "send", send, "receive", receive));
+}
+
+// get statistics for one of the client's ports
+static PyObject *
+Client_port_stats(ManagedPort *managed) {
+  size_t receive_queue = 0;
+  if (managed->receive_queue != NULL) {
+    receive_queue = jack_ringbuffer_read_space(managed->receive_queue);
+  }
+  if (managed->audio_queue != NULL) {
+    receive_queue = jack_ringbuffer_read_space(managed->audio_queue);
+  }
+  return(Py_BuildValue(
+    "{s:k,s:k,s:k,s:k,s:k,s:k,s:k,s:k,s:k,s:k,s:k,s:k,s:n}", 
+    "sent", managed->sent, 
+    "received", managed->received, 
+    "filtered", managed->receive_filtered, 
+    "reserve_failures", managed->reserve_failures, 
+    "send_overflows", managed->send_overflows, 
+    "send_drops", managed->send_drops, 
+    "coalesced", managed->coalesced, 
+    "underruns", managed->audio_underruns, 
+    "receive_overflows", managed->receive_overflows, 
+    "route_overflows", managed->route_overflows, 
+    "intake_retries", atomic_load(&(managed->intake_retries)), 
+    "send_queue", atomic_load(&(managed->send_queue_count)), 
+    "receive_queue", (Py_ssize_t)receive_queue));
+}
+
+// get statistics about the client's process callback and ports, 
+//  with times in seconds
+static PyObject *
+Client_stats(Client *self) {
+  int i;
+  ProcessStats *stats = &(self->_stats);
+  // copy the counters first so they're consistent with each other
+  unsigned long count = stats->count;
+  uint64_t min_ns = stats->min_ns;
+  uint64_t max_ns = stats->max_ns;
+  uint64_t total_ns = stats->total_ns;
+  unsigned long histogram[PROCESS_TIME_BUCKETS];
+  for (i = 0; i < PROCESS_TIME_BUCKETS; i++) {
+    histogram[i] = stats->histogram[i];
+  }
+  // estimate the 99th percentile as the top of the bucket it falls in
+  PyObject *buckets = PyList_New(0);
+  if (buckets == NULL) return(NULL);
+  unsigned long total = 0;
+  unsigned long seen = 0;
+  uint64_t p99_ns = 0;
+  for (i = 0; i < PROCESS_TIME_BUCKETS; i++) total += histogram[i];
+  for (i = 0; i < PROCESS_TIME_BUCKETS; i++) {
+    if (histogram[i] == 0) continue;
+    uint64_t limit = _process_time_bucket_limit(i);
+    if ((i == PROCESS_TIME_BUCKETS - 1) || (limit > max_ns)) limit = max_ns;
+    if ((seen * 100) < (total * 99)) p99_ns = limit;
+    seen += histogram[i];
+    PyObject *bucket = Py_BuildValue("(dk)", 
+      (double)limit / 1e9, histogram[i]);
+    if ((bucket == NULL) || (PyList_Append(buckets, bucket) < 0)) {
+      Py_XDECREF(bucket);
+      Py_DECREF(buckets);
+      return(NULL);
+    }
+    Py_DECREF(bucket);
+  }
+  PyObject *process_time;
+  if (count > 0) {
+    process_time = Py_BuildValue("{s:k,s:d,s:d,s:d,s:d,s:N}", 
+      "count", count, 
+      "min", (double)min_ns / 1e9, 
+      "avg", ((double)total_ns / (double)count) / 1e9, 
+      "p99", (double)p99_ns / 1e9, 
+      "max", (double)max_ns / 1e9, 
+      "histogram", buckets);
+  }
+  else {
+    process_time = Py_BuildValue("{s:k,s:O,s:O,s:O,s:O,s:N}", 
+      "count", count, "min", Py_None, "avg", Py_None, "p99", Py_None, 
+      "max", Py_None, "histogram", buckets);
+  }
+  if (process_time == NULL) return(NULL);
+  // get stats for each managed port by name
+  unsigned long intake_retries = 0;
+  PyObject *ports = PyDict_New();
+  if (ports == NULL) {
+    Py_DECREF(process_time);
+    return(NULL);
+  }
+  PortTable *table = atomic_load(&(self->_ports));
+  if (table != NULL) {
+    for (i = 0; i < table->send_count + table->receive_count + 
+                    table->audio_count; i++) {
+      ManagedPort *managed = table->ports[i];
+      if (managed->port == NULL) continue;
+      intake_retries += managed->intake_retries;
+      PyObject *port_stats = Client_port_stats(managed);
+      if ((port_stats == NULL) || 
+          (PyDict_SetItemString(ports, jack_port_name(managed->port), 
+                                port_stats) < 0)) {
+        Py_XDECREF(port_stats);
+        Py_DECREF(ports);
+        Py_DECREF(process_time);
+        return(NULL);
+      }
+      Py_DECREF(port_stats);
+    }
+  }
+  return(Py_BuildValue("{s:k,s:k,s:k,s:N,s:k,s:N}", 
+    "cycles", (unsigned long)atomic_load(&(self->_process_cycles)), 
+    "xruns", stats->xruns, 
+    "handler_overruns", self->_cycle_overruns, 
+    "process_time", process_time, 
+    "intake_retries", intake_retries, 
+    "ports", ports));
+}
+
+// clean up allocated data for a client
+static void
+Client_dealloc(Client* self) {
+  int i;
+  PyObject_GC_UnTrack((PyObject *)self);
+  Client_close(self);
+  // free the state for managed ports, which also discards their 
+  //  send and receive queues (no Port objects can be using them, since 
+  //  they all hold a reference to the client)
+  PortTable *ports = atomic_exchange(&(self->_ports), NULL);
+  if (ports != NULL) {
+    for (i = 0; i < ports->send_count + ports->receive_count + 
+                    ports->audio_count; i++) {
+      ManagedPort_free(ports->ports[i]);
+    }
+    free(ports);
+  }
+  // free the arena once nothing's holding slots from it
+  ReceiveArena_free(self->_arena);
+  self->_arena = NULL;
+  // likewise for the send pool, which also frees any sent messages 
+  //  still waiting to be recycled
+  MessagePool_free(self->_pool);
+  self->_pool = NULL;
+  // free routing tables now that the process callback isn't running
+  free(atomic_exchange(&(self->_routes), NULL));
+  free(atomic_exchange(&(self->_tempo_map), NULL));
+  Client_reclaim(self, 1);
+  // close the notification pipe
+  if (self->_notify_fds[0] >= 0) close(self->_notify_fds[0]);
+  if (self->_notify_fds[1] >= 0) close(self->_notify_fds[1]);
+  self->_notify_fds[0] = -1;
+  self->_notify_fds[1] = -1;
+  pthread_rwlock_destroy(&(self->_lock));
+  Py_XDECREF(self->_cycle_handler);
+  self->_cycle_handler = NULL;
+  sem_destroy(&(self->_cycle_signal));
+  // free the port index
+  PortIndex_clear(&(self->_index));
+  pthread_mutex_destroy(&(self->_index.lock));
+  Py_XDECREF(self->_port_objects);
+  self->_port_objects = NULL;
+  Py_CLEAR(self->_midi_type_name);
+  Py_CLEAR(self->_audio_type_name);
+  Client_release_transport(self);
+  Py_XDECREF(self->name);
+  PyTypeObject *type = Py_TYPE(self);
+  type->tp_free((PyObject *)self);
+  Py_DECREF(type);
+}
+
+// let the garbage collector see the references a client holds
+static int
+Client_traverse(Client *self, visitproc visit, void *arg) {
+  Py_VISIT(Py_TYPE(self));
+  Py_VISIT(self->name);
+  Py_VISIT(self->is_open);
+  Py_VISIT(self->is_active);
+  Py_VISIT(self->transport);
+  Py_VISIT(self->_cycle_handler);
+  Py_VISIT(self->_port_objects);
+  Py_VISIT(self->_midi_type_name);
+  Py_VISIT(self->_audio_type_name);
+  return(0);
+}
+
+// break reference cycles through a client, which can only close through 
+//  its cycle handler since the other references it holds are to things 
+//  that don't point back at it (a running cycle thread holds a reference 
+//  to the client, so this never runs while the handler might be called)
+static int
+Client_clear(Client *self) {
+  Py_BEGIN_CRITICAL_SECTION(self);
+  Py_CLEAR(self->_cycle_handler);
+  Py_END_CRITICAL_SECTION();
+  return(0);
+}
+
+static PyMemberDef Client_members[] = {
+  {"name", T_OBJECT_EX, offsetof(Client, name), READONLY,
+   "The client's unique name"},
+  {"is_open", T_OBJECT_EX, offsetof(Client, is_open), READONLY,
+   "Whether the client is connected to JACK"},
+  {"is_active", T_OBJECT_EX, offsetof(Client, is_active), READONLY,
+   "Whether the client is activated to send and receive data"},
+  {"transport", T_OBJECT_EX, offsetof(Client, transport), READONLY,
+   "A Transport that interfaces with the JACK transport via this client"},
+  {NULL}  /* Sentinel */
+};
+
+// get the server's sample rate and buffer size
+static PyObject *
+Client_get_sample_rate(Client *self, void *closure) {
+  Client_open(self);
+  if (self->_client == NULL) return(NULL);
+  return(PyLong_FromUnsignedLong(Client_sample_rate(self)));
+}
+static PyObject *
+Client_get_buffer_size(Client *self, void *closure) {
+  Client_open(self);
+  if (self->_client == NULL) return(NULL);
+  return(PyLong_FromUnsignedLong(atomic_load(&(self->_buffer_size))));
+}
+
+// get the current time on JACK's frame clock
+static PyObject *
+Client_get_frame_time(Client *self, void *closure) {
+  Client_open(self);
+  if (self->_client == NULL) return(NULL);
+  return(PyLong_FromUnsignedLong(jack_frame_time(self->_client)));
+}
+
+static PyGetSetDef Client_getset[] = {
+  {"frame_time", (getter)Client_get_frame_time, NULL, 
+    "The current time in frames on JACK's frame clock", NULL},
+  {"sample_rate", (getter)Client_get_sample_rate, NULL, 
+    "The JACK server's sample rate in frames per second", NULL},
+  {"buffer_size", (getter)Client_get_buffer_size, NULL, 
+    "The number of frames in each of the JACK server's process cycles", NULL},
+  {NULL}  /* Sentinel */
+};
+
+static PyMethodDef Client_methods[] = {
+    {"open", (PyCFunction)Client_open, METH_NOARGS,
+      "Ensure the client is connected to JACK"},
+    {"close", (PyCFunction)Client_close, METH_NOARGS,
+      "Ensure the client is not connected to JACK"},
+    {"activate", (PyCFunction)Client_activate, METH_NOARGS,
+      "Ensure the client is ready to send and receive data"},
+    {"deactivate", (PyCFunction)Client_deactivate, METH_NOARGS,
+      "Ensure the client cannot send and receive data"},
+    {"get_ports", (PyCFunction)Client_get_ports, METH_VARARGS | METH_KEYWORDS,
+      "Get a list of available ports"},
+    {"connect", (PyCFunction)Client_connect, METH_VARARGS | METH_KEYWORDS,
+      "Connect a source and destination port"},
+    {"disconnect", (PyCFunction)Client_disconnect, METH_VARARGS | METH_KEYWORDS,
+      "Disconnect a source and destination port"},
+    {"apply_patch", (PyCFunction)Client_apply_patch, METH_VARARGS | METH_KEYWORDS,
+      "Make only the given connections between a set of ports"},
+    {"fileno", (PyCFunction)Client_fileno, METH_NOARGS,
+      "Get a file descriptor that becomes readable when MIDI is received"},
+    {"set_routes", (PyCFunction)Client_set_routes, METH_VARARGS | METH_KEYWORDS,
+      "Replace the rules for routing MIDI between the client's ports"},
+    {"set_cycle_handler", (PyCFunction)Client_set_cycle_handler, 
+      METH_VARARGS | METH_KEYWORDS,
+      "Set a function to call with the client's input after every cycle"},
+    {"record", (PyCFunction)Client_record, METH_VARARGS | METH_KEYWORDS,
+      "Record MIDI received on some of the client's ports to a file"},
+    {"stats", (PyCFunction)Client_stats, METH_NOARGS,
+      "Get statistics about the client's processing and ports"},
+    {"pool_stats", (PyCFunction)Client_pool_stats, METH_NOARGS,
+      "Get statistics for the memory used to send and receive MIDI"},
+    {NULL, NULL, 0, NULL}  /* Sentinel */
+};
+
+static PyType_Slot Client_slots[] = {
+  {Py_tp_dealloc, (destructor)Client_dealloc},
+  {Py_tp_traverse, (traverseproc)Client_traverse},
+  {Py_tp_clear, (inquiry)Client_clear},
+  {Py_tp_doc, "Represents a JACK client"},
+  {Py_tp_methods, Client_methods},
+  {Py_tp_members, Client_members},
+  {Py_tp_getset, Client_getset},
+  {Py_tp_init, (initproc)Client_init},
+  {Py_tp_new, Client_new},
+  {0, NULL}
+};
+
+static PyType_Spec Client_spec = {
+  "jackpatch.Client",          /* name */
+  sizeof(Client),              /* basicsize */
+  0,                           /* itemsize */
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC | Py_TPFLAGS_BASETYPE, /* flags */
+  Client_slots                 /* slots */
+};
+
+// TRANSPORT ******************************************************************
+
+static PyObject *
+Transport_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+  Transport *self;
+  self = (Transport *)type->tp_alloc(type, 0);
+  if (self != NULL) {
+    Py_INCREF(Py_None);
+    self->client = Py_None;
+    self->_owns_client = 1;
+  }
+  return((PyObject *)self);
+}
+
+static int
+Transport_init(Transport *self, PyObject *args, PyObject *kwds) {
+  PyObject *client=NULL, *tmp;
+  static char *kwlist[] = {"client", NULL};
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "O!", kwlist, 
+                                    _module_state(self)->ClientType, &client))
+    return(-1);
+  tmp = self->_owns_client ? self->client : NULL;
+  Py_INCREF(client);
+  self->client = client;
+  self->_owns_client = 1;
+  Py_XDECREF(tmp);
+  return(0);
+}
+
+// clean up allocated data for a transport
+static void
+Transport_dealloc(Transport* self) {
+  PyObject_GC_UnTrack((PyObject *)self);
+  if (self->_owns_client) Py_XDECREF(self->client);
+  PyTypeObject *type = Py_TYPE(self);
+  type->tp_free((PyObject *)self);
+  Py_DECREF(type);
+}
+
+// let the garbage collector see the references a transport holds
+static int
+Transport_traverse(Transport *self, visitproc visit, void *arg) {
+  Py_VISIT(Py_TYPE(self));
+  if (self->_owns_client) Py_VISIT(self->client);
+  return(0);
+}
+
+// get the client the transport talks to JACK through, returning NULL with 
+//  an exception set if that was the client's own transport and it's gone
+static Client *
+Transport_client(Transport *self) {
+  if (self->client == Py_None) {
+    _error(self, "%s", "The transport's client no longer exists");
+    return(NULL);
+  }
+  return((Client *)self->client);
+}
+
+// get the transport's state and position, copying the snapshot the 
+//  process callback publishes if the client is active so it doesn't take a 
+//  request to the server, and returning -1 with an exception set on failure
+static int
+Transport_query(Transport *self, jack_transport_state_t *state, 
+                jack_position_t *pos) {
+  Client *client = Transport_client(self);
+  if (client == NULL) return(-1);
+  if (Client_read_transport(client, state, pos) == 0) return(0);
+  // make sure the client is connected to JACK
+  Client_open(client);
+  if (client->_client == NULL) return(-1);
+  *state = jack_transport_query(client->_client, pos);
+  return(0);
+}
+
+// get a transport position in seconds, moving it along by the time since 
+//  it was captured if the transport is rolling
+static double
+_transport_time(jack_transport_state_t state, const jack_position_t *pos) {
+  if (pos->frame_rate == 0) return(0.0);
+  double frame = (double)pos->frame;
+  if (state == JackTransportRolling) {
+    jack_time_t now = jack_get_time();
+    if (now > pos->usecs) {
+      frame += (double)(now - pos->usecs) * (double)pos->frame_rate / 1.0e6;
+    }
+  }
+  return(frame / (double)pos->frame_rate);
+}
+
+// get the current time of the transport
+static PyObject *
+Transport_get_time(Transport *self, void *closure) {
+  jack_transport_state_t state;
+  jack_position_t pos;
+  if (Transport_query(self, &state, &pos) < 0) return(NULL);
+  return(PyFloat_FromDouble(_transport_time(state, &pos)));
+}
+// set the current time of the transport
+static int
+Transport_set_time(Transport *self, PyObject *value, void *closure) {
+  if (value == NULL) {
+    PyErr_SetString(PyExc_TypeError, "Cannot delete the time attribute");
+    return -1;
+  }
+  double time = PyFloat_AsDouble(value);
+  if (PyErr_Occurred()) return(-1);
+  // guard against negative transport locations
+  if (time < 0.0) time = 0.0;
+  // make sure the client is connected to JACK
+  Client *client = Transport_client(self);
+  if (client == NULL) return(-1);
+  Client_open(client);
+  if (client->_client == NULL) return(-1);
+  // convert the time to frames
+  jack_nframes_t sample_rate = Client_sample_rate(client);
+  jack_nframes_t nframes = (jack_nframes_t)((double)sample_rate * time);
+  // request that JACK update the position
+  int result = -1;
+  Client_lock(client, 0);
+  if (client->_client != NULL) {
+    jack_client_t *jack_client = client->_client;
+    Py_BEGIN_ALLOW_THREADS
+    result = jack_transport_locate(jack_client, nframes);
+    Py_END_ALLOW_THREADS
+  }
+  Client_unlock(client);
+  // warn if that failed
+  if (result != 0) {
+    _warn("Failed to set transport location to %f (error %d)", time, result);
+  }
+  return(0);
+}
+
+// start the transport rolling
+static PyObject *
+Transport_start(Transport *self) {
+  // make sure the client is connected to JACK
+  Client *client = Transport_client(self);
+  if (client == NULL) return(NULL);
+  Client_open(client);
+  if (client->_client == NULL) return(NULL);
+  // set the transport state
+  jack_transport_start(client->_client);
+  Py_RETURN_NONE;
+}
+// stop the transport rolling
+static PyObject *
+Transport_stop(Transport *self) {
+  // make sure the client is connected to JACK
+  Client *client = Transport_client(self);
+  if (client == NULL) return(NULL);
+  Client_open(client);
+  if (client->_client == NULL) return(NULL);
+  // set the transport state
+  jack_transport_stop(client->_client);
+  Py_RETURN_NONE;
+}
+
+// get whether the transport is rolling
+static PyObject *
+Transport_get_is_rolling(Transport *self, void *closure) {
+  jack_transport_state_t state;
+  jack_position_t pos;
+  if (Transport_query(self, &state, &pos) < 0) return(NULL);
+  if (state == JackTransportRolling) Py_RETURN_TRUE;
+  else Py_RETURN_FALSE;
+}
+// start/stop the transport by setting its rolling state
+static int
+Transport_set_is_rolling(Transport *self, PyObject *value, void *closure) {
+  if (PyObject_IsTrue(value)) {
+    Transport_start(self);
+  }
+  else {
+    Transport_stop(self);
+  }
+  return(0);
+}
+
+// the fields of the transport position that can be read as attributes
+enum {
+  TRANSPORT_BAR,
+  TRANSPORT_BEAT,
+  TRANSPORT_TICK,
+  TRANSPORT_BPM
+};
+
+// get a bar/beat/tick field of the transport position, 
+//  or None if the timebase master isn't providing one
+static PyObject *
+Transport_get_bbt(Transport *self, void *closure) {
+  jack_transport_state_t state;
+  jack_position_t pos;
+  if (Transport_query(self, &state, &pos) < 0) return(NULL);
+  if ((pos.valid & JackPositionBBT) == 0) Py_RETURN_NONE;
+  switch ((intptr_t)closure) {
+    case TRANSPORT_BAR: return(PyLong_FromLong(pos.bar));
+    case TRANSPORT_BEAT: return(PyLong_FromLong(pos.beat));
+    case TRANSPORT_TICK: return(PyLong_FromLong(pos.tick));
+    default: return(PyFloat_FromDouble(pos.beats_per_minute));
+  }
+}
+
+// get everything about the transport's position at once, 
+//  so all the values are from the same moment
+static PyObject *
+Transport_get_position(Transport *self, void *closure) {
+  jack_transport_state_t state;
+  jack_position_t pos;
+  if (Transport_query(self, &state, &pos) < 0) return(NULL);
+  PyObject *position = Py_BuildValue("{s:k,s:d,s:O}", 
+    "frame", (unsigned long)pos.frame, 
+    "time", _transport_time(state, &pos), 
+    "is_rolling", (state == JackTransportRolling) ? Py_True : Py_False);
+  if ((position == NULL) || ((pos.valid & JackPositionBBT) == 0)) {
+    return(position);
+  }
+  PyObject *bbt = Py_BuildValue("{s:i,s:i,s:i,s:d,s:d,s:d,s:d,s:d}", 
+    "bar", (int)pos.bar, 
+    "beat", (int)pos.beat, 
+    "tick", (int)pos.tick, 
+    "bar_start_tick", pos.bar_start_tick, 
+    "beats_per_bar", (double)pos.beats_per_bar, 
+    "beat_type", (double)pos.beat_type, 
+    "ticks_per_beat", pos.ticks_per_beat, 
+    "bpm", pos.beats_per_minute);
+  if ((bbt == NULL) || (PyDict_Update(position, bbt) < 0)) {
+    Py_XDECREF(bbt);
+    Py_DECREF(position);
+    return(NULL);
+  }
+  Py_DECREF(bbt);
+  return(position);
+}
+
+// make a tempo map from a sequence of (time, bpm[, beats_per_bar[, 
+//  beat_type]]) tuples, returning NULL with an exception set on failure
+static TempoMap *
+_tempo_map_from_sequence(PyObject *map_obj, double ticks_per_beat) {
+  PyObject *seq = PySequence_Fast(map_obj, 
+    "A tempo map must be a sequence of tuples");
+  if (seq == NULL) return(NULL);
+  Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+  if (count == 0) {
+    Py_DECREF(seq);
+    PyErr_SetString(PyExc_ValueError, "A tempo map can't be empty");
+    return(NULL);
+  }
+  TempoMap *map = (TempoMap *)malloc(sizeof(TempoMap) + 
+                                     (sizeof(TempoSpan) * count));
+  if (map == NULL) {
+    Py_DECREF(seq);
+    PyErr_NoMemory();
+    return(NULL);
+  }
+  map->ticks_per_beat = ticks_per_beat;
+  map->count = (int)count;
+  Py_ssize_t i;
+  for (i = 0; i < count; i++) {
+    TempoSpan *span = &(map->spans[i]);
+    span->beats_per_bar = 4.0;
+    span->beat_type = 4.0;
+    PyObject *item = PySequence_Tuple(PySequence_Fast_GET_ITEM(seq, i));
+    int parsed = (item != NULL) && 
+      PyArg_ParseTuple(item, "dd|ff:set_tempo_map", &(span->time), 
+        &(span->beats_per_minute), &(span->beats_per_bar), 
+        &(span->beat_type));
+    Py_XDECREF(item);
+    if (! parsed) goto error;
+    if ((span->beats_per_minute <= 0.0) || (span->beats_per_bar <= 0.0) || 
+        (span->beat_type <= 0.0)) {
+      PyErr_SetString(PyExc_ValueError, 
+        "Tempo map values must be greater than zero");
+      goto error;
+    }
+    // the first span covers the transport from the start
+    if (i == 0) {
+      span->time = 0.0;
+      span->bars = 0.0;
+      span->ticks = 0.0;
+      continue;
+    }
+    TempoSpan *last = &(map->spans[i - 1]);
+    if (span->time <= last->time) {
+      PyErr_SetString(PyExc_ValueError, 
+        "Tempo map times must be in increasing order");
+      goto error;
+    }
+    double beats = (span->time - last->time) * last->beats_per_minute / 60.0;
+    span->bars = last->bars + (beats / last->beats_per_bar);
+    span->ticks = last->ticks + (beats * ticks_per_beat);
+  }
+  Py_DECREF(seq);
+  return(map);
+  error:
+    Py_DECREF(seq);
+    free(map);
+    return(NULL);
+}
+
+// make the client the transport's timebase master using a tempo map, 
+//  or stop being the master if the map is None
+static PyObject *
+Transport_set_tempo_map(Transport *self, PyObject *args, PyObject *kwds) {
+  PyObject *map_obj = NULL;
+  double ticks_per_beat = 1920.0;
+  int conditional = 0;
+  static char *kwlist[] = {"tempo_map", "ticks_per_beat", "conditional", 
+                           NULL};
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "O|dp", kwlist, &map_obj, 
+                                    &ticks_per_beat, &conditional))
+    return(NULL);
+  if (ticks_per_beat <= 0.0) {
+    PyErr_SetString(PyExc_ValueError, 
+      "Transport.set_tempo_map expects ticks_per_beat to be positive");
+    return(NULL);
+  }
+  TempoMap *map = NULL;
+  if (map_obj != Py_None) {
+    map = _tempo_map_from_sequence(map_obj, ticks_per_beat);
+    if (map == NULL) return(NULL);
+  }
+  // the timebase callback only runs while the client is active
+  Client *client = Transport_client(self);
+  if (client == NULL) {
+    free(map);
+    return(NULL);
+  }
+  Client_activate(client);
+  if (client->is_active != Py_True) {
+    free(map);
+    return(NULL);
+  }
+  int result = 0;
+  Client_lock(client, 0);
+  if (client->_client != NULL) {
+    jack_client_t *jack_client = client->_client;
+    Py_BEGIN_ALLOW_THREADS
+    if (map != NULL) {
+      result = jack_set_timebase_callback(jack_client, conditional, 
+                                          Client_timebase, client);
+    }
+    else result = jack_release_timebase(jack_client);
+    Py_END_ALLOW_THREADS
+  }
+  Client_unlock(client);
+  if ((map != NULL) && (result != 0)) {
+    free(map);
+    if (result == EBUSY) {
+      _error(self, "%s", "Another client is already the timebase master");
+    }
+    else _error(self, "Failed to become the timebase master (error %i)", 
+                      result);
+    return(NULL);
+  }
+  // swap in the new map and keep the old one until the callback is done
+  TempoMap *old = atomic_exchange(&(client->_tempo_map), map);
+  if (Client_retire(client, old, free) < 0) {
+    // if we can't track it, it's safer to leak it than to free it early
+    return(PyErr_NoMemory());
+  }
+  Py_RETURN_NONE;
+}
+
+static PyMemberDef Transport_members[] = {
+  {"client", T_OBJECT_EX, offsetof(Transport, client), READONLY,
+   "The client the transport uses to communicate with JACK"},
+  {NULL}  /* Sentinel */
+};
+
+static PyGetSetDef Transport_getset[] = {
+  {"time", (getter)Transport_get_time, (setter)Transport_set_time, 
+    "The transport's current position in seconds", NULL},
+  {"is_rolling", (getter)Transport_get_is_rolling, 
+                 (setter)Transport_set_is_rolling, 
+    "Whether the transport is currently advancing its time", NULL},
+  {"bar", (getter)Transport_get_bbt, NULL, 
+    "The current bar, counting from 1, or None without a timebase master", 
+    (void *)TRANSPORT_BAR},
+  {"beat", (getter)Transport_get_bbt, NULL, 
+    "The current beat in the bar, counting from 1, or None", 
+    (void *)TRANSPORT_BEAT},
+  {"tick", (getter)Transport_get_bbt, NULL, 
+    "The current tick in the beat, counting from 0, or None", 
+    (void *)TRANSPORT_TICK},
+  {"bpm", (getter)Transport_get_bbt, NULL, 
+    "The current tempo in beats per minute, or None", 
+    (void *)TRANSPORT_BPM},
+  {"position", (getter)Transport_get_position, NULL, 
+    "A dict with the transport's whole position as of the same moment", 
+    NULL},
+  {NULL}  /* Sentinel */
+};
+
+static PyMethodDef Transport_methods[] = {
+
+    {"start", (PyCFunction)Transport_start, METH_NOARGS,
+      "Start the transport rolling if it isn't already"},
+    {"stop", (PyCFunction)Transport_stop, METH_NOARGS,
+      "Stop the transport rolling if it is"},
+    {"set_tempo_map", (PyCFunction)Transport_set_tempo_map, 
+      METH_VARARGS | METH_KEYWORDS,
+      "Become the timebase master, providing bar/beat/tick from a tempo map"},
+    {NULL, NULL, 0, NULL}  /* Sentinel */
+};
+
+static PyType_Slot Transport_slots[] = {
+  {Py_tp_dealloc, (destructor)Transport_dealloc},
+  {Py_tp_traverse, (traverseproc)Transport_traverse},
+  {Py_tp_doc, "Represents a JACK transport"},
+  {Py_tp_methods, Transport_methods},
+  {Py_tp_members, Transport_members},
+  {Py_tp_getset, Transport_getset},
+  {Py_tp_init, (initproc)Transport_init},
+  {Py_tp_new, Transport_new},
+  {0, NULL}
+};
+
+static PyType_Spec Transport_spec = {
+  "jackpatch.Transport",       /* name */
+  sizeof(Transport),           /* basicsize */
+  0,                           /* itemsize */
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC | Py_TPFLAGS_BASETYPE, /* flags */
+  Transport_slots              /* slots */
+};
+
+// PORT ***********************************************************************
+
+static void
+Port_dealloc(Port* self) {
+  PyObject_GC_UnTrack((PyObject *)self);
+  if (self->_weakrefs != NULL) PyObject_ClearWeakRefs((PyObject *)self);
+  ManagedPort_release(self->_managed);
+  self->_managed = NULL;
+  Py_XDECREF(self->name);
+  Py_XDECREF(self->client);
+  Py_XDECREF(self->flags);
+  Py_XDECREF(self->type);
+  PyTypeObject *type = Py_TYPE(self);
+  type->tp_free((PyObject *)self);
+  Py_DECREF(type);
+}
+
+// let the garbage collector see the references a port holds
+static int
+Port_traverse(Port *self, visitproc visit, void *arg) {
+  Py_VISIT(Py_TYPE(self));
+  Py_VISIT(self->name);
+  Py_VISIT(self->client);
+  Py_VISIT(self->flags);
+  Py_VISIT(self->type);
+  return(0);
+}
+
+static PyObject *
+Port_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+  Port *self;
+  self = (Port *)type->tp_alloc(type, 0);
+  if (self != NULL) {
+    Py_INCREF(Py_None);
+    self->name = Py_None;
+    Py_INCREF(Py_None);
+    self->type = Py_None;
+  }
+  return((PyObject *)self);
+}
+
+static int
+Port_init(Port *self, PyObject *args, PyObject *kwds) {
+  char *requested_name = NULL;
+  PyObject *tmp = NULL;
+  Client *client = NULL;
+  unsigned long flags = 0;
+  Py_ssize_t queue_size = -1;
+  const char *type_name = "midi";
+  static char *kwlist[] = { "client", "name", "flags", "queue_size", "type", 
+                            NULL };
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "O!s|kns", kwlist, 
+                                    _module_state(self)->ClientType, &client, 
+                                    &requested_name, &flags,
+                                    &queue_size, &type_name))
+    return(-1);
+  // accept short names for the default port types
+  const char *port_type;
+  int is_audio = 0;
+  if ((strcmp(type_name, "midi") == 0) || 
+      (strcmp(type_name, JACK_DEFAULT_MIDI_TYPE) == 0)) {
+    port_type = JACK_DEFAULT_MIDI_TYPE;
+  }
+  else if ((strcmp(type_name, "audio") == 0) || 
+           (strcmp(type_name, JACK_DEFAULT_AUDIO_TYPE) == 0)) {
+    port_type = JACK_DEFAULT_AUDIO_TYPE;
+    is_audio = 1;
+  }
+  else {
+    PyErr_Format(PyExc_ValueError, 
+      "Port type must be \"midi\" or \"audio\", not \"%s\"", type_name);
+    return(-1);
+  }
+  // the queue holds bytes of MIDI or frames of audio
+  if (queue_size == -1) {
+    queue_size = is_audio ? 
+      DEFAULT_AUDIO_QUEUE_FRAMES : DEFAULT_RECEIVE_QUEUE_SIZE;
+  }
+  if (queue_size <= 0) {
+    PyErr_SetString(PyExc_ValueError, is_audio ? 
+      "Port queue_size must be a positive number of frames" : 
+      "Port queue_size must be a positive number of bytes");
+    return(-1);
+  }
+  // hold a reference to the underlying client so it never goes away while its
+  //  ports are being used
+  PyObject *client_obj = (PyObject *)client;
+  tmp = self->client;
+  Py_INCREF(client_obj);
+  self->client = client_obj;
+  Py_XDECREF(tmp);
+  // make sure the client is connected
+  Client_open(client);
+  if (client->_client == NULL) return(-1);
+  // see if a port already exists with this name
+  self->_is_mine = 0;
+  self->_managed = NULL;
+  self->_port = jack_port_by_name(client->_client, requested_name);
+  // if it's one the client is already managing, share its state
+  if (self->_port != NULL) {
+    self->_managed = Client_find_managed_port(client, self->_port);
+    if (self->_managed != NULL) {
+      self->_is_mine = 1;
+      self->_managed->references++;
+    }
+  }
+  // if there's no such port, we need to create one
+  else {
+    self->_is_mine = 1;
+    self->_port = jack_port_register(
+      client->_client, requested_name, port_type, flags, 0);
+    if (self->_port == NULL) {
+      _error(self, "Failed to create a JACK port named \"%s\"", requested_name);
+      return(-1);
+    }
+    // store the port with the client so it can manage MIDI for it, 
+    //  allocating the receive queue here so the process callback never has to
+    if ((flags & (JackPortIsInput | JackPortIsOutput)) != 0) {
+      self->_managed = ManagedPort_new(self->_port, flags, is_audio, 
+        (((flags & JackPortIsInput) != 0) || (is_audio)) ? 
+          (size_t)queue_size : 0);
+      int is_midi_input = (! is_audio) && ((flags & JackPortIsInput) != 0);
+      int is_midi_output = (! is_audio) && ((flags & JackPortIsOutput) != 0);
+      // set up the arena for received data when we get our first input
+      StateLock_acquire(&(client->_state_lock));
+      if ((self->_managed != NULL) && (is_midi_input)) {
+        if (client->_arena == NULL) client->_arena = ReceiveArena_new();
+        self->_managed->arena = client->_arena;
+      }
+      // set up the pool for sent messages when we get our first output
+      if ((self->_managed != NULL) && (is_midi_output)) {
+        if (client->_pool == NULL) client->_pool = MessagePool_new();
+        self->_managed->pool = client->_pool;
+      }
+      StateLock_release(&(client->_state_lock));
+      if ((self->_managed == NULL) || 
+          ((is_midi_input) && (client->_arena == NULL)) || 
+          ((is_midi_output) && (client->_pool == NULL)) || 
+          (Client_add_managed_port(client, self->_managed) < 0)) {
+        _error(self, "Failed to allocate memory for the port named \"%s\"", 
+               jack_port_name(self->_port));
+        if (self->_managed != NULL) ManagedPort_free(self->_managed);
+        self->_managed = NULL;
+        jack_port_unregister(client->_client, self->_port);
+        self->_port = NULL;
+        return(-1);
+      }
+      self->_managed->references++;
+    }
+  }
+  // store the actual name of the port
+  tmp = self->name;
+  self->name = PyUnicode_FromString(jack_port_name(self->_port));
+  Py_XDECREF(tmp);
+  // store the actual flags of the port
+  tmp = self->flags;
+  self->flags = Py_BuildValue("i", jack_port_flags(self->_port));
+  Py_XDECREF(tmp);
+  // store the actual type of the port
+  tmp = self->type;
+  self->type = Client_type_name(client, jack_port_type(self->_port));
+  Py_XDECREF(tmp);
+  // let the client hand out this object for the port from now on
+  Client_intern_port(client, self);
+  return(0);
+}
+
+// make sure a port hasn't been unregistered, raising an error if it has
+static int
+Port_check_registered(Port *self) {
+  // another Port object for the same port may have unregistered it
+  if ((self->_managed != NULL) && (self->_managed->port == NULL)) {
+    self->_port = NULL;
+  }
+  if (self->_port == NULL) {
+    _error(self, "The port has been unregistered");
+    return(0);
+  }
+  return(1);
+}
+
+// remove a port created by jackpatch from the JACK server
+static PyObject *
+Port_unregister(Port *self) {
+  if (! Port_check_registered(self)) return(NULL);
+  if ((! self->_is_mine) || (self->_managed == NULL)) {
+    _error(self, "Only ports created by jackpatch can be unregistered");
+    return(NULL);
+  }
+  Client *client = (Client *)self->client;
+  ManagedPort *managed = self->_managed;
+  jack_port_t *port = self->_port;
+  // stop the process callback using the port before it goes away
+  if (Client_remove_managed_port(client, managed) < 0) {
+    return(PyErr_NoMemory());
+  }
+  managed->port = NULL;
+  self->_port = NULL;
+  // forget the Port object, since JACK may reuse the handle
+  if (client->_port_objects != NULL) {
+    PyObject *key = PyLong_FromVoidPtr(port);
+    if ((key == NULL) || (PyDict_DelItem(client->_port_objects, key) < 0)) {
+      PyErr_Clear();
+    }
+    Py_XDECREF(key);
+  }
+  int result = -1;
+  Client_lock(client, 0);
+  if (client->_client != NULL) {
+    jack_client_t *jack_client = client->_client;
+    Py_BEGIN_ALLOW_THREADS
+    result = jack_port_unregister(jack_client, port);
+    Py_END_ALLOW_THREADS
+  }
+  Client_unlock(client);
+  if (result != 0) {
+    _warn("Failed to unregister the JACK port (error %i)", result);
+    Py_RETURN_FALSE;
+  }
+  Py_RETURN_TRUE;
+}
+
+// set up a port object for an existing port we already have a handle for
+static int
+Port_init_from_handle(Port *self, Client *client, jack_port_t *handle, 
+                      const char *name) {
+  PyObject *tmp;
+  tmp = self->client;
+  Py_INCREF((PyObject *)client);
+  self->client = (PyObject *)client;
+  Py_XDECREF(tmp);
+  self->_port = handle;
+  self->_managed = Client_find_managed_port(client, handle);
+  self->_is_mine = (self->_managed != NULL);
+  if (self->_managed != NULL) self->_managed->references++;
+  tmp = self->name;
+  self->name = PyUnicode_FromString(name);
+  Py_XDECREF(tmp);
+  tmp = self->flags;
+  self->flags = PyLong_FromLong(jack_port_flags(handle));
+  Py_XDECREF(tmp);
+  tmp = self->type;
+  self->type = Client_type_name(client, jack_port_type(handle));
+  Py_XDECREF(tmp);
+  if ((self->name == NULL) || (self->flags == NULL) || (self->type == NULL)) {
+    return(-1);
+  }
+  Client_intern_port(client, self);
+  return(0);
+}
+
+// make sure a port can send messages and its client is ready to send them,
+//  returning the client or NULL if it can't
+static Client *
+Port_prepare_send(Port *self) {
+  if (! Port_check_registered(self)) return(NULL);
+  if (! self->_is_mine) {
+    _error(self, "Only ports created by jackpatch can send MIDI messages");
+    return(NULL);
+  }
+  if ((self->_managed != NULL) && (self->_managed->is_audio)) {
+    _error(self, "Audio ports can't send MIDI messages");
+    return(NULL);
+  }
+  int flags = jack_port_flags(self->_port);
+  if ((flags & JackPortIsOutput) == 0) {
+    _error(self, "Only output ports can send MIDI messages");
+    return(NULL);
+  }
+  if (self->_managed == NULL) {
+    _error(self, "MIDI is disabled for this port");
+    return(NULL);
+  }
+  // the client needs to be activated for sending to work
+  Client *client = (Client *)self->client;
+  Client_activate(client);
+  if (client->is_active != Py_True) return(NULL);
+  return(client);
+}
+
+// allocate a message with room for the given number of data bytes
+static Message *
+_message_new(MessagePool *pool, size_t bytes) {
+  Message *message = MessagePool_get(pool, bytes);
+  if (message == NULL) return(NULL);
+  message->next = NULL;
+  message->left = NULL;
+  message->right = NULL;
+  message->rank = 1;
+  message->port = NULL;
+  message->time = 0;
+  message->sequence = 0;
+  message->data_size = bytes;
+  return(message);
+}
+
+// free a linked list of messages
+static void
+_message_list_free(MessagePool *pool, Message *message) {
+  Message *next;
+  while (message != NULL) {
+    next = (Message *)message->next;
+    MessagePool_put(pool, message);
+    message = next;
+  }
+}
+
+// add a linked list of messages to the port's send queue by pushing the 
+//  whole list onto the port's intake at once, which never takes a lock, 
+//  so threads sending on the same port don't wait for each other or for 
+//  the process callback
+static void
+Port_enqueue_messages(Port *self, Message *messages) {
+  Message *tail;
+  unsigned long count = 0;
+  ManagedPort *managed = self->_managed;
+  if (messages == NULL) return;
+  for (tail = messages; tail->next != NULL; tail = (Message *)tail->next) {
+    count++;
+  }
+  count++;
+  // number the messages so the ones due at the same frame go out in order
+  unsigned long sequence = atomic_fetch_add_explicit(
+    &(managed->send_sequence), count, memory_order_relaxed);
+  Message *message;
+  for (message = messages; message != NULL; 
+       message = (Message *)message->next) {
+    message->sequence = sequence++;
+  }
+  atomic_fetch_add_explicit(&(managed->send_queue_count), count, 
+                            memory_order_relaxed);
+  Message *head = atomic_load_explicit(&(managed->send_intake), 
+                                       memory_order_relaxed);
+  for (;;) {
+    tail->next = head;
+    if (atomic_compare_exchange_strong_explicit(&(managed->send_intake), 
+          &head, messages, memory_order_release, memory_order_relaxed)) {
+      break;
+    }
+    atomic_fetch_add_explicit(&(managed->intake_retries), 1, 
+                              memory_order_relaxed);
+  }
+}
+
+// add a message to the port's send queue to be sent at the given absolute 
+//  frame on JACK's frame clock
+static PyObject *
+Port_queue_message(Port *self, PyObject *data, jack_nframes_t frame) {
+  Py_ssize_t i;
+  // store the message
+  Py_ssize_t bytes = PySequence_Size(data);
+  if (bytes < 0) return(NULL);
+  MessagePool *pool = self->_managed->pool;
+  Message *message = _message_new(pool, (size_t)bytes);
+  if (message == NULL) {
+    _error(self, "Failed to allocate memory for MIDI data");
+    return(NULL);
+  }
+  message->port = self->_port;
+  // messages are scheduled at an absolute frame so they never need to be 
+  //  adjusted while they wait in the queue
+  message->time = frame;
+  unsigned char *mdata = message->data;
+  PyObject *item;
+  long value;
+  for (i = 0; i < bytes; i++) {
+    item = PySequence_ITEM(data, i);
+    if (item == NULL) {
+      MessagePool_put(pool, message);
+      return(NULL);
+    }
+    value = PyLong_AsLong(item);
+    Py_DECREF(item);
+    if ((value == -1) && (PyErr_Occurred())) {
+      MessagePool_put(pool, message);
+      return(NULL);
+    }
+    *mdata = (unsigned char)(value & 0xFF);
+    mdata++;
+  }
+  // add the message to the port's send queue, which keeps it ordered by time
+  Port_enqueue_messages(self, message);
+  Py_RETURN_NONE;
+}
+
+// get the length of a MIDI message from its status byte, returning 0 for 
+//  system exclusive messages, which end with an end-of-exclusive byte 
+//  instead, or -1 if the byte can't begin a message
+static int
+_midi_message_length(unsigned char status) {
+  if (status < 0x80) return(-1);
+  if (status < 0xC0) return(3);
+  if (status < 0xE0) return(2);
+  if (status < 0xF0) return(3);
+  switch (status) {
+    case 0xF0: return(0);
+    case 0xF1: return(2);
+    case 0xF2: return(3);
+    case 0xF3: return(2);
+    case 0xF7: return(-1);
+    default:   return(1);
+  }
+}
+
+// parse a stream of raw MIDI bytes into a linked list of messages all sent 
+//  at the same frame, allowing running status between channel messages;
+//  returns the head of the list or NULL with an exception set
+static Message *
+_parse_midi_stream(Port *self, MessagePool *pool, const unsigned char *data, 
+                   size_t size, jack_nframes_t frame, jack_port_t *port) {
+  Message *head = NULL;
+  Message *tail = NULL;
+  Message *message;
+  unsigned char running_status = 0;
+  unsigned char status;
+  size_t offset = 0;
+  size_t start, length, data_start;
+  int expected;
+  while (offset < size) {
+    start = offset;
+    status = data[offset];
+    data_start = offset;
+    // data bytes at the start of a message continue the last channel status
+    if (status < 0x80) {
+      if (running_status == 0) {
+        PyErr_Format(PyExc_ValueError, 
+          "MIDI data byte without a status byte at offset %zu", offset);
+        _message_list_free(pool, head);
+        return(NULL);
+      }
+      status = running_status;
+    }
+    else {
+      data_start = offset + 1;
+    }
+    expected = _midi_message_length(status);
+    if (expected < 0) {
+      PyErr_Format(PyExc_ValueError, 
+        "Invalid MIDI status byte 0x%02x at offset %zu", status, offset);
+      _message_list_free(pool, head);
+      return(NULL);
+    }
+    // find the end of system exclusive messages
+    if (expected == 0) {
+      offset = data_start;
+      while ((offset < size) && (data[offset] != 0xF7)) {
+        if (data[offset] >= 0x80) {
+          PyErr_Format(PyExc_ValueError, 
+            "Unterminated system exclusive message at offset %zu", start);
+          _message_list_free(pool, head);
+          return(NULL);
+        }
+        offset++;
+      }
+      if (offset >= size) {
+        PyErr_Format(PyExc_ValueError, 
+          "Unterminated system exclusive message at offset %zu", start);
+        _message_list_free(pool, head);
+        return(NULL);
+      }
+      offset++;
+      length = offset - start;
+    }
+    else {
+      // the status byte counts toward the length even when it's implied
+      length = (size_t)expected;
+      if (data_start + (length - 1) > size) {
+        PyErr_Format(PyExc_ValueError, 
+          "Incomplete MIDI message at offset %zu", start);
+        _message_list_free(pool, head);
+        return(NULL);
+      }
+      offset = data_start + (length - 1);
+      for (size_t i = data_start; i < offset; i++) {
+        if (data[i] >= 0x80) {
+          PyErr_Format(PyExc_ValueError, 
+            "Unexpected MIDI status byte 0x%02x at offset %zu", data[i], i);
+          _message_list_free(pool, head);
+          return(NULL);
+        }
+      }
+    }
+    // only channel messages can set a running status, and system common 
+    //  messages cancel it
+    if (status < 0xF0) running_status = status;
+    else if (status < 0xF8) running_status = 0;
+    message = _message_new(pool, length);
+    if (message == NULL) {
+      _error(self, "Failed to allocate memory for MIDI data");
+      _message_list_free(pool, head);
+      return(NULL);
+    }
+    message->port = port;
+    message->time = frame;
+    message->data[0] = status;
+    if (length > 1) {
+      memcpy(message->data + 1, data + offset - (length - 1), length - 1);
+    }
+    if (tail == NULL) head = message;
+    else tail->next = message;
+    tail = message;
+  }
+  return(head);
+}
+
+// parse an array of fixed-size event records into a linked list of 
+//  messages; each record holds a native unsigned 32-bit frame offset 
+//  followed by a status byte and two data bytes, optionally padded to 
+//  8 bytes; returns the head of the list or NULL with an exception set
+static Message *
+_parse_midi_records(Port *self, MessagePool *pool, const unsigned char *data, 
+                    Py_ssize_t count, 
+                    Py_ssize_t record_size, jack_nframes_t frame, 
+                    jack_port_t *port) {
+  Message *head = NULL;
+  Message *tail = NULL;
+  Message *message;
+  const unsigned char *record;
+  uint32_t offset;
+  int length, j;
+  Py_ssize_t i;
+  for (i = 0; i < count; i++) {
+    record = data + (i * record_size);
+    memcpy(&offset, record, sizeof(uint32_t));
+    length = _midi_message_length(record[4]);
+    // records only have room for short messages
+    if (length <= 0) {
+      PyErr_Format(PyExc_ValueError, 
+        "Invalid status byte 0x%02x for a MIDI event record at index %zd", 
+        record[4], i);
+      _message_list_free(pool, head);
+      return(NULL);
+    }
+    for (j = 1; j < length; j++) {
+      if (record[4 + j] >= 0x80) {
+        PyErr_Format(PyExc_ValueError, 
+          "Invalid data byte 0x%02x in the MIDI event record at index %zd", 
+          record[4 + j], i);
+        _message_list_free(pool, head);
+        return(NULL);
+      }
+    }
+    message = _message_new(pool, (size_t)length);
+    if (message == NULL) {
+      _error(self, "Failed to allocate memory for MIDI data");
+      _message_list_free(pool, head);
+      return(NULL);
+    }
+    message->port = port;
+    message->time = frame + offset;
+    memcpy(message->data, record + 4, length);
+    if (tail == NULL) head = message;
+    else tail->next = message;
+    tail = message;
+  }
+  return(head);
+}
+
+// send a batch of messages from an object supporting the buffer protocol, 
+//  validating all of them before any are queued
+static PyObject *
+Port_send_many(Port *self, PyObject *args, PyObject *kwds) {
+  PyObject *events = NULL;
+  PyObject *frame_obj = Py_None;
+  static char *kwlist[] = {"events", "frame", NULL};
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "O|O", kwlist, 
+                                    &events, &frame_obj))
+    return(NULL);
+  if (! PyObject_CheckBuffer(events)) {
+    PyErr_SetString(PyExc_TypeError, 
+      "Port.send_many expects an object supporting the buffer protocol");
+    return(NULL);
+  }
+  Client *client = Port_prepare_send(self);
+  if (client == NULL) return(NULL);
+  // events are sent relative to the given frame, or now if there isn't one
+  jack_nframes_t frame;
+  if (frame_obj == Py_None) {
+    frame = jack_frame_time(client->_client);
+  }
+  else {
+    unsigned long value = PyLong_AsUnsignedLongMask(frame_obj);
+    if (PyErr_Occurred()) return(NULL);
+    frame = (jack_nframes_t)value;
+  }
+  Py_buffer view;
+  if (PyObject_GetBuffer(events, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) < 0) 
+    return(NULL);
+  Message *messages = NULL;
+  // treat arrays of single bytes as a raw MIDI stream
+  if (view.itemsize == 1) {
+    messages = _parse_midi_stream(self, self->_managed->pool, 
+      (const unsigned char *)view.buf, 
+      (size_t)view.len, frame, self->_port);
+  }
+  // treat arrays of larger items as event records
+  else if ((view.ndim == 1) && 
+           ((view.itemsize == 7) || (view.itemsize == 8))) {
+    messages = _parse_midi_records(self, self->_managed->pool, 
+      (const unsigned char *)view.buf, 
+      view.len / view.itemsize, view.itemsize, frame, self->_port);
+  }
+  else {
+    PyErr_SetString(PyExc_TypeError, 
+      "Port.send_many expects a byte string of MIDI messages or a "
+      "one-dimensional array of (frame, status, data1, data2) records");
+    PyBuffer_Release(&view);
+    return(NULL);
+  }
+  PyBuffer_Release(&view);
+  if ((messages == NULL) && (PyErr_Occurred())) return(NULL);
+  Port_enqueue_messages(self, messages);
+  Py_RETURN_NONE;
+}
+
+// send a message after a delay in seconds from now
+static PyObject *
+Port_send(Port *self, PyObject *args) {
+  PyObject *data;
+  double time = 0.0;
+  if (! PyArg_ParseTuple(args, "O|d", &data, &time)) return(NULL);
+  if (! PySequence_Check(data)) {
+    PyErr_SetString(PyExc_TypeError, 
+      "Port.send expects argument 1 to be a sequence");
+    return(NULL);
+  }
+  Client *client = Port_prepare_send(self);
+  if (client == NULL) return(NULL);
+  // get the current sample rate for time conversions
+  jack_nframes_t sample_rate = Client_sample_rate(client);
+  jack_nframes_t frame = jack_frame_time(client->_client) + 
+    (jack_nframes_t)(time * (double)sample_rate);
+  return(Port_queue_message(self, data, frame));
+}
+
+// send a message at an absolute frame on JACK's frame clock
+static PyObject *
+Port_send_at(Port *self, PyObject *args) {
+  PyObject *data;
+  unsigned long frame = 0;
+  if (! PyArg_ParseTuple(args, "Ok", &data, &frame)) return(NULL);
+  if (! PySequence_Check(data)) {
+    PyErr_SetString(PyExc_TypeError, 
+      "Port.send_at expects argument 1 to be a sequence");
+    return(NULL);
+  }
+  Client *client = Port_prepare_send(self);
+  if (client == NULL) return(NULL);
+  // the frame clock wraps around, so only the low bits are meaningful
+  return(Port_queue_message(self, data, (jack_nframes_t)frame));
+}
+
+// send a message when the transport reaches a position in seconds
+static PyObject *
+Port_send_at_time(Port *self, PyObject *args) {
+  PyObject *data;
+  double time = 0.0;
+  if (! PyArg_ParseTuple(args, "Od", &data, &time)) return(NULL);
+  if (! PySequence_Check(data)) {
+    PyErr_SetString(PyExc_TypeError, 
+      "Port.send_at_time expects argument 1 to be a sequence");
+    return(NULL);
+  }
+  Client *client = Port_prepare_send(self);
+  if (client == NULL) return(NULL);
+  // get the transport position and the frame clock at the start of the 
+  //  same block, retrying if a block boundary passes between the two
+  jack_position_t pos;
+  jack_nframes_t start_frame;
+  do {
+    start_frame = jack_last_frame_time(client->_client);
+    jack_transport_query(client->_client, &pos);
+  } while (start_frame != jack_last_frame_time(client->_client));
+  // convert the transport position to the frame clock
+  jack_nframes_t sample_rate = Client_sample_rate(client);
+  jack_nframes_t position = (jack_nframes_t)(time * (double)sample_rate);
+  jack_nframes_t frame = start_frame + (position - pos.frame);
+  return(Port_queue_message(self, data, frame));
+}
+
+// make sure a port can receive messages and its client is ready to receive 
+//  them, returning the port's receive queue, or NULL with an exception set 
+//  if it can't receive or without one if it has no queue
+static jack_ringbuffer_t *
+Port_prepare_receive(Port *self) {
+  if (! Port_check_registered(self)) return(NULL);
+  if (! self->_is_mine) {
+    _error(self, "Only ports created by jackpatch can receive MIDI messages");
+    return(NULL);
+  }
+  if ((self->_managed != NULL) && (self->_managed->is_audio)) {
+    _error(self, "Audio ports can't receive MIDI messages");
+    return(NULL);
+  }
+  int flags = jack_port_flags(self->_port);
+  if ((flags & JackPortIsInput) == 0) {
+    _error(self, "Only input ports can receive MIDI messages");
+    return(NULL);
+  }
+  // the client needs to be activated for receiving to work
+  Client *client = (Client *)self->client;
+  Client_activate(client);
+  if (client->is_active != Py_True) return(NULL);
+  if (self->_managed == NULL) return(NULL);
+  // we're about to take events off the queue, so anything watching the 
+  //  client's file descriptor has been told about them
+  Client_acknowledge_notification(client);
+  return(self->_managed->receive_queue);
+}
+
+// convert a timeout argument to seconds, where None means to wait forever 
+//  and is returned as a negative number; returns -1 with an exception set 
+//  if the argument is invalid
+static int
+_parse_timeout(PyObject *timeout_obj, double *timeout) {
+  *timeout = 0.0;
+  if (timeout_obj == NULL) return(0);
+  if (timeout_obj == Py_None) {
+    *timeout = -1.0;
+    return(0);
+  }
+  *timeout = PyFloat_AsDouble(timeout_obj);
+  if (PyErr_Occurred()) return(-1);
+  if (*timeout < 0.0) {
+    PyErr_SetString(PyExc_ValueError, "timeout must be a non-negative number");
+    return(-1);
+  }
+  return(0);
+}
+
+// wait up to the given timeout for there to be at least the given number 
+//  of bytes on the port's queue, releasing the GIL while waiting; returns 1 
+//  if there are, 0 if the timeout expired first, or -1 with an exception set 
+//  if interrupted
+static int
+Port_wait_for_bytes(Port *self, jack_ringbuffer_t *queue, size_t size, 
+                    double timeout) {
+  sem_t *signal = &(self->_managed->receive_signal);
+  struct timespec deadline;
+  int result, error;
+  if (timeout > 0.0) {
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += (time_t)timeout;
+    deadline.tv_nsec += (long)((timeout - (double)(time_t)timeout) * 1e9);
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+  }
+  // the semaphore can have been posted for data we already took, so 
+  //  always recheck the queue after waking
+  while (jack_ringbuffer_read_space(queue) < size) {
+    if (timeout == 0.0) return(0);
+    Py_BEGIN_ALLOW_THREADS
+    if (timeout < 0.0) result = sem_wait(signal);
+    else result = sem_timedwait(signal, &deadline);
+    error = errno;
+    Py_END_ALLOW_THREADS
+    if (result != 0) {
+      if (error == ETIMEDOUT) {
+        return(jack_ringbuffer_read_space(queue) >= size);
+      }
+      else if (error == EINTR) {
+        // let the user interrupt a long wait
+        if (PyErr_CheckSignals() < 0) return(-1);
+      }
+      else {
+        errno = error;
+        PyErr_SetFromErrno(PyExc_OSError);
+        return(-1);
+      }
+    }
+  }
+  Client_acknowledge_notification((Client *)self->client);
+  return(1);
+}
+
+// wait up to the given timeout for there to be an event on the port's queue
+static int
+Port_wait_for_event(Port *self, jack_ringbuffer_t *queue, double timeout) {
+  return(Port_wait_for_bytes(self, queue, sizeof(ReceivedEvent), timeout));
+}
+
+// wait up to the given timeout for an event, then take the port's lock so 
+//  no other thread can read the event first; returns 1 with the lock held, 
+//  0 if no event arrived, or -1 with an exception set
+static int
+Port_claim_event(Port *self, jack_ringbuffer_t *queue, double timeout) {
+  for (;;) {
+    int result = Port_wait_for_event(self, queue, timeout);
+    if (result <= 0) return(result);
+    StateLock_acquire(&(self->_managed->lock));
+    if (jack_ringbuffer_read_space(queue) >= sizeof(ReceivedEvent)) return(1);
+    // another thread took the event before we got the lock
+    StateLock_release(&(self->_managed->lock));
+  }
+}
+
+// make a memoryview of a bytes object with the given item format, so it can 
+//  be read as an array of numbers
+static PyObject *
+_typed_memoryview(PyObject *bytes, const char *format) {
+  PyObject *view = PyMemoryView_FromObject(bytes);
+  if (view == NULL) return(NULL);
+  PyObject *typed = PyObject_CallMethod(view, "cast", "s", format);
+  Py_DECREF(view);
+  return(typed);
+}
+
+static PyObject *
+Port_receive(Port *self, PyObject *args, PyObject *kwds) {
+  PyObject *timeout_obj = NULL;
+  double timeout;
+  int timestamps = 0;
+  static char *kwlist[] = {"timeout", "timestamps", NULL};
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "|Op", kwlist, &timeout_obj,
+                                    &timestamps))
+    return(NULL);
+  if (_parse_timeout(timeout_obj, &timeout) < 0) return(NULL);
+  jack_ringbuffer_t *queue = Port_prepare_receive(self);
+  if (queue == NULL) {
+    if (PyErr_Occurred()) return(NULL);
+    Py_RETURN_NONE;
+  }
+  Client *client = (Client *)self->client;
+  // wait for an event if requested, and return nothing if there isn't one
+  int result = Port_claim_event(self, queue, timeout);
+  if (result < 0) return(NULL);
+  if (result == 0) Py_RETURN_NONE;
+  // get the next event from the queue; the process callback writes events 
+  //  as whole records, so if we can see the header we can see the data
+  jack_ringbuffer_data_t vec[2];
+  ReceivedEvent header;
+  jack_ringbuffer_get_read_vector(queue, vec);
+  _ringbuffer_vector_read(vec, 0, &header, sizeof(ReceivedEvent));
+  // get the current sample rate for time conversions
+  jack_nframes_t sample_rate = Client_sample_rate(client);
+  // convert the event time from samples to seconds
+  double time = (double)header.time / (double)sample_rate;
+  // package raw MIDI data into an array
+  size_t bytes = header.data_size;
+  PyObject *data = PyList_New(bytes);
+  if (data == NULL) {
+    StateLock_release(&(self->_managed->lock));
+    return(NULL);
+  }
+  ReceiveArena *arena = self->_managed->arena;
+  const unsigned char *slot = (header.slot_class >= 0) ? 
+    ReceiveArena_slot(arena, header.slot_class, header.slot) : NULL;
+  unsigned char c;
+  size_t i;
+  for (i = 0; i < bytes; i++) {
+    if (slot != NULL) c = slot[i];
+    else _ringbuffer_vector_read(vec, sizeof(ReceivedEvent) + i, &c, 1);
+    PyList_SET_ITEM(data, i, PyLong_FromLong(c));
+  }
+  // remove the event from the queue once received
+  ReceiveArena_give(arena, header.slot_class, header.slot);
+  jack_ringbuffer_read_advance(queue, _received_record_size(&header));
+  StateLock_release(&(self->_managed->lock));
+  PyObject *tuple;
+  if (timestamps) {
+    tuple = Py_BuildValue("(O,d,k,K)", data, time, 
+      (unsigned long)header.frame, (unsigned long long)header.usecs);
+  }
+  else tuple = Py_BuildValue("(O,d)", data, time);
+  Py_DECREF(data);
+  return(tuple);
+}
+
+// receive a single MIDI event as an object that views its data in place
+static PyObject *
+Port_receive_event(Port *self, PyObject *args, PyObject *kwds) {
+  PyObject *timeout_obj = NULL;
+  double timeout;
+  static char *kwlist[] = {"timeout", NULL};
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &timeout_obj))
+    return(NULL);
+  if (_parse_timeout(timeout_obj, &timeout) < 0) return(NULL);
+  jack_ringbuffer_t *queue = Port_prepare_receive(self);
+  if (queue == NULL) {
+    if (PyErr_Occurred()) return(NULL);
+    Py_RETURN_NONE;
+  }
+  Client *client = (Client *)self->client;
+  int result = Port_claim_event(self, queue, timeout);
+  if (result < 0) return(NULL);
+  if (result == 0) Py_RETURN_NONE;
+  jack_ringbuffer_data_t vec[2];
+  ReceivedEvent header;
+  jack_ringbuffer_get_read_vector(queue, vec);
+  _ringbuffer_vector_read(vec, 0, &header, sizeof(ReceivedEvent));
+  MidiEvent *event = PyObject_GC_New(MidiEvent, 
+                                     _module_state(self)->MidiEventType);
+  if (event == NULL) {
+    StateLock_release(&(self->_managed->lock));
+    return(NULL);
+  }
+  // the event owns nothing until it's filled in below
+  Py_INCREF(client);
+  event->_client = (PyObject *)client;
+  event->_data = NULL;
+  event->_slot_class = -1;
+  event->_exports = 0;
+  PyObject_GC_Track((PyObject *)event);
+  event->time = (double)header.time / (double)Client_sample_rate(client);
+  event->frame = header.frame;
+  event->usecs = header.usecs;
+  event->_size = header.data_size;
+  // hand the event its arena slot, or copy the data if it didn't get one
+  if (header.slot_class >= 0) {
+    event->_data = ReceiveArena_slot(self->_managed->arena, 
+                                     header.slot_class, header.slot);
+    event->_slot_class = header.slot_class;
+    event->_slot = header.slot;
+  }
+  else {
+    event->_data = (unsigned char *)malloc(header.data_size + 1);
+    if (event->_data == NULL) {
+      StateLock_release(&(self->_managed->lock));
+      Py_DECREF(event);
+      return(PyErr_NoMemory());
+    }
+    _received_event_read(NULL, vec, 0, &header, event->_data);
+  }
+  jack_ringbuffer_read_advance(queue, _received_record_size(&header));
+  StateLock_release(&(self->_managed->lock));
+  return((PyObject *)event);
+}
+
+// receive every pending event for the port at once, returning the 
+//  concatenated event data as bytes, an array of offsets into it with one 
+//  more member than there are events, and an array of event times in seconds
+static PyObject *
+Port_receive_all(Port *self, PyObject *args, PyObject *kwds) {
+  PyObject *timeout_obj = NULL;
+  double timeout;
+  int timestamps = 0;
+  static char *kwlist[] = {"timeout", "timestamps", NULL};
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "|Op", kwlist, &timeout_obj,
+                                    &timestamps))
+    return(NULL);
+  if (_parse_timeout(timeout_obj, &timeout) < 0) return(NULL);
+  jack_ringbuffer_t *queue = Port_prepare_receive(self);
+  if ((queue == NULL) && (PyErr_Occurred())) return(NULL);
+  // wait for at least one event if requested
+  if ((queue != NULL) && (Port_wait_for_event(self, queue, timeout) < 0)) 
+    return(NULL);
+  Client *client = (Client *)self->client;
+  jack_ringbuffer_data_t vec[2];
+  ReceivedEvent header;
+  size_t available = 0;
+  size_t offset = 0;
+  size_t total_bytes = 0;
+  Py_ssize_t count = 0;
+  Py_ssize_t i;
+  // scan the events that are readable now to see how much room they need,
+  //  leaving any that arrive while we're working for the next call
+  StateLock *lock = (queue != NULL) ? &(self->_managed->lock) : NULL;
+  if (lock != NULL) StateLock_acquire(lock);
+  if (queue != NULL) {
+    jack_ringbuffer_get_read_vector(queue, vec);
+    available = vec[0].len + vec[1].len;
+    while (offset + sizeof(ReceivedEvent) <= available) {
+      _ringbuffer_vector_read(vec, offset, &header, sizeof(ReceivedEvent));
+      offset += _received_record_size(&header);
+      total_bytes += header.data_size;
+      count++;
+    }
+  }
+  // allocate everything we're going to return
+  PyObject *data = PyBytes_FromStringAndSize(NULL, total_bytes);
+  PyObject *offsets = PyBytes_FromStringAndSize(NULL, 
+    sizeof(uint32_t) * (count + 1));
+  PyObject *times = PyBytes_FromStringAndSize(NULL, sizeof(double) * count);
+  PyObject *frames = NULL;
+  PyObject *usecs = NULL;
+  if (timestamps) {
+    frames = PyBytes_FromStringAndSize(NULL, sizeof(uint32_t) * count);
+    usecs = PyBytes_FromStringAndSize(NULL, sizeof(uint64_t) * count);
+  }
+  if ((data == NULL) || (offsets == NULL) || (times == NULL) || 
+      ((timestamps) && ((frames == NULL) || (usecs == NULL)))) {
+    if (lock != NULL) StateLock_release(lock);
+    Py_XDECREF(data);
+    Py_XDECREF(offsets);
+    Py_XDECREF(times);
+    Py_XDECREF(frames);
+    Py_XDECREF(usecs);
+    return(NULL);
+  }
+  unsigned char *data_out = (unsigned char *)PyBytes_AS_STRING(data);
+  uint32_t *offsets_out = (uint32_t *)PyBytes_AS_STRING(offsets);
+  double *times_out = (double *)PyBytes_AS_STRING(times);
+  uint32_t *frames_out = timestamps ? 
+    (uint32_t *)PyBytes_AS_STRING(frames) : NULL;
+  uint64_t *usecs_out = timestamps ? 
+    (uint64_t *)PyBytes_AS_STRING(usecs) : NULL;
+  double sample_rate = (double)Client_sample_rate(client);
+  // copy the events out in one pass (a port without a queue has no 
+  //  managed state, and so no arena, but also no events to copy)
+  ReceiveArena *arena = (queue != NULL) ? self->_managed->arena : NULL;
+  uint32_t data_offset = 0;
+  offset = 0;
+  for (i = 0; i < count; i++) {
+    _ringbuffer_vector_read(vec, offset, &header, sizeof(ReceivedEvent));
+    _received_event_read(arena, vec, offset, &header, data_out + data_offset);
+    ReceiveArena_give(arena, header.slot_class, header.slot);
+    offsets_out[i] = data_offset;
+    times_out[i] = (double)header.time / sample_rate;
+    if (timestamps) {
+      frames_out[i] = header.frame;
+      usecs_out[i] = header.usecs;
+    }
+    data_offset += header.data_size;
+    offset += _received_record_size(&header);
+  }
+  offsets_out[count] = data_offset;
+  if (count > 0) jack_ringbuffer_read_advance(queue, offset);
+  if (lock != NULL) StateLock_release(lock);
+  // make the arrays readable as numbers
+  PyObject *offsets_view = _typed_memoryview(offsets, "I");
+  PyObject *times_view = _typed_memoryview(times, "d");
+  Py_DECREF(offsets);
+  Py_DECREF(times);
+  if ((offsets_view == NULL) || (times_view == NULL)) {
+    Py_DECREF(data);
+    Py_XDECREF(offsets_view);
+    Py_XDECREF(times_view);
+    Py_XDECREF(frames);
+    Py_XDECREF(usecs);
+    return(NULL);
+  }
+  if (! timestamps) {
+    return(Py_BuildValue("(NNN)", data, offsets_view, times_view));
+  }
+  PyObject *frames_view = _typed_memoryview(frames, "I");
+  PyObject *usecs_view = _typed_memoryview(usecs, "Q");
+  Py_DECREF(frames);
+  Py_DECREF(usecs);
+  if ((frames_view == NULL) || (usecs_view == NULL)) {
+    Py_DECREF(data);
+    Py_DECREF(offsets_view);
+    Py_DECREF(times_view);
+    Py_XDECREF(frames_view);
+    Py_XDECREF(usecs_view);
+    return(NULL);
+  }
+  return(Py_BuildValue("(NNNNN)", data, offsets_view, times_view, 
+                       frames_view, usecs_view));
+}
+
+// receive as many pending events as will fit into a writable buffer, each 
+//  stored as a native unsigned 32-bit frame and size followed by the data 
+//  and padded out to a multiple of 4 bytes; returns the number of events 
+//  and bytes written
+static PyObject *
+Port_receive_into(Port *self, PyObject *args) {
+  PyObject *target;
+  if (! PyArg_ParseTuple(args, "O", &target)) return(NULL);
+  Py_buffer view;
+  if (PyObject_GetBuffer(target, &view, 
+        PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS) < 0) return(NULL);
+  jack_ringbuffer_t *queue = Port_prepare_receive(self);
+  if ((queue == NULL) && (PyErr_Occurred())) {
+    PyBuffer_Release(&view);
+    return(NULL);
+  }
+  unsigned char *out = (unsigned char *)view.buf;
+  size_t capacity = (size_t)view.len;
+  size_t written = 0;
+  size_t offset = 0;
+  size_t available, record_size;
+  Py_ssize_t count = 0;
+  jack_ringbuffer_data_t vec[2];
+  ReceivedEvent header;
+  uint32_t fields[2];
+  int too_small = 0;
+  if (queue != NULL) {
+    StateLock_acquire(&(self->_managed->lock));
+    jack_ringbuffer_get_read_vector(queue, vec);
+    available = vec[0].len + vec[1].len;
+    while (offset + sizeof(ReceivedEvent) <= available) {
+      _ringbuffer_vector_read(vec, offset, &header, sizeof(ReceivedEvent));
+      record_size = (sizeof(fields) + header.data_size + 3) & ~((size_t)3);
+      // leave events that don't fit in the queue for the next call
+      if (written + record_size > capacity) {
+        too_small = (count == 0);
+        break;
+      }
+      fields[0] = header.time;
+      fields[1] = (uint32_t)header.data_size;
+      memcpy(out + written, fields, sizeof(fields));
+      _received_event_read(self->_managed->arena, vec, offset, &header, 
+                           out + written + sizeof(fields));
+      ReceiveArena_give(self->_managed->arena, header.slot_class, header.slot);
+      memset(out + written + sizeof(fields) + header.data_size, 0, 
+        record_size - (sizeof(fields) + header.data_size));
+      written += record_size;
+      offset += _received_record_size(&header);
+      count++;
+    }
+    if (count > 0) jack_ringbuffer_read_advance(queue, offset);
+    StateLock_release(&(self->_managed->lock));
+  }
+  PyBuffer_Release(&view);
+  // if even the first event doesn't fit, the caller would never get it
+  if (too_small) {
+    PyErr_SetString(PyExc_ValueError, 
+      "The buffer is too small to hold the next MIDI message");
+    return(NULL);
+  }
+  return(Py_BuildValue("(nn)", count, (Py_ssize_t)written));
+}
+
+// remove all events from the send queue
+static PyObject *
+Port_clear_send(Port *self) {
+  ManagedPort *managed = self->_managed;
+  // skip clearing if the queue is empty
+  if ((managed == NULL) || (atomic_load(&(managed->send_queue_count)) == 0)) {
+    Py_RETURN_NONE;
+  }
+  Client *client = (Client *)self->client;
+  // hold the client's lock so it can't be activated or deactivated 
+  //  while we're deciding who clears the queue
+  Client_lock(client, 0);
+  if (client->is_active == Py_True) {
+    // the process callback owns the queue while it's running, so ask it 
+    //  to clear the queue and wait until it has, giving up if the server 
+    //  seems to be stuck
+    unsigned long clears = atomic_fetch_add(&(managed->send_clears), 1) + 1;
+    int i;
+    Py_BEGIN_ALLOW_THREADS
+    for (i = 0; i < 1000; i++) {
+      if (atomic_load(&(managed->send_clears_done)) == clears) break;
+      usleep(1000);
+    }
+    Py_END_ALLOW_THREADS
+  }
+  else {
+    Message *message = atomic_exchange(&(managed->send_intake), NULL);
+    while (message != NULL) {
+      Message *next = (Message *)message->next;
+      MessagePool_put(managed->pool, message);
+      message = next;
+    }
+    StateLock_acquire(&(managed->lock));
+    _message_heap_free(managed->pool, managed->send_queue);
+    managed->send_queue = NULL;
+    atomic_store(&(managed->send_queue_count), 0);
+    StateLock_release(&(managed->lock));
+  }
+  Client_unlock(client);
+  Py_RETURN_NONE;
+}
+
+// remove all events from the receive queue
+static PyObject *
+Port_clear_receive(Port *self) {
+  // discard whole frames of received audio
+  if ((self->_managed != NULL) && (self->_managed->is_audio) && 
+      (self->_managed->is_input)) {
+    jack_ringbuffer_t *queue = self->_managed->audio_queue;
+    StateLock_acquire(&(self->_managed->lock));
+    size_t available = jack_ringbuffer_read_space(queue);
+    available -= available % sizeof(jack_default_audio_sample_t);
+    jack_ringbuffer_read_advance(queue, available);
+    StateLock_release(&(self->_managed->lock));
+    Py_RETURN_NONE;
+  }
+  // skip clearing if the port has no queue
+  if ((self->_managed == NULL) || 
+      (self->_managed->receive_queue == NULL)) Py_RETURN_NONE;
+  // discard everything that's currently readable; since events are written 
+  //  as whole records this always leaves the queue on a record boundary
+  jack_ringbuffer_t *queue = self->_managed->receive_queue;
+  StateLock_acquire(&(self->_managed->lock));
+  _received_events_discard(self->_managed->arena, queue, 
+                           jack_ringbuffer_read_space(queue));
+  StateLock_release(&(self->_managed->lock));
+  Py_RETURN_NONE;
+}
+
+// make sure a port is an audio port going the given way and its client is 
+//  ready to process audio, returning its state or NULL if it can't
+static ManagedPort *
+Port_prepare_audio(Port *self, int is_input) {
+  if (! Port_check_registered(self)) return(NULL);
+  ManagedPort *managed = self->_managed;
+  if ((! self->_is_mine) || (managed == NULL) || (! managed->is_audio)) {
+    _error(self, "Only audio ports created by jackpatch can %s audio", 
+           is_input ? "read" : "write");
+    return(NULL);
+  }
+  if (managed->is_input != is_input) {
+    _error(self, is_input ? "Only input ports can read audio" : 
+                      "Only output ports can write audio");
+    return(NULL);
+  }
+  // the client needs to be activated for audio to flow
+  Client *client = (Client *)self->client;
+  Client_activate(client);
+  if (client->is_active != Py_True) return(NULL);
+  return(managed);
+}
+
+// get a buffer of audio samples, making sure it holds 32-bit floats 
+//  (or raw bytes we can treat as them)
+static int
+_get_sample_buffer(PyObject *obj, Py_buffer *view, int flags) {
+  if (PyObject_GetBuffer(obj, view, flags | PyBUF_C_CONTIGUOUS | 
+                                    PyBUF_FORMAT) < 0) return(-1);
+  int is_bytes = (view->itemsize == 1) && 
+    ((view->format == NULL) || (strcmp(view->format, "B") == 0));
+  int is_samples = (view->itemsize == sizeof(jack_default_audio_sample_t)) && 
+    (view->format != NULL) && (strcmp(view->format, "f") == 0);
+  if ((! is_bytes) && (! is_samples)) {
+    PyErr_SetString(PyExc_TypeError, 
+      "Audio must be passed in a buffer of 32-bit floats");
+    PyBuffer_Release(view);
+    return(-1);
+  }
+  return(0);
+}
+
+// read received audio as an array of samples
+static PyObject *
+Port_read(Port *self, PyObject *args, PyObject *kwds) {
+  PyObject *frames_obj = Py_None;
+  PyObject *timeout_obj = NULL;
+  double timeout;
+  Py_ssize_t frames = -1;
+  static char *kwlist[] = {"frames", "timeout", NULL};
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "|OO", kwlist, 
+                                    &frames_obj, &timeout_obj)) return(NULL);
+  if (frames_obj != Py_None) {
+    frames = PyLong_AsSsize_t(frames_obj);
+    if ((frames == -1) && (PyErr_Occurred())) return(NULL);
+    if (frames < 0) {
+      PyErr_SetString(PyExc_ValueError, 
+        "frames must be a non-negative number");
+      return(NULL);
+    }
+  }
+  if (_parse_timeout(timeout_obj, &timeout) < 0) return(NULL);
+  ManagedPort *managed = Port_prepare_audio(self, 1);
+  if (managed == NULL) return(NULL);
+  jack_ringbuffer_t *queue = managed->audio_queue;
+  size_t sample_size = sizeof(jack_default_audio_sample_t);
+  // wait for as many frames as were asked for, or any at all, 
+  //  but never more than the queue can hold
+  size_t wanted = (frames >= 0) ? (size_t)frames * sample_size : sample_size;
+  size_t limit = (queue->size - 1) - ((queue->size - 1) % sample_size);
+  if (wanted > limit) wanted = limit;
+  if ((wanted > 0) && 
+      (Port_wait_for_bytes(self, queue, wanted, timeout) < 0)) return(NULL);
+  StateLock_acquire(&(managed->lock));
+  size_t available = jack_ringbuffer_read_space(queue);
+  available -= available % sample_size;
+  if ((frames >= 0) && (available > (size_t)frames * sample_size)) {
+    available = (size_t)frames * sample_size;
+  }
+  PyObject *bytes = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)available);
+  if (bytes != NULL) {
+    jack_ringbuffer_read(queue, PyBytes_AS_STRING(bytes), available);
+  }
+  StateLock_release(&(managed->lock));
+  if (bytes == NULL) return(NULL);
+  PyObject *samples = _typed_memoryview(bytes, "f");
+  Py_DECREF(bytes);
+  return(samples);
+}
+
+// read received audio into a writable buffer of samples, returning the 
+//  number of frames read
+static PyObject *
+Port_read_into(Port *self, PyObject *args, PyObject *kwds) {
+  PyObject *target;
+  PyObject *timeout_obj = NULL;
+  double timeout;
+  static char *kwlist[] = {"buffer", "timeout", NULL};
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "O|O", kwlist, 
+                                    &target, &timeout_obj)) return(NULL);
+  if (_parse_timeout(timeout_obj, &timeout) < 0) return(NULL);
+  Py_buffer view;
+  if (_get_sample_buffer(target, &view, PyBUF_WRITABLE) < 0) return(NULL);
+  ManagedPort *managed = Port_prepare_audio(self, 1);
+  if (managed == NULL) {
+    PyBuffer_Release(&view);
+    return(NULL);
+  }
+  jack_ringbuffer_t *queue = managed->audio_queue;
+  size_t sample_size = sizeof(jack_default_audio_sample_t);
+  size_t capacity = (size_t)view.len - ((size_t)view.len % sample_size);
+  // wait until the buffer can be filled, or the queue is full
+  size_t wanted = (queue->size - 1) - ((queue->size - 1) % sample_size);
+  if (wanted > capacity) wanted = capacity;
+  if ((wanted > 0) && 
+      (Port_wait_for_bytes(self, queue, wanted, timeout) < 0)) {
+    PyBuffer_Release(&view);
+    return(NULL);
+  }
+  StateLock_acquire(&(managed->lock));
+  size_t available = jack_ringbuffer_read_space(queue);
+  available -= available % sample_size;
+  if (available > capacity) available = capacity;
+  jack_ringbuffer_read(queue, (char *)view.buf, available);
+  StateLock_release(&(managed->lock));
+  PyBuffer_Release(&view);
+  return(PyLong_FromSize_t(available / sample_size));
+}
+
+// queue audio to be played on an output port, returning the number of 
+//  frames that fit in the queue
+static PyObject *
+Port_write(Port *self, PyObject *args) {
+  PyObject *source;
+  if (! PyArg_ParseTuple(args, "O", &source)) return(NULL);
+  Py_buffer view;
+  if (_get_sample_buffer(source, &view, PyBUF_SIMPLE) < 0) return(NULL);
+  size_t sample_size = sizeof(jack_default_audio_sample_t);
+  if ((view.len % sample_size) != 0) {
+    PyErr_SetString(PyExc_ValueError, 
+      "Audio must be a whole number of 32-bit samples");
+    PyBuffer_Release(&view);
+    return(NULL);
+  }
+  ManagedPort *managed = Port_prepare_audio(self, 0);
+  if (managed == NULL) {
+    PyBuffer_Release(&view);
+    return(NULL);
+  }
+  StateLock_acquire(&(managed->lock));
+  size_t space = jack_ringbuffer_write_space(managed->audio_queue);
+  space -= space % sample_size;
+  if (space > (size_t)view.len) space = (size_t)view.len;
+  jack_ringbuffer_write(managed->audio_queue, (const char *)view.buf, space);
+  StateLock_release(&(managed->lock));
+  PyBuffer_Release(&view);
+  return(PyLong_FromSize_t(space / sample_size));
+}
+
+// get the number of frames of silence an audio output port played because 
+//  nothing had been written for it
+static PyObject *
+Port_get_underruns(Port *self, void *closure) {
+  unsigned long underruns = 0;
+  if (self->_managed != NULL) underruns = self->_managed->audio_underruns;
+  return(PyLong_FromUnsignedLong(underruns));
+}
+
+// get the number of received events dropped because the port's 
+//  receive queue was full
+static PyObject *
+Port_get_receive_overflows(Port *self, void *closure) {
+  unsigned long overflows = 0;
+  if (self->_managed != NULL) overflows = self->_managed->receive_overflows;
+  return(PyLong_FromUnsignedLong(overflows));
+}
+static PyObject *
+Port_get_route_overflows(Port *self, void *closure) {
+  unsigned long overflows = 0;
+  if (self->_managed != NULL) overflows = self->_managed->route_overflows;
+  return(PyLong_FromUnsignedLong(overflows));
+}
+
+// get and set what the port does with queued messages that don't fit 
+//  in a block
+static PyObject *
+Port_get_overflow_policy(Port *self, void *closure) {
+  int policy = OVERFLOW_DEFER;
+  if (self->_managed != NULL) policy = self->_managed->overflow_policy;
+  return(PyLong_FromLong(policy));
+}
+static int
+Port_set_overflow_policy(Port *self, PyObject *value, void *closure) {
+  if (value == NULL) {
+    PyErr_SetString(PyExc_TypeError, "Cannot delete the overflow_policy");
+    return(-1);
+  }
+  long policy = PyLong_AsLong(value);
+  if ((policy == -1) && (PyErr_Occurred())) return(-1);
+  if ((policy != OVERFLOW_DEFER) && (policy != OVERFLOW_DROP_OLDEST) && 
+      (policy != OVERFLOW_COALESCE)) {
+    PyErr_SetString(PyExc_ValueError, 
+      "Port.overflow_policy must be OverflowDefer, OverflowDropOldest, "
+      "or OverflowCoalesce");
+    return(-1);
+  }
+  if ((self->_managed == NULL) || (self->_managed->routed == NULL)) {
+    _error(self, 
+      "Only output ports created by jackpatch have an overflow policy");
+    return(-1);
+  }
+  self->_managed->overflow_policy = (int)policy;
+  return(0);
+}
+
+// get and set whether the port coalesces controller messages in every block
+static PyObject *
+Port_get_coalesce(Port *self, void *closure) {
+  if ((self->_managed != NULL) && (self->_managed->coalesce)) Py_RETURN_TRUE;
+  Py_RETURN_FALSE;
+}
+static int
+Port_set_coalesce(Port *self, PyObject *value, void *closure) {
+  if (value == NULL) {
+    PyErr_SetString(PyExc_TypeError, "Cannot delete the coalesce attribute");
+    return(-1);
+  }
+  int coalesce = PyObject_IsTrue(value);
+  if (coalesce < 0) return(-1);
+  if ((self->_managed == NULL) || (self->_managed->routed == NULL)) {
+    _error(self, 
+      "Only output ports created by jackpatch can coalesce messages");
+    return(-1);
+  }
+  self->_managed->coalesce = coalesce;
+  return(0);
+}
+
+// get all ports connected to the given port
+static PyObject *
+Port_get_connections(Port *self) {
+  int i;
+  Client *client = (Client *)self->client;
+  if (Client_index_ports(client) < 0) return(NULL);
+  // look up the ports connected to this port in the index
+  PortMatch *matches = NULL;
+  int match_count = 0;
+  PortIndex *index = &(client->_index);
+  pthread_mutex_lock(&(index->lock));
+  int position = PortIndex_find(index, self->_port);
+  PortRecord *record = (position >= 0) ? &(index->records[position]) : NULL;
+  int count = (record != NULL) ? record->connection_count : 0;
+  matches = (PortMatch *)malloc(sizeof(PortMatch) * (count + 1));
+  for (i = 0; (matches != NULL) && (i < count); i++) {
+    int other = PortIndex_find(index, record->connections[i]);
+    if (other < 0) continue;
+    matches[match_count].port = record->connections[i];
+    matches[match_count].name = strdup(index->records[other].name);
+    if (matches[match_count].name == NULL) {
+      _port_matches_free(matches, match_count);
+      matches = NULL;
+      break;
+    }
+    match_count++;
+  }
+  pthread_mutex_unlock(&(index->lock));
+  if (matches == NULL) return(PyErr_NoMemory());
+  // convert the matches into a list of Port objects
+  PyObject *return_list = Client_port_list(client, matches, match_count);
+  _port_matches_free(matches, match_count);
+  return(return_list);
+}
+
+// make a list of the values whose bits are set in a mask
+static PyObject *
+_mask_list(unsigned int mask, int count, int base, int step) {
+  PyObject *list = PyList_New(0);
+  if (list == NULL) return(NULL);
+  int i;
+  for (i = 0; i < count; i++) {
+    if ((mask & (1 << i)) == 0) continue;
+    PyObject *value = PyLong_FromLong(base + (i * step));
+    if ((value == NULL) || (PyList_Append(list, value) < 0)) {
+      Py_XDECREF(value);
+      Py_DECREF(list);
+      return(NULL);
+    }
+    Py_DECREF(value);
+  }
+  return(list);
+}
+
+// get and set which MIDI messages an input port keeps, as a dict or None 
+//  if it keeps everything
+static PyObject *
+Port_get_receive_filter(Port *self, void *closure) {
+  if (self->_managed == NULL) Py_RETURN_NONE;
+  uint64_t filter = atomic_load(&(self->_managed->receive_filter));
+  if (filter == RECEIVE_FILTER_ALL) Py_RETURN_NONE;
+  PyObject *sysex_max = (RECEIVE_FILTER_SYSEX_MAX(filter) == UINT32_MAX) ? 
+    Py_None : PyLong_FromUnsignedLong(RECEIVE_FILTER_SYSEX_MAX(filter));
+  if (sysex_max == Py_None) Py_INCREF(Py_None);
+  return(Py_BuildValue("{s:N,s:N,s:N,s:N}", 
+    "types", _mask_list(RECEIVE_FILTER_TYPES(filter), 8, 0x80, 0x10), 
+    "channels", _mask_list(RECEIVE_FILTER_CHANNELS(filter), 16, 0, 1), 
+    "realtime", _mask_list(RECEIVE_FILTER_REALTIME(filter), 8, 0xF8, 1), 
+    "sysex_max", sysex_max));
+}
+static int
+Port_set_receive_filter(Port *self, PyObject *value, void *closure) {
+  if ((self->_managed == NULL) || (! self->_managed->is_input) || 
+      (self->_managed->is_audio)) {
+    _error(self, 
+      "Only MIDI input ports created by jackpatch can filter messages");
+    return(-1);
+  }
+  uint64_t filter = RECEIVE_FILTER_ALL;
+  if ((value != NULL) && (value != Py_None)) {
+    if (! PyDict_Check(value)) {
+      PyErr_SetString(PyExc_TypeError, 
+        "A port's receive filter must be a dict or None");
+      return(-1);
+    }
+    // by default, pass everything
+    uint16_t types = 0xFF;
+    uint16_t channels = 0xFFFF;
+    uint16_t realtime = 0xFF;
+    int sysex_max = -1;
+    if ((_route_mask(value, "filter", "types", 0x80, 0xFF, 4, &types) < 0) || 
+        (_route_mask(value, "filter", "channels", 0, 15, 0, &channels) < 0) || 
+        (_route_mask(value, "filter", "realtime", 0xF8, 0xFF, 0, 
+                     &realtime) < 0) || 
+        (_route_int(value, "filter", "sysex_max", 0, INT_MAX, 
+                    &sysex_max) < 0)) {
+      return(-1);
+    }
+    filter = (uint64_t)types | ((uint64_t)channels << 8) | 
+      ((uint64_t)realtime << 24) | 
+      ((uint64_t)((sysex_max < 0) ? UINT32_MAX : (uint32_t)sysex_max) << 32);
+  }
+  atomic_store(&(self->_managed->receive_filter), filter);
+  return(0);
+}
+
+static PyMemberDef Port_members[] = {
+  {"__weaklistoffset__", T_PYSSIZET, offsetof(Port, _weakrefs), READONLY},
+  {"name", T_OBJECT_EX, offsetof(Port, name), READONLY,
+   "The port's unique name"},
+  {"client", T_OBJECT_EX, offsetof(Port, client), READONLY,
+   "The client used to create the port"},
+  {"flags", T_OBJECT_EX, offsetof(Port, flags), READONLY,
+   "The port's flags as a bitfield of JackPortFlags"},
+  {"type", T_OBJECT_EX, offsetof(Port, type), READONLY,
+   "The port's JACK type"},
+  {NULL}  /* Sentinel */
+};
+
+static PyGetSetDef Port_getset[] = {
+  {"receive_overflows", (getter)Port_get_receive_overflows, NULL, 
+    "The number of received MIDI messages dropped because the port's "
+    "receive queue was full", NULL},
+  {"route_overflows", (getter)Port_get_route_overflows, NULL, 
+    "The number of routed MIDI messages dropped because they didn't fit "
+    "in the block", NULL},
+  {"underruns", (getter)Port_get_underruns, NULL, 
+    "The number of frames of silence an audio output played because no "
+    "audio had been written for them", NULL},
+  {"overflow_policy", (getter)Port_get_overflow_policy, 
+    (setter)Port_set_overflow_policy, 
+    "What to do with queued MIDI messages that don't fit in a block", NULL},
+  {"coalesce", (getter)Port_get_coalesce, (setter)Port_set_coalesce, 
+    "Whether to send only the latest controller value due in each block", 
+    NULL},
+  {"receive_filter", (getter)Port_get_receive_filter, 
+    (setter)Port_set_receive_filter, 
+    "Which MIDI messages an input port keeps, as a dict, or None for all", 
+    NULL},
+  {NULL}  /* Sentinel */
+};
+
+static PyMethodDef Port_methods[] = {
+    {"unregister", (PyCFunction)Port_unregister, METH_NOARGS,
+      "Remove the port from the JACK server"},
+    {"send", (PyCFunction)Port_send, METH_VARARGS,
+      "Send a tuple of ints as a MIDI message to the port"},
+    {"send_at", (PyCFunction)Port_send_at, METH_VARARGS,
+      "Send a MIDI message at an absolute frame on JACK's frame clock"},
+    {"send_at_time", (PyCFunction)Port_send_at_time, METH_VARARGS,
+      "Send a MIDI message when the transport reaches a time in seconds"},
+    {"send_many", (PyCFunction)Port_send_many, METH_VARARGS | METH_KEYWORDS,
+      "Send a batch of MIDI messages from a byte string or an array of "
+      "event records"},
+    {"receive", (PyCFunction)Port_receive, METH_VARARGS | METH_KEYWORDS,
+      "Receive a MIDI message from the port, optionally waiting for one"},
+    {"receive_event", (PyCFunction)Port_receive_event, 
+      METH_VARARGS | METH_KEYWORDS,
+      "Receive a MIDI message as an object that views its data in place"},
+    {"receive_all", (PyCFunction)Port_receive_all, METH_VARARGS | METH_KEYWORDS,
+      "Receive all pending MIDI messages from the port as packed arrays"},
+    {"receive_into", (PyCFunction)Port_receive_into, METH_VARARGS,
+      "Receive as many pending MIDI messages as fit into a writable buffer"},
+    {"read", (PyCFunction)Port_read, METH_VARARGS | METH_KEYWORDS,
+      "Read received audio as an array of 32-bit float samples"},
+    {"read_into", (PyCFunction)Port_read_into, METH_VARARGS | METH_KEYWORDS,
+      "Read received audio into a writable buffer of 32-bit float samples"},
+    {"write", (PyCFunction)Port_write, METH_VARARGS,
+      "Queue a buffer of 32-bit float samples to play on an audio output"},
+    {"clear_send", (PyCFunction)Port_clear_send, METH_NOARGS,
+      "Remove all messages from the port's send queue"},
+    {"clear_receive", (PyCFunction)Port_clear_receive, METH_NOARGS,
+      "Remove all messages from the port's receive queue"},
+    {"get_connections", (PyCFunction)Port_get_connections, METH_NOARGS,
+      "Get all the ports connected to this one"},
+    {NULL, NULL, 0, NULL}  /* Sentinel */
+};
+
+static PyType_Slot Port_slots[] = {
+  {Py_tp_dealloc, (destructor)Port_dealloc},
+  {Py_tp_traverse, (traverseproc)Port_traverse},
+  {Py_tp_doc, "Represents an JACK port"},
+  {Py_tp_methods, Port_methods},
+  {Py_tp_members, Port_members},
+  {Py_tp_getset, Port_getset},
+  {Py_tp_init, (initproc)Port_init},
+  {Py_tp_new, Port_new},
+  {0, NULL}
+};
+
+static PyType_Spec Port_spec = {
+  "jackpatch.Port",            /* name */
+  sizeof(Port),                /* basicsize */
+  0,                           /* itemsize */
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC | Py_TPFLAGS_BASETYPE, /* flags */
+  Port_slots                   /* slots */
+};
+
+// MIDI EVENT *****************************************************************
+
+// give an event's memory back to the arena it came from
+static void
+MidiEvent_release_data(MidiEvent *self) {
+  if (self->_data == NULL) return;
+  if (self->_slot_class >= 0) {
+    ReceiveArena_give(((Client *)self->_client)->_arena, 
+                      self->_slot_class, self->_slot);
+  }
+  else free(self->_data);
+  self->_data = NULL;
+  self->_size = 0;
+}
+
+static void
+MidiEvent_dealloc(MidiEvent *self) {
+  PyObject_GC_UnTrack((PyObject *)self);
+  MidiEvent_release_data(self);
+  Py_XDECREF(self->_client);
+  PyTypeObject *type = Py_TYPE(self);
+  type->tp_free((PyObject *)self);
+  Py_DECREF(type);
+}
+
+// let the garbage collector see the references an event holds
+static int
+MidiEvent_traverse(MidiEvent *self, visitproc visit, void *arg) {
+  Py_VISIT(Py_TYPE(self));
+  Py_VISIT(self->_client);
+  return(0);
+}
+
+// release an event's memory before the event itself goes away
+static PyObject *
+MidiEvent_release(MidiEvent *self) {
+  if (self->_exports > 0) {
+    PyErr_SetString(PyExc_BufferError, 
+      "Cannot release a MIDI event while its data is being viewed");
+    return(NULL);
+  }
+  MidiEvent_release_data(self);
+  Py_RETURN_NONE;
+}
+
+static Py_ssize_t
+MidiEvent_length(MidiEvent *self) {
+  return((Py_ssize_t)self->_size);
+}
+
+static PyObject *
+MidiEvent_item(MidiEvent *self, Py_ssize_t i) {
+  if ((i < 0) || ((size_t)i >= self->_size)) {
+    PyErr_SetString(PyExc_IndexError, "MIDI event index out of range");
+    return(NULL);
+  }
+  return(PyLong_FromLong(self->_data[i]));
+}
+
+static int
+MidiEvent_getbuffer(MidiEvent *self, Py_buffer *view, int flags) {
+  if (self->_data == NULL) {
+    PyErr_SetString(PyExc_BufferError, "The MIDI event has been released");
+    view->obj = NULL;
+    return(-1);
+  }
+  if (PyBuffer_FillInfo(view, (PyObject *)self, self->_data, 
+                        (Py_ssize_t)self->_size, 1, flags) < 0) return(-1);
+  self->_exports++;
+  return(0);
+}
+
+static void
+MidiEvent_releasebuffer(MidiEvent *self, Py_buffer *view) {
+  self->_exports--;
+}
+
+static PyMethodDef MidiEvent_methods[] = {
+  {"release", (PyCFunction)MidiEvent_release, METH_NOARGS,
+    "Give the event's memory back to the client before it's deleted"},
+  {NULL}  /* Sentinel */
+};
+
+static PyMemberDef MidiEvent_members[] = {
+  {"time", T_DOUBLE, offsetof(MidiEvent, time), READONLY,
+   "The transport time the event was received at, in seconds"},
+  {"frame", T_UINT, offsetof(MidiEvent, frame), READONLY,
+   "The frame on JACK's frame clock the event was received at"},
+  {"usecs", T_ULONGLONG, offsetof(MidiEvent, usecs), READONLY,
+   "The system time the event was received at, in microseconds"},
+  {NULL}  /* Sentinel */
+};
+
+static PyType_Slot MidiEvent_slots[] = {
+  {Py_tp_dealloc, (destructor)MidiEvent_dealloc},
+  {Py_tp_traverse, (traverseproc)MidiEvent_traverse},
+  {Py_tp_doc, "A received MIDI message that views its data in place"},
+  {Py_sq_length, (lenfunc)MidiEvent_length},
+  {Py_sq_item, (ssizeargfunc)MidiEvent_item},
+  {Py_bf_getbuffer, (getbufferproc)MidiEvent_getbuffer},
+  {Py_bf_releasebuffer, (releasebufferproc)MidiEvent_releasebuffer},
+  {Py_tp_methods, MidiEvent_methods},
+  {Py_tp_members, MidiEvent_members},
+  {0, NULL}
+};
+
+static PyType_Spec MidiEvent_spec = {
+  "jackpatch.MidiEvent",       /* name */
+  sizeof(MidiEvent),           /* basicsize */
+  0,                           /* itemsize */
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC | 
+    Py_TPFLAGS_DISALLOW_INSTANTIATION, /* flags */
+  MidiEvent_slots              /* slots */
+};
+
+// STANDARD MIDI FILES ********************************************************
+
+// read a variable-length quantity from a standard MIDI file, 
+//  returning -1 if it runs past the end of the data
+static int
+_smf_read_varint(const unsigned char **data, const unsigned char *end, 
+                 uint32_t *value) {
+  const unsigned char *p = *data;
+  uint32_t result = 0;
+  int i;
+  for (i = 0; i < 4; i++) {
+    if (p >= end) return(-1);
+    result = (result << 7) | (*p & 0x7F);
+    if ((*p++ & 0x80) == 0) {
+      *value = result;
+      *data = p;
+      return(0);
+    }
+  }
+  return(-1);
+}
+
+// read a big-endian number from a standard MIDI file
+static inline uint32_t
+_smf_read_number(const unsigned char *data, int bytes) {
+  uint32_t result = 0;
+  int i;
+  for (i = 0; i < bytes; i++) result = (result << 8) | data[i];
+  return(result);
+}
+
+// get the size of a cursor for the given number of tracks
+static inline size_t
+_smf_cursor_size(int track_count) {
+  return(sizeof(SmfCursor) + (sizeof(SmfTrack) * track_count));
+}
+
+// copy a cursor's position to another with the same number of tracks
+static void
+SmfCursor_copy(SmfCursor *dest, const SmfCursor *src) {
+  memcpy(dest, src, _smf_cursor_size(src->track_count));
+}
+
+// make a cursor at the start of a standard MIDI file, 
+//  returning NULL with an exception set if it can't be read
+static SmfCursor *
+SmfCursor_new(const unsigned char *data, size_t size) {
+  const unsigned char *end = data + size;
+  if ((size < 14) || (memcmp(data, "MThd", 4) != 0)) {
+    PyErr_SetString(PyExc_ValueError, "Not a standard MIDI file");
+    return(NULL);
+  }
+  uint32_t header_size = _smf_read_number(data + 4, 4);
+  int track_count = (int)_smf_read_number(data + 10, 2);
+  uint32_t division = _smf_read_number(data + 12, 2);
+  if ((header_size < 6) || (header_size > size - 8) || (division == 0)) {
+    PyErr_SetString(PyExc_ValueError, "The MIDI file's header is invalid");
+    return(NULL);
+  }
+  // an SMPTE division needs one of the frame rates the format allows and 
+  //  at least one tick per frame
+  if (division & 0x8000) {
+    int fps = -(int)(int8_t)(division >> 8);
+    if (((fps != 24) && (fps != 25) && (fps != 29) && (fps != 30)) || 
+        ((division & 0xFF) == 0)) {
+      PyErr_SetString(PyExc_ValueError, "The MIDI file's header is invalid");
+      return(NULL);
+    }
+  }
+  SmfCursor *cursor = (SmfCursor *)malloc(_smf_cursor_size(track_count));
+  if (cursor == NULL) {
+    PyErr_NoMemory();
+    return(NULL);
+  }
+  if (division & 0x8000) {
+    // the upper byte is a negative SMPTE frame rate, where 29 means 29.97
+    int fps = -(int)(int8_t)(division >> 8);
+    double frame_rate = (fps == 29) ? 29.97 : (double)fps;
+    cursor->is_smpte = 1;
+    cursor->ticks_per_beat = 0.0;
+    cursor->seconds_per_tick = 1.0 / (frame_rate * (double)(division & 0xFF));
+  }
+  else {
+    // the default tempo is 120 BPM
+    cursor->is_smpte = 0;
+    cursor->ticks_per_beat = (double)division;
+    cursor->seconds_per_tick = 0.5 / (double)division;
+  }
+  cursor->tempo_tick = 0;
+  cursor->tempo_time = 0.0;
+  cursor->time = 0.0;
+  cursor->track_count = 0;
+  // find the tracks, skipping chunks we don't know about
+  const unsigned char *p = data + 8 + header_size;
+  while ((cursor->track_count < track_count) && (end - p >= 8)) {
+    uint32_t chunk_size = _smf_read_number(p + 4, 4);
+    const unsigned char *chunk = p + 8;
+    if (chunk_size > (size_t)(end - chunk)) chunk_size = end - chunk;
+    p = chunk + chunk_size;
+    if (memcmp(chunk - 8, "MTrk", 4) != 0) continue;
+    SmfTrack *track = &(cursor->tracks[cursor->track_count++]);
+    track->data = chunk;
+    track->end = chunk + chunk_size;
+    track->tick = 0;
+    track->status = 0;
+    uint32_t delta;
+    if (_smf_read_varint(&(track->data), track->end, &delta) < 0) {
+      track->data = NULL;
+    }
+    else track->tick = delta;
+  }
+  return(cursor);
+}
+
+// get the track with the next event, or NULL if they've all ended
+static SmfTrack *
+_smf_next_track(SmfCursor *cursor) {
+  SmfTrack *next = NULL;
+  int i;
+  for (i = 0; i < cursor->track_count; i++) {
+    SmfTrack *track = &(cursor->tracks[i]);
+    if ((track->data != NULL) && ((next == NULL) || (track->tick < next->tick))) {
+      next = track;
+    }
+  }
+  return(next);
+}
+
+// get the time in seconds of a tick at the current tempo
+static inline double
+_smf_tick_time(SmfCursor *cursor, uint64_t tick) {
+  return(cursor->tempo_time + 
+    ((double)(tick - cursor->tempo_tick) * cursor->seconds_per_tick));
+}
+
+// get the time of the next event without decoding it, 
+//  or infinity if there are no more
+static double
+SmfCursor_peek_time(SmfCursor *cursor) {
+  SmfTrack *track = _smf_next_track(cursor);
+  if (track == NULL) return(INFINITY);
+  return(_smf_tick_time(cursor, track->tick));
+}
+
+// decode the next event from any track in time order, returning 0 once 
+//  every track has ended; tempo changes are applied as they're reached
+static int
+SmfCursor_next(SmfCursor *cursor, SmfEvent *event) {
+  SmfTrack *track = _smf_next_track(cursor);
+  if (track == NULL) return(0);
+  const unsigned char *p = track->data;
+  const unsigned char *end = track->end;
+  uint32_t length;
+  event->time = _smf_tick_time(cursor, track->tick);
+  event->head_size = 0;
+  event->body = NULL;
+  event->body_size = 0;
+  cursor->time = event->time;
+  if (p >= end) goto ended;
+  unsigned char status = *p;
+  if (status < 0x80) {
+    // use running status, which only applies to channel messages
+    status = track->status;
+    if (status == 0) goto ended;
+  }
+  else p++;
+  if (status == 0xFF) {
+    if (p >= end) goto ended;
+    unsigned char type = *p++;
+    if ((_smf_read_varint(&p, end, &length) < 0) || 
+        (length > (size_t)(end - p))) goto ended;
+    if (type == 0x2F) goto ended;
+    if ((type == 0x51) && (length == 3) && (! cursor->is_smpte)) {
+      cursor->tempo_time = event->time;
+      cursor->tempo_tick = track->tick;
+      cursor->seconds_per_tick = (double)_smf_read_number(p, 3) / 
+        (1000000.0 * cursor->ticks_per_beat);
+    }
+    p += length;
+    track->status = 0;
+  }
+  else if ((status == 0xF0) || (status == 0xF7)) {
+    if ((_smf_read_varint(&p, end, &length) < 0) || 
+        (length > (size_t)(end - p))) goto ended;
+    // F0 starts a SysEx message, while F7 escapes arbitrary bytes
+    if (status == 0xF0) event->head[event->head_size++] = 0xF0;
+    event->body = p;
+    event->body_size = length;
+    p += length;
+    track->status = 0;
+  }
+  else if (status >= 0xF0) goto ended;
+  else {
+    size_t data_size = ((status & 0xE0) == 0xC0) ? 1 : 2;
+    if ((size_t)(end - p) < data_size) goto ended;
+    event->head[0] = status;
+    event->head[1] = p[0] & 0x7F;
+    if (data_size > 1) event->head[2] = p[1] & 0x7F;
+    event->head_size = 1 + data_size;
+    p += data_size;
+    track->status = status;
+  }
+  // read the time until the track's next event
+  if ((p >= end) || (_smf_read_varint(&p, end, &length) < 0)) {
+    track->data = NULL;
+  }
+  else {
+    track->data = p;
+    track->tick += length;
+  }
+  return(1);
+  ended:
+    track->data = NULL;
+    return(1);
+}
+
+// move a cursor to the first event at or after a time in seconds
+static void
+SmfCursor_seek(SmfCursor *cursor, const SmfCursor *start, double time) {
+  SmfEvent event;
+  SmfCursor_copy(cursor, start);
+  while (SmfCursor_peek_time(cursor) < time) {
+    if (! SmfCursor_next(cursor, &event)) break;
+  }
+}
+
+// PLAYER *********************************************************************
+
+// free a player's feed once the process callback can't be using it
+static void
+PlayerFeed_free(void *feed_ptr) {
+  PlayerFeed *feed = (PlayerFeed *)feed_ptr;
+  if (feed == NULL) return;
+  if (feed->ring != NULL) jack_ringbuffer_free(feed->ring);
+  free(feed->scratch);
+  free(feed);
+}
+
+// allocate a feed for a player to pass decoded events to the process callback
+static PlayerFeed *
+PlayerFeed_new(void) {
+  PlayerFeed *feed = (PlayerFeed *)malloc(sizeof(PlayerFeed));
+  if (feed == NULL) return(NULL);
+  feed->ring = jack_ringbuffer_create(PLAYER_QUEUE_SIZE);
+  feed->scratch = (unsigned char *)malloc(PLAYER_SCRATCH_SIZE);
+  feed->scratch_used = 0;
+  atomic_init(&(feed->flushes), 0);
+  atomic_init(&(feed->flushes_done), 0);
+  if ((feed->ring == NULL) || (feed->scratch == NULL)) {
+    PlayerFeed_free(feed);
+    return(NULL);
+  }
+  jack_ringbuffer_mlock(feed->ring);
+  mlock(feed->scratch, PLAYER_SCRATCH_SIZE);
+  return(feed);
+}
+
+// write an event to a player's feed, returning -1 if there isn't room
+static int
+_player_write(PlayerFeed *feed, jack_nframes_t frame, 
+              const unsigned char *head, size_t head_size, 
+              const unsigned char *body, size_t body_size) {
+  PlayerRecord record;
+  record.frame = frame;
+  record.size = (uint32_t)(head_size + body_size);
+  size_t record_size = sizeof(PlayerRecord) + record.size;
+  if (jack_ringbuffer_write_space(feed->ring) < record_size) return(-1);
+  jack_ringbuffer_data_t vec[2];
+  jack_ringbuffer_get_write_vector(feed->ring, vec);
+  _ringbuffer_vector_write(vec, 0, &record, sizeof(PlayerRecord));
+  _ringbuffer_vector_write(vec, sizeof(PlayerRecord), head, head_size);
+  if (body_size > 0) {
+    _ringbuffer_vector_write(vec, sizeof(PlayerRecord) + head_size, 
+                             body, body_size);
+  }
+  jack_ringbuffer_write_advance(feed->ring, record_size);
+  return(0);
+}
+
+// keep track of which notes a player is holding, 
+//  so they can be released if playback stops or jumps
+static void
+_player_track_note(Player *self, const unsigned char *head, size_t size) {
+  if (size != 3) return;
+  unsigned char *held = self->_held[head[0] & 0x0F];
+  int note = head[1] & 0x7F;
+  // a note-on with zero velocity is a note-off
+  if (((head[0] & 0xF0) == 0x90) && (head[2] > 0)) {
+    held[note / 8] |= (1 << (note % 8));
+  }
+  else if (((head[0] & 0xF0) == 0x80) || ((head[0] & 0xF0) == 0x90)) {
+    held[note / 8] &= ~(1 << (note % 8));
+  }
+}
+
+// get whether a player's feed has room for note-offs for every note 
+//  it's holding
+static int
+_player_can_release_notes(Player *self) {
+  int channel, note;
+  size_t needed = 0;
+  for (channel = 0; channel < 16; channel++) {
+    for (note = 0; note < 128; note++) {
+      if (self->_held[channel][note / 8] & (1 << (note % 8))) {
+        needed += sizeof(PlayerRecord) + 3;
+      }
+    }
+  }
+  return(jack_ringbuffer_write_space(self->_feed->ring) >= needed);
+}
+
+// send note-offs for every note a player is holding, returning -1 if the 
+//  feed filled up first, in which case the notes still held are the ones 
+//  that didn't get a note-off
+static int
+_player_release_notes(Player *self, jack_nframes_t frame) {
+  int channel, note;
+  unsigned char message[3];
+  for (channel = 0; channel < 16; channel++) {
+    for (note = 0; note < 128; note++) {
+      if ((self->_held[channel][note / 8] & (1 << (note % 8))) == 0) continue;
+      message[0] = 0x80 | channel;
+      message[1] = note;
+      message[2] = 0;
+      if (_player_write(self->_feed, frame, message, sizeof(message), 
+                        NULL, 0) < 0) return(-1);
+      self->_held[channel][note / 8] &= ~(1 << (note % 8));
+    }
+  }
+  return(0);
+}
+
+// ask the process callback to discard everything in a player's feed, 
+//  releasing held notes once it has
+static void
+_player_flush(Player *self) {
+  atomic_fetch_add(&(self->_feed->flushes), 1);
+  self->_release_pending = 1;
+}
+
+// get a player's position in the file at the given frame 
+//  (with the player's lock held)
+static double
+_player_position(Player *self, jack_nframes_t now, jack_nframes_t rate) {
+  if ((! self->_playing) || (! self->_anchored) || (rate == 0)) {
+    return(self->_position);
+  }
+  jack_nframes_t frame = self->_anchor_frame;
+  double time = self->_anchor_time;
+  // if the thread has looped ahead of the callback, 
+  //  we're still on the last pass
+  if (_frame_before(now, frame)) {
+    frame = self->_last_anchor_frame;
+    time = self->_last_anchor_time;
+  }
+  int32_t elapsed = (int32_t)(now - frame);
+  if (elapsed < 0) elapsed = 0;
+  time += (double)elapsed / (double)rate;
+  return((time < self->duration) ? time : self->duration);
+}
+
+// decode events far enough ahead of the process callback to keep it fed, 
+//  returning whether the player should keep being woken up every block 
+//  (called only on the player's thread, with the player's lock held)
+static int
+Player_feed(Player *self, Client *client) {
+  // don't use the client while it's being opened or closed
+  if (pthread_rwlock_tryrdlock(&(client->_lock)) != 0) return(1);
+  if ((client->is_active != Py_True) || (client->_client == NULL)) {
+    pthread_rwlock_unlock(&(client->_lock));
+    return(self->_requested || self->_release_pending);
+  }
+  jack_client_t *jack_client = client->_client;
+  jack_nframes_t rate = Client_sample_rate(client);
+  jack_nframes_t period = atomic_load(&(client->_buffer_size));
+  jack_nframes_t now = jack_frame_time(jack_client);
+  PlayerFeed *feed = self->_feed;
+  // carry out requests
+  if (self->_requested != self->_playing) {
+    if (self->_playing) {
+      self->_position = _player_position(self, now, rate);
+      self->_seek = self->_position;
+    }
+    self->_playing = self->_requested;
+    self->_anchored = 0;
+  }
+  if (! isnan(self->_seek)) {
+    double time = self->_seek;
+    self->_seek = NAN;
+    _player_flush(self);
+    pthread_mutex_unlock(&(self->_lock));
+    SmfCursor_seek(self->_cursor, self->_start, time);
+    pthread_mutex_lock(&(self->_lock));
+    self->_has_pending = 0;
+    self->_position = time;
+    self->_anchored = 0;
+  }
+  // wait for the callback to discard the feed before adding to it again
+  if (atomic_load(&(feed->flushes)) != atomic_load(&(feed->flushes_done))) {
+    pthread_rwlock_unlock(&(client->_lock));
+    return(1);
+  }
+  if (self->_release_pending) {
+    // the feed was just emptied, but if the notes somehow don't fit, 
+    //  try again next time rather than leaving them hanging
+    if (_player_release_notes(self, now) < 0) {
+      pthread_rwlock_unlock(&(client->_lock));
+      return(1);
+    }
+    self->_release_pending = 0;
+  }
+  if (! self->_playing) {
+    pthread_rwlock_unlock(&(client->_lock));
+    return(0);
+  }
+  if (self->follow_transport) {
+    // line the file up with the transport, starting over whenever the 
+    //  transport stops or jumps
+    jack_transport_state_t state;
+    jack_position_t pos;
+    if (Client_read_transport(client, &state, &pos) < 0) {
+      pthread_rwlock_unlock(&(client->_lock));
+      return(1);
+    }
+    if (state != JackTransportRolling) {
+      if (self->_anchored) _player_flush(self);
+      self->_anchored = 0;
+      self->_position = (pos.frame_rate > 0) ? 
+        ((double)pos.frame / (double)pos.frame_rate) : 0.0;
+      pthread_rwlock_unlock(&(client->_lock));
+      return(1);
+    }
+    jack_nframes_t offset = 
+      jack_time_to_frames(jack_client, pos.usecs) - pos.frame;
+    int32_t drift = (int32_t)(offset - self->_transport_offset);
+    if ((! self->_anchored) || (drift > 1) || (drift < -1)) {
+      if (self->_anchored) _player_flush(self);
+      double time = (double)pos.frame / (double)rate;
+      pthread_mutex_unlock(&(self->_lock));
+      SmfCursor_seek(self->_cursor, self->_start, time);
+      pthread_mutex_lock(&(self->_lock));
+      self->_has_pending = 0;
+      self->_transport_offset = offset;
+      self->_anchor_frame = offset;
+      self->_anchor_time = 0.0;
+      self->_last_anchor_frame = offset;
+      self->_last_anchor_time = 0.0;
+      self->_anchored = 1;
+      if (self->_release_pending) {
+        pthread_rwlock_unlock(&(client->_lock));
+        return(1);
+      }
+    }
+  }
+  else if (! self->_anchored) {
+    // start playing a couple of blocks from now
+    self->_anchor_frame = now + (2 * period);
+    self->_anchor_time = self->_position;
+    self->_last_anchor_frame = self->_anchor_frame;
+    self->_last_anchor_time = self->_anchor_time;
+    self->_anchored = 1;
+  }
+  // decode events until they're too far ahead or the feed is full, 
+  //  without holding the player's lock since decoding can take a while
+  jack_nframes_t limit = now + (PLAYER_LOOKAHEAD_PERIODS * period);
+  int looping = (! self->follow_transport) && 
+    (self->_loop_end > self->_loop_start);
+  double loop_end = self->_loop_end;
+  jack_nframes_t anchor_frame = self->_anchor_frame;
+  double anchor_time = self->_anchor_time;
+  int finished = 0;
+  pthread_mutex_unlock(&(self->_lock));
+  while (1) {
+    if (! self->_has_pending) {
+      self->_has_pending = SmfCursor_next(self->_cursor, &(self->_pending));
+    }
+    // jump back to the loop start when the loop end comes up
+    if ((looping) && 
+        ((! self->_has_pending) || (self->_pending.time >= loop_end))) {
+      jack_nframes_t loop_frame = anchor_frame + 
+        (jack_nframes_t)llround((loop_end - anchor_time) * (double)rate);
+      if (! _frame_before(loop_frame, limit)) break;
+      // wait for the feed to drain if the note-offs won't all fit yet
+      if (! _player_can_release_notes(self)) break;
+      _player_release_notes(self, loop_frame);
+      pthread_mutex_lock(&(self->_lock));
+      SmfCursor_copy(self->_cursor, self->_loop_cursor);
+      self->_last_anchor_frame = self->_anchor_frame;
+      self->_last_anchor_time = self->_anchor_time;
+      self->_anchor_frame = anchor_frame = loop_frame;
+      self->_anchor_time = anchor_time = self->_loop_start;
+      pthread_mutex_unlock(&(self->_lock));
+      self->_has_pending = 0;
+      continue;
+    }
+    if (! self->_has_pending) {
+      finished = ! self->follow_transport;
+      break;
+    }
+    SmfEvent *event = &(self->_pending);
+    double delay = (event->time - anchor_time) * (double)rate;
+    jack_nframes_t frame = anchor_frame + 
+      (jack_nframes_t)llround((delay > 0.0) ? delay : 0.0);
+    if (! _frame_before(frame, limit)) break;
+    size_t size = event->head_size + event->body_size;
+    // skip meta events and anything too long to ever fit in the feed
+    if ((size > 0) && 
+        (sizeof(PlayerRecord) + size < PLAYER_QUEUE_SIZE)) {
+      if (_player_write(self->_feed, frame, event->head, event->head_size, 
+                        event->body, event->body_size) < 0) break;
+      _player_track_note(self, event->head, event->head_size);
+    }
+    self->_has_pending = 0;
+  }
+  pthread_mutex_lock(&(self->_lock));
+  pthread_rwlock_unlock(&(client->_lock));
+  // stop once the end of the file has been decoded, leaving what's in the 
+  //  feed to play out
+  if (finished) {
+    jack_nframes_t end_frame = anchor_frame + (jack_nframes_t)llround(
+      (self->duration - anchor_time) * (double)rate);
+    // if the feed is too full for the note-offs, finish next time
+    if (_player_release_notes(self, end_frame) < 0) return(1);
+    self->_requested = 0;
+    self->_playing = 0;
+    self->_anchored = 0;
+    self->_position = self->duration;
+    return(0);
+  }
+  return(1);
+}
+
+// run a player's decoding, waking up once per block while it's playing
+static void *
+Player_thread(void *self_ptr) {
+  Player *self = (Player *)self_ptr;
+  Client *client = (Client *)((Port *)self->port)->client;
+  pthread_mutex_lock(&(self->_lock));
+  while (! self->_quit) {
+    int active = Player_feed(self, client);
+    if (self->_quit) break;
+    if ((! active) && (self->_requested == self->_playing) && 
+        (isnan(self->_seek))) {
+      pthread_cond_wait(&(self->_wake), &(self->_lock));
+      continue;
+    }
+    // sleep for about a block
+    jack_nframes_t rate = Client_sample_rate(client);
+    jack_nframes_t period = atomic_load(&(client->_buffer_size));
+    long nsecs = ((rate > 0) && (period > 0)) ? 
+      (long)(((double)period / (double)rate) * 1.0e9) : 5000000L;
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += nsecs;
+    while (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_nsec -= 1000000000L;
+      deadline.tv_sec++;
+    }
+    pthread_cond_timedwait(&(self->_wake), &(self->_lock), &deadline);
+  }
+  pthread_mutex_unlock(&(self->_lock));
+  return(NULL);
+}
+
+// wake a player's thread to act on a request (with the player's lock held)
+static inline void
+Player_wake(Player *self) {
+  pthread_cond_signal(&(self->_wake));
+}
+
+static PyObject *
+Player_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+  Player *self;
+  self = (Player *)type->tp_alloc(type, 0);
+  if (self != NULL) {
+    Py_INCREF(Py_None);
+    self->port = Py_None;
+    Py_INCREF(Py_None);
+    self->path = Py_None;
+    self->duration = 0.0;
+    self->follow_transport = 0;
+    self->_data = NULL;
+    self->_size = 0;
+    self->_start = NULL;
+    self->_loop_cursor = NULL;
+    self->_cursor = NULL;
+    self->_has_pending = 0;
+    self->_feed = NULL;
+    self->_thread_running = 0;
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&(self->_wake), &attributes);
+    pthread_condattr_destroy(&attributes);
+    pthread_mutex_init(&(self->_lock), NULL);
+    self->_quit = 0;
+    self->_requested = 0;
+    self->_seek = NAN;
+    self->_loop_start = 0.0;
+    self->_loop_end = 0.0;
+    self->_playing = 0;
+    self->_anchored = 0;
+    self->_position = 0.0;
+    self->_release_pending = 0;
+    memset(self->_held, 0, sizeof(self->_held));
+    self->_transport_offset = 0;
+  }
+  return((PyObject *)self);
+}
+
+static int
+Player_init(Player *self, PyObject *args, PyObject *kwds) {
+  Port *port = NULL;
+  PyObject *path = NULL;
+  int follow_transport = 0;
+  static char *kwlist[] = {"port", "path", "follow_transport", NULL};
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "O!O&|p", kwlist, 
+                                    _module_state(self)->PortType, &port, 
+                                    PyUnicode_FSConverter, &path, 
+                                    &follow_transport))
+    return(-1);
+  if (self->_feed != NULL) {
+    Py_DECREF(path);
+    _error(self, "%s", "A player can only be initialized once");
+    return(-1);
+  }
+  // make sure the port can send
+  Client *client = Port_prepare_send(port);
+  if (client == NULL) {
+    Py_DECREF(path);
+    return(-1);
+  }
+  PyObject *tmp = self->port;
+  Py_INCREF(port);
+  self->port = (PyObject *)port;
+  Py_XDECREF(tmp);
+  // map the file into memory, so only the parts being played are read
+  const char *filename = PyBytes_AS_STRING(path);
+  int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  struct stat info;
+  if ((fd < 0) || (fstat(fd, &info) != 0)) {
+    PyErr_SetFromErrnoWithFilename(PyExc_OSError, filename);
+    if (fd >= 0) close(fd);
+    Py_DECREF(path);
+    return(-1);
+  }
+  void *data = (info.st_size > 0) ? 
+    mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+  close(fd);
+  if (data == MAP_FAILED) {
+    PyErr_SetFromErrnoWithFilename(PyExc_OSError, filename);
+    Py_DECREF(path);
+    return(-1);
+  }
+  self->_data = (const unsigned char *)data;
+  self->_size = (size_t)info.st_size;
+  if (self->_data == NULL) {
+    Py_DECREF(path);
+    PyErr_SetString(PyExc_ValueError, "Not a standard MIDI file");
+    return(-1);
+  }
+  self->_start = SmfCursor_new(self->_data, self->_size);
+  if (self->_start == NULL) {
+    Py_DECREF(path);
+    return(-1);
+  }
+  size_t cursor_size = _smf_cursor_size(self->_start->track_count);
+  self->_cursor = (SmfCursor *)malloc(cursor_size);
+  self->_loop_cursor = (SmfCursor *)malloc(cursor_size);
+  self->_feed = PlayerFeed_new();
+  if ((self->_cursor == NULL) || (self->_loop_cursor == NULL) || 
+      (self->_feed == NULL)) {
+    Py_DECREF(path);
+    PyErr_NoMemory();
+    return(-1);
+  }
+  // find out how long the file is by decoding it all once
+  SmfEvent event;
+  SmfCursor_copy(self->_cursor, self->_start);
+  while (SmfCursor_next(self->_cursor, &event)) { }
+  self->duration = self->_cursor->time;
+  SmfCursor_copy(self->_cursor, self->_start);
+  SmfCursor_copy(self->_loop_cursor, self->_start);
+  // only one player can feed a port at a time
+  PlayerFeed *expected = NULL;
+  if (! atomic_compare_exchange_strong(&(port->_managed->feed), &expected, 
+                                       self->_feed)) {
+    Py_DECREF(path);
+    _error(self, "%s", "The port is already being fed by another player");
+    return(-1);
+  }
+  tmp = self->path;
+  self->path = PyUnicode_DecodeFSDefault(filename);
+  Py_DECREF(path);
+  Py_XDECREF(tmp);
+  if (self->path == NULL) return(-1);
+  self->follow_transport = follow_transport ? 1 : 0;
+  int result = pthread_create(&(self->_thread), NULL, Player_thread, self);
+  if (result != 0) {
+    _error(self, "Failed to start a thread for the player (error %i)", result);
+    return(-1);
+  }
+  self->_thread_running = 1;
+  return(0);
+}
+
+// stop a player's thread and stop feeding its port, releasing any notes 
+//  it was holding
+static void
+Player_close(Player *self) {
+  if (self->_thread_running) {
+    pthread_mutex_lock(&(self->_lock));
+    self->_quit = 1;
+    Player_wake(self);
+    pthread_mutex_unlock(&(self->_lock));
+    Py_BEGIN_ALLOW_THREADS
+    pthread_join(self->_thread, NULL);
+    Py_END_ALLOW_THREADS
+    self->_thread_running = 0;
+  }
+  if (self->_feed == NULL) return;
+  if (self->port == Py_None) {
+    PlayerFeed_free(self->_feed);
+    self->_feed = NULL;
+    return;
+  }
+  Port *port = (Port *)self->port;
+  Client *client = (Client *)port->client;
+  if ((port->_managed != NULL) && 
+      (atomic_load(&(port->_managed->feed)) == self->_feed)) {
+    // now that the thread is gone we can write to the feed ourselves, 
+    //  so discard what's left in it and let the callback send note-offs
+    if (client->is_active == Py_True) {
+      _player_flush(self);
+      Client_synchronize(client);
+      if (client->_client != NULL) {
+        _player_release_notes(self, jack_frame_time(client->_client));
+      }
+      Client_synchronize(client);
+    }
+    atomic_store(&(port->_managed->feed), NULL);
+    // if we can't track it, it's safer to leak it than to free it early
+    if (Client_retire(client, self->_feed, PlayerFeed_free) == 0) {
+      self->_feed = NULL;
+    }
+  }
+  else {
+    PlayerFeed_free(self->_feed);
+    self->_feed = NULL;
+  }
+}
+
+static void
+Player_dealloc(Player *self) {
+  PyObject_GC_UnTrack((PyObject *)self);
+  Player_close(self);
+  free(self->_start);
+  free(self->_cursor);
+  free(self->_loop_cursor);
+  if (self->_data != NULL) munmap((void *)self->_data, self->_size);
+  pthread_mutex_destroy(&(self->_lock));
+  pthread_cond_destroy(&(self->_wake));
+  Py_XDECREF(self->port);
+  Py_XDECREF(self->path);
+  PyTypeObject *type = Py_TYPE(self);
+  type->tp_free((PyObject *)self);
+  Py_DECREF(type);
+}
+
+// let the garbage collector see the references a player holds
+static int
+Player_traverse(Player *self, visitproc visit, void *arg) {
+  Py_VISIT(Py_TYPE(self));
+  Py_VISIT(self->port);
+  Py_VISIT(self->path);
+  return(0);
+}
+
+// make sure a player has been set up, raising an error if not
+static int
+Player_check(Player *self) {
+  if (self->_thread_running) return(1);
+  _error(self, "%s", "The player isn't ready to play");
+  return(0);
+}
+
+// start playing from the current position
+static PyObject *
+Player_play(Player *self) {
+  if (! Player_check(self)) return(NULL);
+  // the process callback has to be running to send anything
+  Client *client = (Client *)((Port *)self->port)->client;
+  Client_activate(client);
+  if (client->is_active != Py_True) return(NULL);
+  pthread_mutex_lock(&(self->_lock));
+  // start over if a previous play reached the end
+  if ((! self->_requested) && (! self->follow_transport) && 
+      (self->_position >= self->duration)) {
+    self->_seek = 0.0;
+    self->_position = 0.0;
+  }
+  self->_requested = 1;
+  Player_wake(self);
+  pthread_mutex_unlock(&(self->_lock));
+  Py_RETURN_NONE;
+}
+
+// stop playing, releasing any held notes
+static PyObject *
+Player_stop(Player *self) {
+  if (! Player_check(self)) return(NULL);
+  pthread_mutex_lock(&(self->_lock));
+  self->_requested = 0;
+  Player_wake(self);
+  pthread_mutex_unlock(&(self->_lock));
+  Py_RETURN_NONE;
+}
+
+// move to a position in the file in seconds, or if the player is following 
+//  the transport, move the transport there
+static PyObject *
+Player_seek(Player *self, PyObject *args) {
+  double time = 0.0;
+  if (! PyArg_ParseTuple(args, "d", &time)) return(NULL);
+  if (! Player_check(self)) return(NULL);
+  if (time < 0.0) time = 0.0;
+  if (self->follow_transport) {
+    Client *client = (Client *)((Port *)self->port)->client;
+    int result = -1;
+    Client_lock(client, 0);
+    if (client->_client != NULL) {
+      jack_client_t *jack_client = client->_client;
+      jack_nframes_t frame = 
+        (jack_nframes_t)(time * (double)Client_sample_rate(client));
+      Py_BEGIN_ALLOW_THREADS
+      result = jack_transport_locate(jack_client, frame);
+      Py_END_ALLOW_THREADS
+    }
+    Client_unlock(client);
+    if (result != 0) {
+      _error(self, "Failed to set transport location to %f (error %d)", 
+             time, result);
+      return(NULL);
+    }
+    Py_RETURN_NONE;
+  }
+  pthread_mutex_lock(&(self->_lock));
+  self->_seek = time;
+  // report the new position right away rather than when the thread gets 
+  //  to it
+  self->_position = time;
+  self->_anchored = 0;
+  Player_wake(self);
+  pthread_mutex_unlock(&(self->_lock));
+  Py_RETURN_NONE;
+}
+
+// get whether the player is playing
+static PyObject *
+Player_get_is_playing(Player *self, void *closure) {
+  pthread_mutex_lock(&(self->_lock));
+  int requested = self->_requested;
+  pthread_mutex_unlock(&(self->_lock));
+  if (requested) Py_RETURN_TRUE;
+  else Py_RETURN_FALSE;
+}
+
+// get the player's position in the file in seconds
+static PyObject *
+Player_get_position(Player *self, void *closure) {
+  Client *client = (Client *)((Port *)self->port)->client;
+  jack_nframes_t now = 0;
+  jack_nframes_t rate = 0;
+  // hold the client's lock so it can't be closed while we ask for the time
+  Client_lock(client, 0);
+  if ((self->_thread_running) && (client->_client != NULL)) {
+    now = jack_frame_time(client->_client);
+    rate = Client_sample_rate(client);
+  }
+  Client_unlock(client);
+  pthread_mutex_lock(&(self->_lock));
+  double position = _player_position(self, now, rate);
+  pthread_mutex_unlock(&(self->_lock));
+  return(PyFloat_FromDouble(position));
+}
+
+// get and set the span of the file to loop over, as a (start, end) tuple 
+//  in seconds or None
+static PyObject *
+Player_get_loop(Player *self, void *closure) {
+  pthread_mutex_lock(&(self->_lock));
+  double start = self->_loop_start;
+  double end = self->_loop_end;
+  pthread_mutex_unlock(&(self->_lock));
+  if (end <= start) Py_RETURN_NONE;
+  return(Py_BuildValue("(dd)", start, end));
+}
+static int
+Player_set_loop(Player *self, PyObject *value, void *closure) {
+  double start = 0.0, end = 0.0;
+  if ((value != NULL) && (value != Py_None)) {
+    PyObject *tuple = PySequence_Tuple(value);
+    if (tuple == NULL) return(-1);
+    int parsed = PyArg_ParseTuple(tuple, "dd", &start, &end);
+    Py_DECREF(tuple);
+    if (! parsed) return(-1);
+    if ((start < 0.0) || (end <= start)) {
+      PyErr_SetString(PyExc_ValueError, 
+        "A player's loop must end after it starts, which can't be negative");
+      return(-1);
+    }
+  }
+  if (self->_start == NULL) {
+    _error(self, "%s", "The player isn't ready to play");
+    return(-1);
+  }
+  // find where the loop starts before handing it to the thread
+  SmfCursor *cursor = 
+    (SmfCursor *)malloc(_smf_cursor_size(self->_start->track_count));
+  if (cursor == NULL) {
+    PyErr_NoMemory();
+    return(-1);
+  }
+  SmfCursor_seek(cursor, self->_start, start);
+  pthread_mutex_lock(&(self->_lock));
+  SmfCursor_copy(self->_loop_cursor, cursor);
+  self->_loop_start = start;
+  self->_loop_end = end;
+  pthread_mutex_unlock(&(self->_lock));
+  free(cursor);
+  return(0);
+}
+
+static PyMemberDef Player_members[] = {
+  {"port", T_OBJECT_EX, offsetof(Player, port), READONLY,
+   "The port the player sends on"},
+  {"path", T_OBJECT_EX, offsetof(Player, path), READONLY,
+   "The path of the MIDI file being played"},
+  {"duration", T_DOUBLE, offsetof(Player, duration), READONLY,
+   "The length of the MIDI file in seconds"},
+  {"follow_transport", T_BOOL, offsetof(Player, follow_transport), READONLY,
+   "Whether the file is played in time with the JACK transport"},
+  {NULL}  /* Sentinel */
+};
+
+static PyGetSetDef Player_getset[] = {
+  {"is_playing", (getter)Player_get_is_playing, NULL, 
+    "Whether the player is playing", NULL},
+  {"position", (getter)Player_get_position, NULL, 
+    "The player's position in the file in seconds", NULL},
+  {"loop", (getter)Player_get_loop, (setter)Player_set_loop, 
+    "A (start, end) span of the file in seconds to repeat, or None", NULL},
+  {NULL}  /* Sentinel */
+};
+
+static PyMethodDef Player_methods[] = {
+  {"play", (PyCFunction)Player_play, METH_NOARGS,
+    "Start playing from the current position"},
+  {"stop", (PyCFunction)Player_stop, METH_NOARGS,
+    "Stop playing, releasing any held notes"},
+  {"seek", (PyCFunction)Player_seek, METH_VARARGS,
+    "Move to a position in the file in seconds"},
+  {NULL}  /* Sentinel */
+};
+
+static PyType_Slot Player_slots[] = {
+  {Py_tp_dealloc, (destructor)Player_dealloc},
+  {Py_tp_traverse, (traverseproc)Player_traverse},
+  {Py_tp_doc, "Plays a standard MIDI file on a port"},
+  {Py_tp_methods, Player_methods},
+  {Py_tp_members, Player_members},
+  {Py_tp_getset, Player_getset},
+  {Py_tp_init, (initproc)Player_init},
+  {Py_tp_new, Player_new},
+  {0, NULL}
+};
+
+static PyType_Spec Player_spec = {
+  "jackpatch.Player",          /* name */
+  sizeof(Player),              /* basicsize */
+  0,                           /* itemsize */
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /* flags */
+  Player_slots                 /* slots */
+};
+
+// RECORDER *******************************************************************
+
+// write a number to a buffer in little-endian order
+static inline void
+_recorder_put_number(unsigned char *buffer, uint64_t value, int bytes) {
+  int i;
+  for (i = 0; i < bytes; i++) buffer[i] = (unsigned char)(value >> (8 * i));
+}
+
+// write a variable-length quantity for a standard MIDI file, 
+//  returning the number of bytes written
+static int
+_smf_put_varint(unsigned char *buffer, uint32_t value) {
+  unsigned char bytes[5];
+  int count = 0;
+  int i;
+  do {
+    bytes[count++] = value & 0x7F;
+    value >>= 7;
+  } while (value > 0);
+  for (i = 0; i < count; i++) {
+    buffer[i] = bytes[count - 1 - i] | ((i < count - 1) ? 0x80 : 0);
+  }
+  return(count);
+}
+
+// write a recorded event to the file or, for a standard MIDI file, its 
+//  port's track, remembering the first error (called only by the 
+//  recorder's thread)
+static void
+_recorder_store(Recorder *self, const RecordedEvent *record, 
+                const unsigned char *data) {
+  unsigned char head[16];
+  size_t head_size = 0;
+  const unsigned char *body = data;
+  size_t body_size = record->size;
+  // time events from when recording started
+  jack_time_t usecs = (record->usecs > self->_start_usecs) ? 
+    record->usecs - self->_start_usecs : 0;
+  FILE *file = self->_file;
+  if (! self->_is_smf) {
+    _recorder_put_number(head, usecs, 8);
+    _recorder_put_number(head + 8, record->frame, 4);
+    _recorder_put_number(head + 12, record->track, 2);
+    _recorder_put_number(head + 14, record->size, 2);
+    head_size = 16;
+  }
+  else {
+    if (record->size == 0) return;
+    file = self->_tracks[record->track];
+    // tracks are timed in milliseconds
+    uint64_t tick = usecs / 1000;
+    uint64_t *last_tick = &(self->_track_ticks[record->track]);
+    if (tick < *last_tick) tick = *last_tick;
+    head_size = _smf_put_varint(head, (uint32_t)(tick - *last_tick));
+    *last_tick = tick;
+    if (data[0] == 0xF0) {
+      // SysEx is stored with its length after the F0
+      head[head_size++] = 0xF0;
+      body++;
+      body_size--;
+      head_size += _smf_put_varint(head + head_size, body_size);
+    }
+    else if (data[0] >= 0xF0) {
+      // other system messages can only be stored escaped
+      head[head_size++] = 0xF7;
+      head_size += _smf_put_varint(head + head_size, record->size);
+    }
+  }
+  if ((fwrite(head, 1, head_size, file) != head_size) || 
+      ((body_size > 0) && 
+       (fwrite(body, 1, body_size, file) != body_size))) {
+    if (self->_error == 0) self->_error = (errno != 0) ? errno : EIO;
+    return;
+  }
+  atomic_fetch_add(&(self->_events), 1);
+}
+
+// write everything in a recorder's queue to disk (called only by the 
+//  recorder's thread)
+static void
+_recorder_drain(Recorder *self) {
+  jack_ringbuffer_t *ring = self->_ring;
+  jack_ringbuffer_data_t vec[2];
+  RecordedEvent record;
+  unsigned char data[UINT16_MAX];
+  while (jack_ringbuffer_read_space(ring) >= sizeof(RecordedEvent)) {
+    // the process callback writes events as whole records, so if we can 
+    //  see the header we can see the data
+    jack_ringbuffer_get_read_vector(ring, vec);
+    _ringbuffer_vector_read(vec, 0, &record, sizeof(RecordedEvent));
+    _ringbuffer_vector_read(vec, sizeof(RecordedEvent), data, record.size);
+    jack_ringbuffer_read_advance(ring, sizeof(RecordedEvent) + record.size);
+    if ((self->_error == 0) && (record.track < self->_track_count)) {
+      _recorder_store(self, &record, data);
+    }
+  }
+}
+
+// assemble a standard MIDI file from a recorder's tracks, returning 0 or 
+//  an error number (called only by the recorder's thread)
+static int
+_recorder_write_smf(Recorder *self) {
+  FILE *file = self->_file;
+  unsigned char chunk[RECORDER_WRITE_BUFFER_SIZE];
+  static const unsigned char end_of_track[4] = { 0x00, 0xFF, 0x2F, 0x00 };
+  int i;
+  // a format 1 file with one track per port, timed in milliseconds 
+  //  (25 frames per second with 40 ticks per frame)
+  memcpy(chunk, "MThd\0\0\0\x06\0\x01", 10);
+  chunk[10] = (unsigned char)(self->_track_count >> 8);
+  chunk[11] = (unsigned char)(self->_track_count & 0xFF);
+  chunk[12] = 0xE7;
+  chunk[13] = 40;
+  if (fwrite(chunk, 1, 14, file) != 14) return(errno ? errno : EIO);
+  for (i = 0; i < self->_track_count; i++) {
+    FILE *track = self->_tracks[i];
+    if (fflush(track) != 0) return(errno ? errno : EIO);
+    long length = ftell(track);
+    if ((length < 0) || (length + sizeof(end_of_track) > UINT32_MAX)) {
+      return(EFBIG);
+    }
+    memcpy(chunk, "MTrk", 4);
+    chunk[4] = (unsigned char)((length + 4) >> 24);
+    chunk[5] = (unsigned char)((length + 4) >> 16);
+    chunk[6] = (unsigned char)((length + 4) >> 8);
+    chunk[7] = (unsigned char)(length + 4);
+    if (fwrite(chunk, 1, 8, file) != 8) return(errno ? errno : EIO);
+    rewind(track);
+    size_t count;
+    while ((count = fread(chunk, 1, sizeof(chunk), track)) > 0) {
+      if (fwrite(chunk, 1, count, file) != count) return(errno ? errno : EIO);
+    }
+    if (ferror(track)) return(errno ? errno : EIO);
+    if (fwrite(end_of_track, 1, sizeof(end_of_track), file) != 
+        sizeof(end_of_track)) return(errno ? errno : EIO);
+  }
+  return(0);
+}
+
+// write a recorder's events to disk in large batches until it's stopped, 
+//  then finish the file
+static void *
+Recorder_thread(void *self_ptr) {
+  Recorder *self = (Recorder *)self_ptr;
+  struct timespec deadline;
+  pthread_mutex_lock(&(self->_lock));
+  while (! self->_quit) {
+    pthread_mutex_unlock(&(self->_lock));
+    _recorder_drain(self);
+    pthread_mutex_lock(&(self->_lock));
+    if (self->_quit) break;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += RECORDER_WRITE_INTERVAL * 1000000L;
+    while (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_nsec -= 1000000000L;
+      deadline.tv_sec++;
+    }
+    pthread_cond_timedwait(&(self->_wake), &(self->_lock), &deadline);
+  }
+  pthread_mutex_unlock(&(self->_lock));
+  // the ports have been detached by now, so this gets everything
+  _recorder_drain(self);
+  if ((self->_is_smf) && (self->_error == 0)) {
+    self->_error = _recorder_write_smf(self);
+  }
+  if ((fclose(self->_file) != 0) && (self->_error == 0)) {
+    self->_error = errno ? errno : EIO;
+  }
+  self->_file = NULL;
+  return(NULL);
+}
+
+// free the queue and taps of a recorder once the process callback 
+//  can't be using them
+static void
+_recorder_ring_free(void *ring) {
+  jack_ringbuffer_free((jack_ringbuffer_t *)ring);
+}
+
+static PyObject *
+Recorder_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+  Recorder *self;
+  self = (Recorder *)type->tp_alloc(type, 0);
+  if (self != NULL) {
+    Py_INCREF(Py_None);
+    self->client = Py_None;
+    Py_INCREF(Py_None);
+    self->ports = Py_None;
+    Py_INCREF(Py_None);
+    self->path = Py_None;
+    Py_INCREF(Py_None);
+    self->format = Py_None;
+    self->_is_smf = 0;
+    self->_track_count = 0;
+    self->_managed = NULL;
+    self->_taps = NULL;
+    self->_ring = NULL;
+    self->_file = NULL;
+    self->_tracks = NULL;
+    self->_track_ticks = NULL;
+    self->_start_usecs = 0;
+    self->_thread_running = 0;
+    self->_closing = 0;
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&(self->_wake), &attributes);
+    pthread_condattr_destroy(&attributes);
+    pthread_mutex_init(&(self->_lock), NULL);
+    self->_quit = 0;
+    atomic_init(&(self->_events), 0);
+    self->_error = 0;
+  }
+  return((PyObject *)self);
+}
+
+static int
+Recorder_init(Recorder *self, PyObject *args, PyObject *kwds) {
+  Client *client = NULL;
+  PyObject *ports_obj = NULL;
+  PyObject *path = NULL;
+  const char *format = "smf";
+  int receive = 1;
+  int i;
+  static char *kwlist[] = {"client", "ports", "path", "format", "receive", 
+                           NULL};
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "O!OO&|sp", kwlist, 
+                                    _module_state(self)->ClientType, &client, 
+                                    &ports_obj, 
+                                    PyUnicode_FSConverter, &path, 
+                                    &format, &receive))
+    return(-1);
+  if (self->_ring != NULL) {
+    Py_DECREF(path);
+    _error(self, "%s", "A recorder can only be initialized once");
+    return(-1);
+  }
+  if ((strcmp(format, "smf") != 0) && (strcmp(format, "raw") != 0)) {
+    Py_DECREF(path);
+    PyErr_Format(PyExc_ValueError, 
+      "Unknown recording format \"%s\", expected \"smf\" or \"raw\"", format);
+    return(-1);
+  }
+  self->_is_smf = (strcmp(format, "smf") == 0);
+  PyObject *tmp = self->ports;
+  self->ports = PySequence_Tuple(ports_obj);
+  Py_XDECREF(tmp);
+  if (self->ports == NULL) {
+    Py_DECREF(path);
+    return(-1);
+  }
+  Py_ssize_t count = PyTuple_GET_SIZE(self->ports);
+  if ((count == 0) || (count > UINT16_MAX)) {
+    Py_DECREF(path);
+    PyErr_SetString(PyExc_ValueError, 
+      "A recording needs at least one port and at most 65535");
+    return(-1);
+  }
+  // make sure every port can receive and belongs to the client
+  self->_managed = (ManagedPort **)calloc(count, sizeof(ManagedPort *));
+  self->_taps = (RecorderTap **)calloc(count, sizeof(RecorderTap *));
+  if ((self->_managed == NULL) || (self->_taps == NULL)) {
+    Py_DECREF(path);
+    PyErr_NoMemory();
+    return(-1);
+  }
+  for (i = 0; i < count; i++) {
+    Port *port = (Port *)PyTuple_GET_ITEM(self->ports, i);
+    if (! PyObject_TypeCheck((PyObject *)port, 
+                             _module_state(self)->PortType)) {
+      Py_DECREF(path);
+      PyErr_SetString(PyExc_TypeError, "Only Ports can be recorded");
+      return(-1);
+    }
+    if ((Client *)port->client != client) {
+      Py_DECREF(path);
+      _error(self, "%s", "Only the client's own ports can be recorded");
+      return(-1);
+    }
+    if (Port_prepare_receive(port) == NULL) {
+      Py_DECREF(path);
+      if (! PyErr_Occurred()) _error(self, "%s", 
+                                           "MIDI is disabled for this port");
+      return(-1);
+    }
+    self->_managed[i] = port->_managed;
+    if (atomic_load(&(port->_managed->recorder)) != NULL) {
+      Py_DECREF(path);
+      _error(self, "%s", "The port is already being recorded");
+      return(-1);
+    }
+  }
+  tmp = self->client;
+  Py_INCREF(client);
+  self->client = (PyObject *)client;
+  Py_XDECREF(tmp);
+  tmp = self->format;
+  self->format = PyUnicode_FromString(format);
+  Py_XDECREF(tmp);
+  tmp = self->path;
+  self->path = PyUnicode_DecodeFSDefault(PyBytes_AS_STRING(path));
+  Py_XDECREF(tmp);
+  if ((self->format == NULL) || (self->path == NULL)) {
+    Py_DECREF(path);
+    return(-1);
+  }
+  // open the file, and for a standard MIDI file, a temporary file to 
+  //  collect each track in until they can be put together at the end
+  self->_file = fopen(PyBytes_AS_STRING(path), "wbe");
+  if (self->_file == NULL) {
+    PyErr_SetFromErrnoWithFilename(PyExc_OSError, PyBytes_AS_STRING(path));
+    Py_DECREF(path);
+    return(-1);
+  }
+  Py_DECREF(path);
+  setvbuf(self->_file, NULL, _IOFBF, RECORDER_WRITE_BUFFER_SIZE);
+  self->_track_count = (int)count;
+  if (self->_is_smf) {
+    self->_tracks = (FILE **)calloc(count, sizeof(FILE *));
+    self->_track_ticks = (uint64_t *)calloc(count, sizeof(uint64_t));
+    if ((self->_tracks == NULL) || (self->_track_ticks == NULL)) {
+      PyErr_NoMemory();
+      return(-1);
+    }
+    for (i = 0; i < count; i++) {
+      self->_tracks[i] = tmpfile();
+      if (self->_tracks[i] == NULL) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        return(-1);
+      }
+      setvbuf(self->_tracks[i], NULL, _IOFBF, RECORDER_WRITE_BUFFER_SIZE);
+    }
+  }
+  self->_ring = jack_ringbuffer_create(RECORDER_QUEUE_SIZE);
+  if (self->_ring == NULL) {
+    PyErr_NoMemory();
+    return(-1);
+  }
+  jack_ringbuffer_mlock(self->_ring);
+  for (i = 0; i < count; i++) {
+    RecorderTap *tap = (RecorderTap *)malloc(sizeof(RecorderTap));
+    if (tap == NULL) {
+      PyErr_NoMemory();
+      return(-1);
+    }
+    tap->ring = self->_ring;
+    tap->track = (uint16_t)i;
+    tap->receive = receive;
+    tap->overflows = 0;
+    tap->oversized = 0;
+    self->_taps[i] = tap;
+  }
+  self->_start_usecs = jack_get_time();
+  int result = pthread_create(&(self->_thread), NULL, Recorder_thread, self);
+  if (result != 0) {
+    _error(self, "Failed to start a thread for the recorder (error %i)", 
+                 result);
+    return(-1);
+  }
+  self->_thread_running = 1;
+  // only one recorder can tap a port at a time
+  for (i = 0; i < count; i++) {
+    RecorderTap *expected = NULL;
+    if (! atomic_compare_exchange_strong(&(self->_managed[i]->recorder), 
+                                         &expected, self->_taps[i])) {
+      _error(self, "%s", "The port is already being recorded");
+      return(-1);
+    }
+  }
+  return(0);
+}
+
+// stop recording, writing out everything received so far and closing the 
+//  file, returning -1 with an exception set if anything couldn't be written
+static int
+Recorder_close(Recorder *self) {
+  int i;
+  // claim the shutdown before anything lets go of the interpreter, so a 
+  //  call racing this one returns instead of joining the thread again
+  pthread_mutex_lock(&(self->_lock));
+  int claimed = (self->_thread_running && (! self->_closing));
+  if (claimed) self->_closing = 1;
+  pthread_mutex_unlock(&(self->_lock));
+  if (! claimed) return(0);
+  Client *client = (Client *)self->client;
+  // detach from the ports and wait for the process callback to let go
+  int detached = 0;
+  for (i = 0; i < self->_track_count; i++) {
+    RecorderTap *expected = self->_taps[i];
+    if ((expected != NULL) && 
+        (atomic_compare_exchange_strong(&(self->_managed[i]->recorder), 
+                                        &expected, NULL))) {
+      detached = 1;
+    }
+  }
+  if (detached) Client_synchronize(client);
+  pthread_mutex_lock(&(self->_lock));
+  self->_quit = 1;
+  pthread_cond_signal(&(self->_wake));
+  pthread_mutex_unlock(&(self->_lock));
+  Py_BEGIN_ALLOW_THREADS
+  pthread_join(self->_thread, NULL);
+  Py_END_ALLOW_THREADS
+  pthread_mutex_lock(&(self->_lock));
+  self->_thread_running = 0;
+  self->_closing = 0;
+  pthread_mutex_unlock(&(self->_lock));
+  if (self->_error != 0) {
+    errno = self->_error;
+    PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, self->path);
+    return(-1);
+  }
+  return(0);
+}
+
+static void
+Recorder_dealloc(Recorder *self) {
+  int i;
+  PyObject_GC_UnTrack((PyObject *)self);
+  if (Recorder_close(self) < 0) PyErr_WriteUnraisable((PyObject *)self);
+  if (self->_file != NULL) fclose(self->_file);
+  for (i = 0; i < self->_track_count; i++) {
+    if ((self->_tracks != NULL) && (self->_tracks[i] != NULL)) {
+      fclose(self->_tracks[i]);
     }
   }
-  jack_free(ports);
-  return(return_list);
+  free(self->_tracks);
+  free(self->_track_ticks);
+  // if the client was active the process callback may still have been 
+  //  looking at the queue and taps, so let the client free them once 
+  //  it's done (if we can't track them, it's safer to leak them)
+  Client *client = (self->client != Py_None) ? (Client *)self->client : NULL;
+  if (self->_taps != NULL) {
+    for (i = 0; i < self->_track_count; i++) {
+      if (client != NULL) Client_retire(client, self->_taps[i], free);
+      else free(self->_taps[i]);
+    }
+  }
+  if (self->_ring != NULL) {
+    if (client != NULL) Client_retire(client, self->_ring, _recorder_ring_free);
+    else jack_ringbuffer_free(self->_ring);
+  }
+  free(self->_taps);
+  free(self->_managed);
+  pthread_mutex_destroy(&(self->_lock));
+  pthread_cond_destroy(&(self->_wake));
+  Py_XDECREF(self->client);
+  Py_XDECREF(self->ports);
+  Py_XDECREF(self->path);
+  Py_XDECREF(self->format);
+  PyTypeObject *type = Py_TYPE(self);
+  type->tp_free((PyObject *)self);
+  Py_DECREF(type);
 }
 
-// use a client to make a connection between two ports
+// let the garbage collector see the references a recorder holds
+static int
+Recorder_traverse(Recorder *self, visitproc visit, void *arg) {
+  Py_VISIT(Py_TYPE(self));
+  Py_VISIT(self->client);
+  Py_VISIT(self->ports);
+  Py_VISIT(self->path);
+  Py_VISIT(self->format);
+  return(0);
+}
+
+// stop recording and finish the file
 static PyObject *
-Client_connect(Client *self, PyObject *args, PyObject *kwds) {
-  Port *source = NULL;
-  Port *destination = NULL;
-  static char *kwlist[] = {"source", "destination", NULL};
-  if (! PyArg_ParseTupleAndKeywords(args, kwds, "O!O!", kwlist, 
-                                  &PortType, &source, &PortType, &destination))
-    return(NULL);
-  Client_activate(self);
-  if (self->is_active != Py_True) return(NULL);
-  int result = jack_connect(self->_client, 
-    PyUnicode_AsUTF8(source->name), 
-    PyUnicode_AsUTF8(destination->name));
-  if ((result == 0) || (result == EEXIST)) Py_RETURN_TRUE;
-  else {
-    _warn("Failed to connect JACK ports (error %i)", result);
-    Py_RETURN_FALSE;
-  }
+Recorder_stop(Recorder *self) {
+  if (Recorder_close(self) < 0) return(NULL);
+  Py_RETURN_NONE;
 }
 
-// use a client to break the connection between two ports, if any
+// get whether the recorder is recording
 static PyObject *
-Client_disconnect(Client *self, PyObject *args, PyObject *kwds) {
-  Port *source = NULL;
-  Port *destination = NULL;
-  static char *kwlist[] = {"source", "destination", NULL};
-  if (! PyArg_ParseTupleAndKeywords(args, kwds, "O!O!", kwlist, 
-                                  &PortType, &source, &PortType, &destination))
-    return(NULL);
-  Client_activate(self);
-  if (self->is_active != Py_True) return(NULL);
-  int result = jack_disconnect(self->_client, 
-    PyUnicode_AsUTF8(source->name), 
-    PyUnicode_AsUTF8(destination->name));
-  if ((result == 0) || (result == EEXIST)) Py_RETURN_TRUE;
-  else {
-    _warn("Failed to disconnect JACK ports (error %i)", result);
-    Py_RETURN_FALSE;
-  }
+Recorder_get_is_recording(Recorder *self, void *closure) {
+  if (self->_thread_running) Py_RETURN_TRUE;
+  else Py_RETURN_FALSE;
 }
 
-// clean up allocated data for a client
-static void
-Client_dealloc(Client* self) {
-  Client_close(self);
-  // invalidate references to ports by zeroing the counts
-  self->_send_port_count = 0;
-  self->_receive_port_count = 0;
-  // free port list memory
-  free(self->_send_ports);
-  free(self->_receive_ports);
-  self->_send_ports = NULL;
-  self->_receive_ports = NULL;
-  // remove all events from the send and receive queues
-  Message *message = NULL;
-  Message *next = NULL;
-  message = self->_midi_receive_queue_head;
-  self->_midi_receive_queue_head = NULL;
-  self->_midi_receive_queue_tail = NULL;
-  while (message != NULL) {
-    next = message->next;
-    free(message);
-    message = next;
+// get the number of events written to the file
+static PyObject *
+Recorder_get_events(Recorder *self, void *closure) {
+  return(PyLong_FromUnsignedLong(atomic_load(&(self->_events))));
+}
+
+// get the number of events that were dropped because the recorder's queue 
+//  was full
+static PyObject *
+Recorder_get_overflows(Recorder *self, void *closure) {
+  unsigned long overflows = 0;
+  int i;
+  if (self->_taps != NULL) {
+    for (i = 0; i < self->_track_count; i++) {
+      if (self->_taps[i] != NULL) overflows += self->_taps[i]->overflows;
+    }
   }
-  message = self->_midi_send_queue_head;
-  self->_midi_send_queue_head = NULL;
-  while (message != NULL) {
-    next = message->next;
-    free(message);
-    message = next;
+  return(PyLong_FromUnsignedLong(overflows));
+}
+
+// get the number of events that were dropped because they were too big 
+//  to record
+static PyObject *
+Recorder_get_oversized(Recorder *self, void *closure) {
+  unsigned long oversized = 0;
+  int i;
+  if (self->_taps != NULL) {
+    for (i = 0; i < self->_track_count; i++) {
+      if (self->_taps[i] != NULL) oversized += self->_taps[i]->oversized;
+    }
   }
-  Py_XDECREF(self->name);  
+  return(PyLong_FromUnsignedLong(oversized));
 }
 
-static PyMemberDef Client_members[] = {
-  {"name", T_OBJECT_EX, offsetof(Client, name), READONLY,
-   "The client's unique name"},
-  {"is_open", T_OBJECT_EX, offsetof(Client, is_open), READONLY,
-   "Whether the client is connected to JACK"},
-  {"is_active", T_OBJECT_EX, offsetof(Client, is_active), READONLY,
-   "Whether the client is activated to send and receive data"},
-  {"transport", T_OBJECT_EX, offsetof(Client, transport), READONLY,
-   "A Transport that interfaces with the JACK transport via this client"},
+static PyMemberDef Recorder_members[] = {
+  {"client", T_OBJECT_EX, offsetof(Recorder, client), READONLY,
+   "The client whose ports are being recorded"},
+  {"ports", T_OBJECT_EX, offsetof(Recorder, ports), READONLY,
+   "The ports being recorded, in the order of the file's tracks"},
+  {"path", T_OBJECT_EX, offsetof(Recorder, path), READONLY,
+   "The path of the file being written"},
+  {"format", T_OBJECT_EX, offsetof(Recorder, format), READONLY,
+   "The format of the file, either \"smf\" or \"raw\""},
   {NULL}  /* Sentinel */
 };
 
-static PyMethodDef Client_methods[] = {
-    {"open", (PyCFunction)Client_open, METH_NOARGS,
-      "Ensure the client is connected to JACK"},
-    {"close", (PyCFunction)Client_close, METH_NOARGS,
-      "Ensure the client is not connected to JACK"},
-    {"activate", (PyCFunction)Client_activate, METH_NOARGS,
-      "Ensure the client is ready to send and receive data"},
-    {"deactivate", (PyCFunction)Client_deactivate, METH_NOARGS,
-      "Ensure the client cannot send and receive data"},
-    {"get_ports", (PyCFunction)Client_get_ports, METH_VARARGS | METH_KEYWORDS,
-      "Get a list of available ports"},
-    {"connect", (PyCFunction)Client_connect, METH_VARARGS | METH_KEYWORDS,
-      "Connect a source and destination port"},
-    {"disconnect", (PyCFunction)Client_disconnect, METH_VARARGS | METH_KEYWORDS,
-      "Disconnect a source and destination port"},
-    {NULL, NULL, 0, NULL}  /* Sentinel */
+static PyGetSetDef Recorder_getset[] = {
+  {"is_recording", (getter)Recorder_get_is_recording, NULL, 
+    "Whether the recorder is recording", NULL},
+  {"events", (getter)Recorder_get_events, NULL, 
+    "The number of events written to the file so far", NULL},
+  {"overflows", (getter)Recorder_get_overflows, NULL, 
+    "The number of events dropped because the disk couldn't keep up", NULL},
+  {"oversized", (getter)Recorder_get_oversized, NULL, 
+    "The number of events dropped for being longer than 65535 bytes", NULL},
+  {NULL}  /* Sentinel */
+};
+
+static PyMethodDef Recorder_methods[] = {
+  {"stop", (PyCFunction)Recorder_stop, METH_NOARGS,
+    "Stop recording and finish writing the file"},
+  {NULL}  /* Sentinel */
 };
 
-static PyTypeObject ClientType = {
-    PyObject_HEAD_INIT(NULL)
-    0,                             /*ob_size*/
-    "jackpatch.Client",            /*tp_name*/  
-    sizeof(Client),                /*tp_basicsize*/
-    0,                             /*tp_itemsize*/
-    (destructor)Client_dealloc,    /*tp_dealloc*/
-    0,                             /*tp_print*/
-    0,                             /*tp_getattr*/
-    0,                             /*tp_setattr*/
-    0,                             /*tp_compare*/
-    0,                             /*tp_repr*/
-    0,                             /*tp_as_number*/
-    0,                             /*tp_as_sequence*/
-    0,                             /*tp_as_mapping*/
-    0,                             /*tp_hash */
-    0,                             /*tp_call*/
-    0,                             /*tp_str*/
-    0,                             /*tp_getattro*/
-    0,                             /*tp_setattro*/
-    0,                             /*tp_as_buffer*/
-    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, /*tp_flags*/
-    "Represents a JACK client",    /* tp_doc */
-    0,		                         /* tp_traverse */
-    0,		                         /* tp_clear */
-    0,		                         /* tp_richcompare */
-    0,		                         /* tp_weaklistoffset */
-    0,		                         /* tp_iter */
-    0,		                         /* tp_iternext */
-    Client_methods,                /* tp_methods */
-    Client_members,                /* tp_members */
-    0,                             /* tp_getset */
-    0,                             /* tp_base */
-    0,                             /* tp_dict */
-    0,                             /* tp_descr_get */
-    0,                             /* tp_descr_set */
-    0,                             /* tp_dictoffset */
-    (initproc)Client_init,         /* tp_init */
-    0,                             /* tp_alloc */
-    Client_new,                    /* tp_new */
+static PyType_Slot Recorder_slots[] = {
+  {Py_tp_dealloc, (destructor)Recorder_dealloc},
+  {Py_tp_traverse, (traverseproc)Recorder_traverse},
+  {Py_tp_doc, "Records MIDI received on a client's ports to a file"},
+  {Py_tp_methods, Recorder_methods},
+  {Py_tp_members, Recorder_members},
+  {Py_tp_getset, Recorder_getset},
+  {Py_tp_init, (initproc)Recorder_init},
+  {Py_tp_new, Recorder_new},
+  {0, NULL}
 };
 
-// TRANSPORT ******************************************************************
+static PyType_Spec Recorder_spec = {
+  "jackpatch.Recorder",        /* name */
+  sizeof(Recorder),            /* basicsize */
+  0,                           /* itemsize */
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /* flags */
+  Recorder_slots               /* slots */
+};
+
+// CLOCK **********************************************************************
+
+// read what a clock's process callback last published, 
+//  returning -1 if it hasn't published anything yet
+static int
+_clock_read(ClockState *state, double *tempo, int *running, 
+            double *position) {
+  unsigned int before, after;
+  do {
+    before = atomic_load_explicit(&(state->sequence), memory_order_acquire);
+    *tempo = state->published_tempo;
+    *running = state->published_running;
+    *position = state->published_position;
+    atomic_thread_fence(memory_order_acquire);
+    after = atomic_load_explicit(&(state->sequence), memory_order_relaxed);
+  } while ((before != after) || ((before & 1) != 0));
+  return((before != 0) ? 0 : -1);
+}
 
 static PyObject *
-Transport_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
-  Transport *self;
-  self = (Transport *)type->tp_alloc(type, 0);
+Clock_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+  Clock *self;
+  self = (Clock *)type->tp_alloc(type, 0);
   if (self != NULL) {
-    self->client = Py_None;
+    Py_INCREF(Py_None);
+    self->port = Py_None;
+    Py_INCREF(Py_None);
+    self->mtc = Py_None;
+    self->is_follower = 0;
+    self->_state = NULL;
   }
   return((PyObject *)self);
 }
 
 static int
-Transport_init(Transport *self, PyObject *args, PyObject *kwds) {
-  PyObject *client=NULL, *tmp;
-  static char *kwlist[] = {"client", NULL};
-  if (! PyArg_ParseTupleAndKeywords(args, kwds, "O!", kwlist, 
-                                    &ClientType, &client))
+Clock_init(Clock *self, PyObject *args, PyObject *kwds) {
+  Port *port = NULL;
+  double tempo = 120.0;
+  PyObject *mtc = Py_None;
+  int send_clock = 1;
+  static char *kwlist[] = {"port", "tempo", "mtc", "clock", NULL};
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "O!|dOp", kwlist, 
+                                    _module_state(self)->PortType, &port, 
+                                    &tempo, &mtc, 
+                                    &send_clock))
     return(-1);
-  tmp = self->client;
-  Py_INCREF(client);
-  self->client = client;
+  if (self->_state != NULL) {
+    _error(self, "%s", "A clock can only be initialized once");
+    return(-1);
+  }
+  if (tempo <= 0.0) {
+    PyErr_SetString(PyExc_ValueError, "A clock's tempo must be positive");
+    return(-1);
+  }
+  // generate on output ports and follow on input ports
+  if (! Port_check_registered(port)) return(-1);
+  int is_follower = ((jack_port_flags(port->_port) & JackPortIsInput) != 0);
+  if (is_follower) {
+    if ((Port_prepare_receive(port) == NULL) && (PyErr_Occurred())) {
+      return(-1);
+    }
+    if (port->_managed == NULL) {
+      _error(self, "%s", "MIDI is disabled for this port");
+      return(-1);
+    }
+    if (mtc != Py_None) {
+      _error(self, "%s", "A clock following an input port can't send MTC");
+      return(-1);
+    }
+  }
+  else if (Port_prepare_send(port) == NULL) return(-1);
+  // find the MTC rate code for the frame rate
+  int mtc_type = -1;
+  double mtc_fps = 0.0;
+  if (mtc != Py_None) {
+    double fps = PyFloat_AsDouble(mtc);
+    if ((fps == -1.0) && (PyErr_Occurred())) return(-1);
+    if (fps == 24.0) mtc_type = 0;
+    else if (fps == 25.0) mtc_type = 1;
+    else if (fabs(fps - 29.97) < 0.001) mtc_type = 2;
+    else if (fps == 30.0) mtc_type = 3;
+    else {
+      PyErr_SetString(PyExc_ValueError, 
+        "The MTC rate must be 24, 25, 29.97, or 30 frames per second");
+      return(-1);
+    }
+    mtc_fps = (mtc_type == 2) ? (30000.0 / 1001.0) : fps;
+  }
+  ClockState *state = (ClockState *)calloc(1, sizeof(ClockState));
+  if (state == NULL) {
+    PyErr_NoMemory();
+    return(-1);
+  }
+  state->is_follower = is_follower;
+  atomic_init(&(state->tempo), tempo);
+  state->send_clock = send_clock;
+  state->mtc_type = mtc_type;
+  state->mtc_fps = mtc_fps;
+  atomic_init(&(state->sequence), 0);
+  // only one clock can use a port at a time
+  ClockState *expected = NULL;
+  if (! atomic_compare_exchange_strong(&(port->_managed->clock), &expected, 
+                                       state)) {
+    free(state);
+    _error(self, "%s", "The port already has a clock");
+    return(-1);
+  }
+  self->_state = state;
+  self->is_follower = is_follower;
+  PyObject *tmp = self->port;
+  Py_INCREF(port);
+  self->port = (PyObject *)port;
+  Py_XDECREF(tmp);
+  tmp = self->mtc;
+  Py_INCREF(mtc);
+  self->mtc = mtc;
   Py_XDECREF(tmp);
   return(0);
 }
 
-// clean up allocated data for a transport
 static void
-Transport_dealloc(Transport* self) {
-  Py_XDECREF(self->client);  
+Clock_dealloc(Clock *self) {
+  PyObject_GC_UnTrack((PyObject *)self);
+  if (self->_state != NULL) {
+    Port *port = (Port *)self->port;
+    ClockState *expected = self->_state;
+    if (port->_managed != NULL) {
+      atomic_compare_exchange_strong(&(port->_managed->clock), &expected, 
+                                     NULL);
+    }
+    // if we can't track it, it's safer to leak it than to free it early
+    Client_retire((Client *)port->client, self->_state, free);
+    self->_state = NULL;
+  }
+  Py_XDECREF(self->port);
+  Py_XDECREF(self->mtc);
+  PyTypeObject *type = Py_TYPE(self);
+  type->tp_free((PyObject *)self);
+  Py_DECREF(type);
 }
 
-// get the current time of the transport
+// let the garbage collector see the references a clock holds
+static int
+Clock_traverse(Clock *self, visitproc visit, void *arg) {
+  Py_VISIT(Py_TYPE(self));
+  Py_VISIT(self->port);
+  Py_VISIT(self->mtc);
+  return(0);
+}
+
+// get the clock's tempo in quarter notes per minute, which for a follower 
+//  is estimated from the clock it's receiving, or set the tempo a 
+//  generator uses when the transport doesn't have one
 static PyObject *
-Transport_get_time(Transport *self, void *closure) {
-  // make sure the client is connected to JACK
-  Client *client = (Client *)self->client;
-  Client_open(client);
-  if (client->_client == NULL) return(NULL);
-  // get the current transport position in frames
-  jack_nframes_t nframes = jack_get_current_transport_frame(client->_client);
-  // convert it to seconds and return
-  jack_nframes_t sample_rate = jack_get_sample_rate(client->_client);
-  double time = (double)nframes / (double)sample_rate;
-  return(PyFloat_FromDouble(time));
+Clock_get_tempo(Clock *self, void *closure) {
+  double tempo, position;
+  int running;
+  if (self->_state == NULL) Py_RETURN_NONE;
+  if ((_clock_read(self->_state, &tempo, &running, &position) < 0) || 
+      (tempo <= 0.0)) {
+    if (self->is_follower) Py_RETURN_NONE;
+    tempo = atomic_load(&(self->_state->tempo));
+  }
+  return(PyFloat_FromDouble(tempo));
 }
-// set the current time of the transport
 static int
-Transport_set_time(Transport *self, PyObject *value, void *closure) {
+Clock_set_tempo(Clock *self, PyObject *value, void *closure) {
   if (value == NULL) {
-    PyErr_SetString(PyExc_TypeError, "Cannot delete the time attribute");
-    return -1;
+    PyErr_SetString(PyExc_TypeError, "Cannot delete the tempo attribute");
+    return(-1);
   }
-  double time = PyFloat_AsDouble(value);
-  if (PyErr_Occurred()) return(-1);
-  // guard against negative transport locations
-  if (time < 0.0) time = 0.0;
-  // make sure the client is connected to JACK
-  Client *client = (Client *)self->client;
-  Client_open(client);
-  if (client->_client == NULL) return(-1);
-  // convert the time to frames
-  jack_nframes_t sample_rate = jack_get_sample_rate(client->_client);
-  jack_nframes_t nframes = (jack_nframes_t)((double)sample_rate * time);
-  // request that JACK update the position
-  int result = jack_transport_locate(client->_client, nframes);
-  // warn if that failed
-  if (result != 0) {
-    _warn("Failed to set transport location to %f (error %d)", time, result);
+  if ((self->_state == NULL) || (self->is_follower)) {
+    _error(self, "%s", 
+                 "Only a clock generating on an output port can set a tempo");
+    return(-1);
+  }
+  double tempo = PyFloat_AsDouble(value);
+  if ((tempo == -1.0) && (PyErr_Occurred())) return(-1);
+  if (tempo <= 0.0) {
+    PyErr_SetString(PyExc_ValueError, "A clock's tempo must be positive");
+    return(-1);
   }
+  atomic_store(&(self->_state->tempo), tempo);
   return(0);
 }
 
-// start the transport rolling
+// get whether the clock is running
 static PyObject *
-Transport_start(Transport *self) {
-  // make sure the client is connected to JACK
-  Client *client = (Client *)self->client;
-  Client_open(client);
-  if (client->_client == NULL) return(NULL);
-  // set the transport state
-  jack_transport_start(client->_client);
-  Py_RETURN_NONE;
+Clock_get_is_running(Clock *self, void *closure) {
+  double tempo, position;
+  int running = 0;
+  if ((self->_state == NULL) || 
+      (_clock_read(self->_state, &tempo, &running, &position) < 0)) {
+    running = 0;
+  }
+  if (running) Py_RETURN_TRUE;
+  else Py_RETURN_FALSE;
 }
-// stop the transport rolling
+
+// get the clock's position in quarter notes
 static PyObject *
-Transport_stop(Transport *self) {
-  // make sure the client is connected to JACK
-  Client *client = (Client *)self->client;
-  Client_open(client);
-  if (client->_client == NULL) return(NULL);
-  // set the transport state
-  jack_transport_stop(client->_client);
-  Py_RETURN_NONE;
+Clock_get_position(Clock *self, void *closure) {
+  double tempo, position;
+  int running;
+  if ((self->_state == NULL) || 
+      (_clock_read(self->_state, &tempo, &running, &position) < 0)) {
+    position = 0.0;
+  }
+  return(PyFloat_FromDouble(position));
 }
 
-// get whether the transport is rolling
+static PyMemberDef Clock_members[] = {
+  {"port", T_OBJECT_EX, offsetof(Clock, port), READONLY,
+   "The port the clock is generating on or following"},
+  {"mtc", T_OBJECT_EX, offsetof(Clock, mtc), READONLY,
+   "The frame rate of the MIDI timecode being sent, or None"},
+  {"is_follower", T_BOOL, offsetof(Clock, is_follower), READONLY,
+   "Whether the clock follows clock received on an input port"},
+  {NULL}  /* Sentinel */
+};
+
+static PyGetSetDef Clock_getset[] = {
+  {"tempo", (getter)Clock_get_tempo, (setter)Clock_set_tempo, 
+    "The clock's tempo in quarter notes per minute", NULL},
+  {"is_running", (getter)Clock_get_is_running, NULL, 
+    "Whether the clock is running", NULL},
+  {"position", (getter)Clock_get_position, NULL, 
+    "The clock's position in quarter notes", NULL},
+  {NULL}  /* Sentinel */
+};
+
+static PyType_Slot Clock_slots[] = {
+  {Py_tp_dealloc, (destructor)Clock_dealloc},
+  {Py_tp_traverse, (traverseproc)Clock_traverse},
+  {Py_tp_doc, "Generates or follows MIDI clock on a port"},
+  {Py_tp_members, Clock_members},
+  {Py_tp_getset, Clock_getset},
+  {Py_tp_init, (initproc)Clock_init},
+  {Py_tp_new, Clock_new},
+  {0, NULL}
+};
+
+static PyType_Spec Clock_spec = {
+  "jackpatch.Clock",           /* name */
+  sizeof(Clock),               /* basicsize */
+  0,                           /* itemsize */
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /* flags */
+  Clock_slots                  /* slots */
+};
+
+// CLIENT GROUP ***************************************************************
+
 static PyObject *
-Transport_get_is_rolling(Transport *self, void *closure) {
-  // make sure the client is connected to JACK
-  Client *client = (Client *)self->client;
-  Client_open(client);
-  if (client->_client == NULL) return(NULL);
-  // get the transport state
-  jack_transport_state_t state = jack_transport_query(client->_client, NULL);
-  if (state == JackTransportRolling) Py_RETURN_TRUE;
-  else Py_RETURN_FALSE;
+ClientGroup_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+  ClientGroup *self;
+  self = (ClientGroup *)type->tp_alloc(type, 0);
+  if (self != NULL) {
+    Py_INCREF(Py_None);
+    self->name = Py_None;
+    self->clients = PyTuple_New(0);
+    if (self->clients == NULL) {
+      Py_DECREF(self);
+      return(NULL);
+    }
+  }
+  return((PyObject *)self);
 }
-// start/stop the transport by setting its rolling state
+
 static int
-Transport_set_is_rolling(Transport *self, PyObject *value, void *closure) {
-  if (PyObject_IsTrue(value)) {
-    Transport_start(self);
+ClientGroup_init(ClientGroup *self, PyObject *args, PyObject *kwds) {
+  PyObject *name = NULL;
+  int count = 0;
+  static char *kwlist[] = {"name", "count", NULL};
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "U|i", kwlist, 
+                                    &name, &count))
+    return(-1);
+  // use a client for each core by default, since that's as many as JACK 
+  //  can run in parallel
+  if (count <= 0) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    count = (cores > 0) ? (int)cores : 1;
   }
-  else {
-    Transport_stop(self);
+  ModuleState *state = _module_state(self);
+  PyObject *clients = PyTuple_New(count);
+  if (clients == NULL) return(-1);
+  int i;
+  for (i = 0; i < count; i++) {
+    PyObject *client = PyObject_CallFunction((PyObject *)state->ClientType, 
+                                             "(N)", 
+      PyUnicode_FromFormat("%U-%d", name, i + 1));
+    if (client == NULL) {
+      Py_DECREF(clients);
+      return(-1);
+    }
+    PyTuple_SET_ITEM(clients, i, client);
   }
+  PyObject *tmp = self->clients;
+  self->clients = clients;
+  Py_XDECREF(tmp);
+  tmp = self->name;
+  Py_INCREF(name);
+  self->name = name;
+  Py_XDECREF(tmp);
   return(0);
 }
 
-static PyMemberDef Transport_members[] = {
-  {"client", T_OBJECT_EX, offsetof(Transport, client), READONLY,
-   "The client the transport uses to communicate with JACK"},
-  {NULL}  /* Sentinel */
-};
-
-static PyGetSetDef Transport_getset[] = {
-  {"time", (getter)Transport_get_time, (setter)Transport_set_time, 
-    "The transport's current position in seconds", NULL},
-  {"is_rolling", (getter)Transport_get_is_rolling, 
-                 (setter)Transport_set_is_rolling, 
-    "Whether the transport is currently advancing its time", NULL},
-  {NULL}  /* Sentinel */
-};
+static void
+ClientGroup_dealloc(ClientGroup *self) {
+  PyObject_GC_UnTrack((PyObject *)self);
+  // close the group's clients along with it, even if something still 
+  //  holds one of their ports, so none stay registered with the server
+  if (self->clients != NULL) {
+    PyObject *result = ClientGroup_close(self);
+    if (result == NULL) PyErr_WriteUnraisable((PyObject *)self);
+    Py_XDECREF(result);
+  }
+  Py_XDECREF(self->name);
+  Py_XDECREF(self->clients);
+  PyTypeObject *type = Py_TYPE(self);
+  type->tp_free((PyObject *)self);
+  Py_DECREF(type);
+}
 
-static PyMethodDef Transport_methods[] = {
+// let the garbage collector see the references a group holds
+static int
+ClientGroup_traverse(ClientGroup *self, visitproc visit, void *arg) {
+  Py_VISIT(Py_TYPE(self));
+  Py_VISIT(self->name);
+  Py_VISIT(self->clients);
+  return(0);
+}
 
-    {"start", (PyCFunction)Transport_start, METH_NOARGS,
-      "Start the transport rolling if it isn't already"},
-    {"stop", (PyCFunction)Transport_stop, METH_NOARGS,
-      "Stop the transport rolling if it is"},
-    {NULL, NULL, 0, NULL}  /* Sentinel */
-};
+// get one of a group's clients
+static inline Client *
+ClientGroup_client(ClientGroup *self, Py_ssize_t i) {
+  return((Client *)PyTuple_GET_ITEM(self->clients, i));
+}
 
-static PyTypeObject TransportType = {
-    PyObject_HEAD_INIT(NULL)
-    0,                             /*ob_size*/
-    "jackpatch.Transport",         /*tp_name*/  
-    sizeof(Transport),             /*tp_basicsize*/
-    0,                             /*tp_itemsize*/
-    (destructor)Transport_dealloc, /*tp_dealloc*/
-    0,                             /*tp_print*/
-    0,                             /*tp_getattr*/
-    0,                             /*tp_setattr*/
-    0,                             /*tp_compare*/
-    0,                             /*tp_repr*/
-    0,                             /*tp_as_number*/
-    0,                             /*tp_as_sequence*/
-    0,                             /*tp_as_mapping*/
-    0,                             /*tp_hash */
-    0,                             /*tp_call*/
-    0,                             /*tp_str*/
-    0,                             /*tp_getattro*/
-    0,                             /*tp_setattro*/
-    0,                             /*tp_as_buffer*/
-    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, /*tp_flags*/
-    "Represents a JACK transport", /* tp_doc */
-    0,                             /* tp_traverse */
-    0,                             /* tp_clear */
-    0,                             /* tp_richcompare */
-    0,                             /* tp_weaklistoffset */
-    0,                             /* tp_iter */
-    0,                             /* tp_iternext */
-    Transport_methods,             /* tp_methods */
-    Transport_members,             /* tp_members */
-    Transport_getset,              /* tp_getset */
-    0,                             /* tp_base */
-    0,                             /* tp_dict */
-    0,                             /* tp_descr_get */
-    0,                             /* tp_descr_set */
-    0,                             /* tp_dictoffset */
-    (initproc)Transport_init,      /* tp_init */
-    0,                             /* tp_alloc */
-    Transport_new,                 /* tp_new */
-};
+// get the first of a group's clients, which handles anything that goes 
+//  through the server rather than the process callback
+static Client *
+ClientGroup_first(ClientGroup *self) {
+  if (PyTuple_GET_SIZE(self->clients) == 0) {
+    _error(self, "%s", "The client group hasn't been set up");
+    return(NULL);
+  }
+  return(ClientGroup_client(self, 0));
+}
 
-// PORT ***********************************************************************
+// find the client in a group that owns a port, or NULL if none of them do
+static Client *
+ClientGroup_owner(ClientGroup *self, const char *port_name) {
+  Py_ssize_t i;
+  for (i = 0; i < PyTuple_GET_SIZE(self->clients); i++) {
+    Client *client = ClientGroup_client(self, i);
+    // hold the client's lock so it can't be closed while we use its name
+    int owns = 0;
+    Client_lock(client, 0);
+    if (client->_client != NULL) {
+      const char *client_name = jack_get_client_name(client->_client);
+      size_t length = strlen(client_name);
+      owns = ((strncmp(port_name, client_name, length) == 0) && 
+              (port_name[length] == ':'));
+    }
+    Client_unlock(client);
+    if (owns) return(client);
+  }
+  return(NULL);
+}
 
-static void
-Port_dealloc(Port* self) {
-  Py_XDECREF(self->name);
-  Py_XDECREF(self->client);
-  Py_XDECREF(self->flags);
+// replace the Port objects in a list with ones from the client in the 
+//  group that owns each port, so they can send and receive
+static int
+ClientGroup_own_ports(ClientGroup *self, PyObject *list) {
+  Py_ssize_t i;
+  for (i = 0; i < PyList_GET_SIZE(list); i++) {
+    Port *port = (Port *)PyList_GET_ITEM(list, i);
+    const char *name = PyUnicode_AsUTF8(port->name);
+    if (name == NULL) return(-1);
+    Client *owner = ClientGroup_owner(self, name);
+    if ((owner == NULL) || (owner == (Client *)port->client)) continue;
+    jack_port_t *handle = NULL;
+    Client_lock(owner, 0);
+    if (owner->_client != NULL) {
+      handle = jack_port_by_name(owner->_client, name);
+    }
+    Client_unlock(owner);
+    if (handle == NULL) continue;
+    Port *owned = Client_port_object(owner, handle, name);
+    if (owned == NULL) return(-1);
+    // the list takes our reference and drops its old one
+    PyList_SetItem(list, i, (PyObject *)owned);
+  }
+  return(0);
 }
 
+// call a function on every client in the group
 static PyObject *
-Port_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
-  Port *self;
-  self = (Port *)type->tp_alloc(type, 0);
-  if (self != NULL) {
-    self->name = Py_None;
+ClientGroup_call_all(ClientGroup *self, PyObject *(*method)(Client *)) {
+  Py_ssize_t i;
+  for (i = 0; i < PyTuple_GET_SIZE(self->clients); i++) {
+    PyObject *result = method(ClientGroup_client(self, i));
+    if (result == NULL) return(NULL);
+    Py_DECREF(result);
   }
-  return((PyObject *)self);
+  Py_RETURN_NONE;
 }
 
-static int
-Port_init(Port *self, PyObject *args, PyObject *kwds) {
-  char *requested_name = NULL;
-  PyObject *tmp = NULL;
-  Client *client = NULL;
+static PyObject *
+ClientGroup_open(ClientGroup *self) {
+  return(ClientGroup_call_all(self, Client_open));
+}
+static PyObject *
+ClientGroup_close(ClientGroup *self) {
+  return(ClientGroup_call_all(self, Client_close));
+}
+static PyObject *
+ClientGroup_activate(ClientGroup *self) {
+  return(ClientGroup_call_all(self, Client_activate));
+}
+static PyObject *
+ClientGroup_deactivate(ClientGroup *self) {
+  return(ClientGroup_call_all(self, Client_deactivate));
+}
+
+// create a port on the client in the group with the fewest ports, 
+//  or on the given one
+static PyObject *
+ClientGroup_port(ClientGroup *self, PyObject *args, PyObject *kwds) {
+  char *name = NULL;
   unsigned long flags = 0;
-  static char *kwlist[] = { "client", "name", "flags", NULL };
-  if (! PyArg_ParseTupleAndKeywords(args, kwds, "O!s|k", kwlist, 
-                                    &ClientType, &client, &requested_name, &flags))
-    return(-1);
-  // hold a reference to the underlying client so it never goes away while its
-  //  ports are being used
-  PyObject *client_obj = (PyObject *)client;
-  tmp = self->client;
-  Py_INCREF(client_obj);
-  self->client = client_obj;
-  Py_XDECREF(tmp);
-  // make sure the client is connected
-  Client_open(client);
-  if (client->_client == NULL) return(-1);
-  // see if a port already exists with this name
-  self->_is_mine = 0;
-  self->_port = jack_port_by_name(client->_client, requested_name);
-  // if there's no such port, we need to create one
-  if (self->_port == NULL) {
-    self->_is_mine = 1;
-    self->_port = jack_port_register(
-      client->_client, requested_name, 
-        JACK_DEFAULT_MIDI_TYPE, flags, 0);
-    // store the port with the client so it can manage MIDI for it
-    if ((flags & JackPortIsInput) != 0) {
-      if (client->_receive_port_count >= MAX_PORTS_PER_CLIENT) {
-        _warn("Failed to manage the port named \"%s\" because client has "
-              "too many ports. MIDI will be disabled for that port.", 
-              jack_port_name(self->_port));
+  Py_ssize_t queue_size = -1;
+  const char *type_name = "midi";
+  PyObject *shard_obj = Py_None;
+  static char *kwlist[] = { "name", "flags", "queue_size", "type", "shard", 
+                            NULL };
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "s|knsO", kwlist, 
+                                    &name, &flags, &queue_size, &type_name, 
+                                    &shard_obj))
+    return(NULL);
+  if (ClientGroup_first(self) == NULL) return(NULL);
+  ModuleState *state = _module_state(self);
+  Py_ssize_t count = PyTuple_GET_SIZE(self->clients);
+  Py_ssize_t shard = -1;
+  if (shard_obj != Py_None) {
+    // put the port with another port, or on a client by its index
+    if (PyObject_TypeCheck(shard_obj, state->PortType)) {
+      PyObject *client = ((Port *)shard_obj)->client;
+      Py_ssize_t i;
+      for (i = 0; i < count; i++) {
+        if (PyTuple_GET_ITEM(self->clients, i) == client) shard = i;
       }
-      else {
-        client->_receive_ports[client->_receive_port_count] = self->_port;
-        client->_receive_port_count++;
+      if (shard < 0) {
+        _error(self, "%s", "The port doesn't belong to the client group");
+        return(NULL);
       }
     }
-    else if ((flags & JackPortIsOutput) != 0) {
-      if (client->_send_port_count >= MAX_PORTS_PER_CLIENT) {
-        _warn("Failed to manage the port named \"%s\" because client has "
-              "too many ports. MIDI will be disabled for that port.", 
-              jack_port_name(self->_port));
-      }
-      else {
-        client->_send_ports[client->_send_port_count] = self->_port;
-        client->_send_port_count++;
+    else {
+      shard = PyLong_AsSsize_t(shard_obj);
+      if ((shard == -1) && (PyErr_Occurred())) return(NULL);
+      if ((shard < 0) || (shard >= count)) {
+        PyErr_Format(PyExc_IndexError, 
+          "The shard must be between 0 and %zd", count - 1);
+        return(NULL);
       }
     }
   }
-  if (self->_port == NULL) {
-    _error("Failed to create a JACK port named \"%s\"", requested_name);
-    return(-1);
+  else {
+    int fewest = INT_MAX;
+    Py_ssize_t i;
+    for (i = 0; i < count; i++) {
+      PortTable *table = atomic_load(&(ClientGroup_client(self, i)->_ports));
+      int ports = (table != NULL) ? 
+        (table->send_count + table->receive_count + table->audio_count) : 0;
+      if (ports < fewest) {
+        fewest = ports;
+        shard = i;
+      }
+    }
   }
-  // store the actual name of the port
-  tmp = self->name;
-  self->name = PyUnicode_FromString(jack_port_name(self->_port));
-  Py_XDECREF(tmp);
-  // store the actual flags of the port
-  tmp = self->flags;
-  self->flags = Py_BuildValue("i", jack_port_flags(self->_port));
-  Py_XDECREF(tmp);
-  return(0);
+  return(PyObject_CallFunction((PyObject *)state->PortType, "(Osknz)", 
+    PyTuple_GET_ITEM(self->clients, shard), name, flags, queue_size, 
+    type_name));
 }
 
+// list ports on the server, giving ports that belong to the group as 
+//  objects from the client that owns them
 static PyObject *
-Port_send(Port *self, PyObject *args) {
-  size_t i;
-  PyObject *data;
-  double time = 0.0;
-  if (! PyArg_ParseTuple(args, "O|d", &data, &time)) return(NULL);
-  if (! PySequence_Check(data)) {
-    PyErr_SetString(PyExc_TypeError, 
-      "Port.send expects argument 1 to be a sequence");
+ClientGroup_get_ports(ClientGroup *self, PyObject *args, PyObject *kwds) {
+  const char *name_pattern = NULL;
+  const char *type_pattern = NULL;
+  unsigned long flags = 0;
+  PyObject *mine = NULL;
+  static char *kwlist[] = {"name_pattern", "type_pattern", "flags", "mine", NULL};
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "|sskO", kwlist, 
+                                    &name_pattern, &type_pattern, &flags, &mine))
     return(NULL);
-  }
-  if (! self->_is_mine) {
-    _error("Only ports created by jackpatch can send MIDI messages");
+  int mine_only = (mine != NULL) ? PyObject_IsTrue(mine) : 0;
+  if (mine_only < 0) return(NULL);
+  Client *first = ClientGroup_first(self);
+  if (first == NULL) return(NULL);
+  PyObject *list_args = Py_BuildValue("(ssk)", 
+    (name_pattern != NULL) ? name_pattern : "", 
+    (type_pattern != NULL) ? type_pattern : "", flags);
+  if (list_args == NULL) return(NULL);
+  PyObject *ports = Client_get_ports(first, list_args, NULL);
+  Py_DECREF(list_args);
+  if (ports == NULL) return(NULL);
+  if (ClientGroup_own_ports(self, ports) < 0) {
+    Py_DECREF(ports);
     return(NULL);
   }
-  int flags = jack_port_flags(self->_port);
-  if ((flags & JackPortIsOutput) == 0) {
-    _error("Only output ports can send MIDI messages");
-    return(NULL);
+  if (! mine_only) return(ports);
+  // keep only the group's own ports
+  PyObject *owned = PyList_New(0);
+  Py_ssize_t i;
+  for (i = 0; (owned != NULL) && (i < PyList_GET_SIZE(ports)); i++) {
+    Port *port = (Port *)PyList_GET_ITEM(ports, i);
+    if ((! port->_is_mine) || 
+        (! PySequence_Contains(self->clients, port->client))) continue;
+    if (PyList_Append(owned, (PyObject *)port) < 0) Py_CLEAR(owned);
   }
-  // the client needs to be activated for sending to work
-  Client *client = (Client *)self->client;
-  Client_activate(client);
-  // get the current sample rate for time conversions
-  jack_nframes_t sample_rate = jack_get_sample_rate(client->_client);
-  // store the message
-  size_t bytes = PySequence_Size(data);
-  Message *message = malloc(sizeof(Message) + (sizeof(unsigned char) * bytes));
-  if (message == NULL) {
-    _error("Failed to allocate memory for MIDI data");
+  Py_DECREF(ports);
+  return(owned);
+}
+
+// get all ports connected to the given port, giving ports that belong to 
+//  the group as objects from the client that owns them
+static PyObject *
+ClientGroup_get_connections(ClientGroup *self, PyObject *args) {
+  Port *port = NULL;
+  if (! PyArg_ParseTuple(args, "O!", _module_state(self)->PortType, &port)) {
     return(NULL);
   }
-  message->next = NULL;
-  message->port = self->_port;
-  message->time = (jack_nframes_t)(time * (double)sample_rate);
-  message->data_size = bytes;
-  unsigned char *mdata = message->data;
-  long value;
-  for (i = 0; i < bytes; i++) {
-    value = PyLong_AsLong(PySequence_ITEM(data, i));
-    if ((value == -1) && (PyErr_Occurred())) return(NULL);
-    *mdata = (unsigned char)(value & 0xFF);
-    mdata++;
-  }
-  // ensure the send queue isn't changed while we're traversing it
-  pthread_mutex_t *lock = &(client->_midi_send_queue_lock);
-  pthread_mutex_lock(lock);
-  // if the queue is empty, begin it with the message
-  if (client->_midi_send_queue_head == NULL) {
-    client->_midi_send_queue_head = message;
-  }
-  else {
-    // insert the message to the client's send queue in whatever position
-    //  keeps the queue sorted by time
-    Message *last = NULL;
-    Message *current = client->_midi_send_queue_head;
-    // store the message time to save lookups
-    jack_nframes_t mtime = message->time;
-    while (current != NULL) {
-      // if we find an existing message that comes after this one, insert this
-      //  one before it
-      if (mtime < current->time) {
-        if (last == NULL) {
-          client->_midi_send_queue_head = message;
-        }
-        else {
-          last->next = message;
-        }
-        message->next = current;
-        // clear the message to indicate it's been stored in the queue
-        message = NULL;
-        break;
-      }
-      // advance to the next message
-      last = current;
-      current = (Message *)current->next;
-    }
-    // if we get to the end and the message hasn't been inserted, 
-    //  insert it after the last message we have
-    if ((message != NULL) && (last != NULL)) {
-      last->next = message;
-    }
+  PyObject *ports = Port_get_connections(port);
+  if (ports == NULL) return(NULL);
+  if (ClientGroup_own_ports(self, ports) < 0) {
+    Py_DECREF(ports);
+    return(NULL);
   }
-  pthread_mutex_unlock(lock);
-  Py_RETURN_NONE;
+  return(ports);
 }
 
+// make and break connections, which JACK does for the whole server, 
+//  so any of the group's clients can do it
 static PyObject *
-Port_receive(Port *self) {
-  if (! self->_is_mine) {
-    _error("Only ports created by jackpatch can receive MIDI messages");
+ClientGroup_connect(ClientGroup *self, PyObject *args, PyObject *kwds) {
+  Client *first = ClientGroup_first(self);
+  if (first == NULL) return(NULL);
+  return(Client_connect(first, args, kwds));
+}
+static PyObject *
+ClientGroup_disconnect(ClientGroup *self, PyObject *args, PyObject *kwds) {
+  Client *first = ClientGroup_first(self);
+  if (first == NULL) return(NULL);
+  return(Client_disconnect(first, args, kwds));
+}
+static PyObject *
+ClientGroup_apply_patch(ClientGroup *self, PyObject *args, PyObject *kwds) {
+  Client *first = ClientGroup_first(self);
+  if (first == NULL) return(NULL);
+  return(Client_apply_patch(first, args, kwds));
+}
+
+// replace the rules for routing MIDI between the group's ports, giving 
+//  each client the routes between its own ports
+static PyObject *
+ClientGroup_set_routes(ClientGroup *self, PyObject *args, PyObject *kwds) {
+  PyObject *routes_obj = NULL;
+  static char *kwlist[] = { "routes", NULL };
+  if (! PyArg_ParseTupleAndKeywords(args, kwds, "O", kwlist, &routes_obj)) {
     return(NULL);
   }
-  int flags = jack_port_flags(self->_port);
-  if ((flags & JackPortIsInput) == 0) {
-    _error("Only input ports can receive MIDI messages");
-    return(NULL);
+  PyTypeObject *port_type = _module_state(self)->PortType;
+  Py_ssize_t count = PyTuple_GET_SIZE(self->clients);
+  PyObject *shards = PyTuple_New(count);
+  if (shards == NULL) return(NULL);
+  Py_ssize_t i, j;
+  for (i = 0; i < count; i++) {
+    PyObject *list = PyList_New(0);
+    if (list == NULL) goto error;
+    PyTuple_SET_ITEM(shards, i, list);
   }
-  // the client needs to be activated for receiving to work
-  Client *client = (Client *)self->client;
-  Client_activate(client);
-  // skip receiving if the queue is empty
-  if (client->_midi_receive_queue_head == NULL) Py_RETURN_NONE;
-  // ensure the receive queue isn't changed while we're adding to it
-  pthread_mutex_t *lock = &(client->_midi_receive_queue_lock);
-  pthread_mutex_lock(lock);
-  // get the current sample rate for time conversions
-  jack_nframes_t sample_rate = jack_get_sample_rate(client->_client);  
-  // pull events from the receive queue for the client
-  Message *last = NULL;
-  Message *message = client->_midi_receive_queue_head;
-  Message *next = NULL;
-  jack_port_t *port = self->_port;
-  while (message != NULL) {
-    // get all messages for this port
-    if (message->port == port) {
-      // convert the event time from samples to seconds
-      double time = (double)message->time / (double)sample_rate;
-      // package raw MIDI data into an array
-      size_t bytes = message->data_size;
-      PyObject *data = PyList_New(bytes);
-      unsigned char *c = message->data;
-      size_t i;
-      for (i = 0; i < bytes; i++) {
-        PyList_SET_ITEM(data, i, PyLong_FromLong(*c++));
+  if (routes_obj != Py_None) {
+    PyObject *seq = PySequence_Fast(routes_obj, 
+      "Routes must be a sequence of dicts");
+    if (seq == NULL) goto error;
+    for (j = 0; j < PySequence_Fast_GET_SIZE(seq); j++) {
+      PyObject *spec = PySequence_Fast_GET_ITEM(seq, j);
+      if (! PyDict_Check(spec)) {
+        Py_DECREF(seq);
+        PyErr_SetString(PyExc_TypeError, "Each route must be a dict");
+        goto error;
       }
-      PyObject *tuple = Py_BuildValue("(O,d)", data, time);
-      Py_DECREF(data);
-      // remove the message from the queue once received
-      next = (Message *)message->next;
-      message->next = NULL;
-      if (last != NULL) last->next = next;
-      if (message == client->_midi_receive_queue_head) {
-        client->_midi_receive_queue_head = next;
+      // a route runs in one process callback, so both of its ports 
+      //  have to belong to the same client
+      PyObject *source = PyDict_GetItemString(spec, "source");
+      PyObject *destination = PyDict_GetItemString(spec, "destination");
+      if ((source == NULL) || (! PyObject_TypeCheck(source, port_type)) || 
+          (destination == NULL) || 
+          (! PyObject_TypeCheck(destination, port_type))) {
+        Py_DECREF(seq);
+        PyErr_SetString(PyExc_TypeError, 
+          "A route's source and destination must be Ports");
+        goto error;
       }
-      if (message == client->_midi_receive_queue_tail) {
-        client->_midi_receive_queue_tail = last;
+      PyObject *client = ((Port *)source)->client;
+      for (i = 0; i < count; i++) {
+        if (PyTuple_GET_ITEM(self->clients, i) == client) break;
       }
-      free(message);
-      // open the queue for changes before we return
-      pthread_mutex_unlock(lock);
-      // return the message
-      return(tuple);
-    }
-    last = message;
-    message = (Message *)message->next;
-  }
-  pthread_mutex_unlock(lock);
-  // if we get here, there were no messages for this port
-  Py_RETURN_NONE;
-}
-
-// remove all events from the send queue
-static PyObject *
-Port_clear_send(Port *self) {
-  Client *client = (Client *)self->client;
-  // skip receiving if the queue is empty
-  if (client->_midi_send_queue_head == NULL) Py_RETURN_NONE;
-  // ensure the send queue isn't changed while we're adding to it
-  pthread_mutex_t *lock = &(client->_midi_send_queue_lock);
-  pthread_mutex_lock(lock);
-  // remove all messages for this port from the send queue
-  Message *last = NULL;
-  Message *message = client->_midi_send_queue_head;
-  Message *next = NULL;
-  jack_port_t *port = self->_port;
-  while (message != NULL) {
-    if (message->port == port) {
-      next = (Message *)message->next;
-      message->next = NULL;
-      if (last != NULL) last->next = next;
-      if (message == client->_midi_send_queue_head) {
-        client->_midi_send_queue_head = next;
+      if (i >= count) {
+        Py_DECREF(seq);
+        _error(self, "%s", 
+                     "The route's source doesn't belong to the client group");
+        goto error;
+      }
+      if (((Port *)destination)->client != client) {
+        Py_DECREF(seq);
+        _error(self, "%s", 
+                     "A route's source and destination must be on the same "
+                     "client; create the destination with shard=source");
+        goto error;
+      }
+      if (PyList_Append(PyTuple_GET_ITEM(shards, i), spec) < 0) {
+        Py_DECREF(seq);
+        goto error;
       }
-      free(message);
-      message = next;
-      continue;
     }
-    last = message;
-    message = (Message *)message->next;
+    Py_DECREF(seq);
   }
-  pthread_mutex_unlock(lock);
+  for (i = 0; i < count; i++) {
+    PyObject *list = PyTuple_GET_ITEM(shards, i);
+    PyObject *shard_args = (PyList_GET_SIZE(list) > 0) ? 
+      Py_BuildValue("(O)", list) : Py_BuildValue("(O)", Py_None);
+    if (shard_args == NULL) goto error;
+    PyObject *result = Client_set_routes(ClientGroup_client(self, i), 
+                                         shard_args, NULL);
+    Py_DECREF(shard_args);
+    if (result == NULL) goto error;
+    Py_DECREF(result);
+  }
+  Py_DECREF(shards);
   Py_RETURN_NONE;
+error:
+  Py_DECREF(shards);
+  return(NULL);
 }
 
-// remove all events from the receive queue
+// get statistics for each of the group's clients, along with the stats 
+//  for all of their ports together
 static PyObject *
-Port_clear_receive(Port *self) {
-  Client *client = (Client *)self->client;
-  // skip receiving if the queue is empty
-  if (client->_midi_receive_queue_head == NULL) Py_RETURN_NONE;
-  // ensure the receive queue isn't changed while we're adding to it
-  pthread_mutex_t *lock = &(client->_midi_receive_queue_lock);
-  pthread_mutex_lock(lock);
-  // remove all messages for this port from the receive queue
-  Message *last = NULL;
-  Message *message = client->_midi_receive_queue_head;
-  Message *next = NULL;
-  jack_port_t *port = self->_port;
-  while (message != NULL) {
-    if (message->port == port) {
-      next = (Message *)message->next;
-      message->next = NULL;
-      if (last != NULL) last->next = next;
-      if (message == client->_midi_receive_queue_head) {
-        client->_midi_receive_queue_head = next;
-      }
-      if (message == client->_midi_receive_queue_tail) {
-        client->_midi_receive_queue_tail = last;
-      }
-      free(message);
-      message = next;
-      continue;
+ClientGroup_stats(ClientGroup *self) {
+  Py_ssize_t count = PyTuple_GET_SIZE(self->clients);
+  PyObject *shards = PyList_New(count);
+  PyObject *ports = PyDict_New();
+  if ((shards == NULL) || (ports == NULL)) goto error;
+  Py_ssize_t i;
+  for (i = 0; i < count; i++) {
+    PyObject *stats = Client_stats(ClientGroup_client(self, i));
+    if (stats == NULL) goto error;
+    PyList_SET_ITEM(shards, i, stats);
+    PyObject *shard_ports = PyDict_GetItemString(stats, "ports");
+    if ((shard_ports != NULL) && (PyDict_Update(ports, shard_ports) < 0)) {
+      goto error;
     }
-    last = message;
-    message = (Message *)message->next;
   }
-  pthread_mutex_unlock(lock);
-  Py_RETURN_NONE;
+  return(Py_BuildValue("{s:N,s:N}", "shards", shards, "ports", ports));
+error:
+  Py_XDECREF(shards);
+  Py_XDECREF(ports);
+  return(NULL);
 }
 
-// get all ports connected to the given port
+// get the transport, which all of the group's clients share
 static PyObject *
-Port_get_connections(Port *self) {
-  int i;
-  // make sure we're connected to JACK
-  Client *client = (Client *)self->client;
-  Client_open(client);
-  if (client->_client == NULL) return(NULL);
-  // get a list of port names connected to this port
-  const char **ports = jack_port_get_all_connections(
-    client->_client, self->_port);
-  // convert the port names into a list of Port objects
-  PyObject *return_list;
-  return_list = PyList_New(0);
-  if (! ports) return(return_list);
-  for (i = 0; ports[i]; ++i) {
-    Port *port = (Port *)Port_new(&PortType, NULL, NULL);
-    if (port != NULL) {
-      PyObject *name = PyUnicode_FromString(ports[i]);
-      Port_init(port, Py_BuildValue("(O,S)", client, name), Py_BuildValue("{}"));
-      Py_XDECREF(name);
-      if (PyList_Append(return_list, (PyObject *)port) < 0) {
-        _error("Failed to append a port to the list");
-        Py_DECREF(return_list);
-        jack_free(ports);
-        return(NULL);
-      }
-    }
-  }
-  jack_free(ports);
-  return(return_list);
+ClientGroup_get_transport(ClientGroup *self, void *closure) {
+  Client *first = ClientGroup_first(self);
+  if (first == NULL) return(NULL);
+  Py_INCREF(first->transport);
+  return(first->transport);
 }
 
-static PyMemberDef Port_members[] = {
-  {"name", T_OBJECT_EX, offsetof(Port, name), READONLY,
-   "The port's unique name"},
-  {"client", T_OBJECT_EX, offsetof(Port, client), READONLY,
-   "The client used to create the port"},
-  {"flags", T_OBJECT_EX, offsetof(Port, flags), READONLY,
-   "The port's flags as a bitfield of JackPortFlags"},
+static PyMemberDef ClientGroup_members[] = {
+  {"name", T_OBJECT_EX, offsetof(ClientGroup, name), READONLY,
+   "The name the group's clients are named after"},
+  {"clients", T_OBJECT_EX, offsetof(ClientGroup, clients), READONLY,
+   "A tuple of the group's clients"},
   {NULL}  /* Sentinel */
 };
 
-static PyMethodDef Port_methods[] = {
-    {"send", (PyCFunction)Port_send, METH_VARARGS,
-      "Send a tuple of ints as a MIDI message to the port"},
-    {"receive", (PyCFunction)Port_receive, METH_NOARGS,
-      "Receive a MIDI message from the port"},
-    {"clear_send", (PyCFunction)Port_clear_send, METH_NOARGS,
-      "Remove all messages from the port's send queue"},
-    {"clear_receive", (PyCFunction)Port_clear_receive, METH_NOARGS,
-      "Remove all messages from the port's receive queue"},
-    {"get_connections", (PyCFunction)Port_get_connections, METH_NOARGS,
-      "Get all the ports connected to this one"},
+static PyGetSetDef ClientGroup_getset[] = {
+  {"transport", (getter)ClientGroup_get_transport, NULL, 
+    "A Transport that interfaces with the JACK transport", NULL},
+  {NULL}  /* Sentinel */
+};
+
+static PyMethodDef ClientGroup_methods[] = {
+    {"open", (PyCFunction)ClientGroup_open, METH_NOARGS,
+      "Ensure all the group's clients are connected to JACK"},
+    {"close", (PyCFunction)ClientGroup_close, METH_NOARGS,
+      "Ensure none of the group's clients are connected to JACK"},
+    {"activate", (PyCFunction)ClientGroup_activate, METH_NOARGS,
+      "Ensure all the group's clients are ready to send and receive data"},
+    {"deactivate", (PyCFunction)ClientGroup_deactivate, METH_NOARGS,
+      "Ensure none of the group's clients can send and receive data"},
+    {"port", (PyCFunction)ClientGroup_port, METH_VARARGS | METH_KEYWORDS,
+      "Create a port on the group's least busy client"},
+    {"get_ports", (PyCFunction)ClientGroup_get_ports, 
+      METH_VARARGS | METH_KEYWORDS,
+      "Get a list of available ports"},
+    {"get_connections", (PyCFunction)ClientGroup_get_connections, 
+      METH_VARARGS,
+      "Get a list of the ports connected to a port"},
+    {"connect", (PyCFunction)ClientGroup_connect, METH_VARARGS | METH_KEYWORDS,
+      "Connect a source and destination port"},
+    {"disconnect", (PyCFunction)ClientGroup_disconnect, 
+      METH_VARARGS | METH_KEYWORDS,
+      "Disconnect a source and destination port"},
+    {"apply_patch", (PyCFunction)ClientGroup_apply_patch, 
+      METH_VARARGS | METH_KEYWORDS,
+      "Make only the given connections between a set of ports"},
+    {"set_routes", (PyCFunction)ClientGroup_set_routes, 
+      METH_VARARGS | METH_KEYWORDS,
+      "Replace the rules for routing MIDI between the group's ports"},
+    {"stats", (PyCFunction)ClientGroup_stats, METH_NOARGS,
+      "Get statistics about the group's clients and ports"},
     {NULL, NULL, 0, NULL}  /* Sentinel */
 };
 
-static PyTypeObject PortType = {
-    PyObject_HEAD_INIT(NULL)
-    0,                             /*ob_size*/
-    "jackpatch.Port",              /*tp_name*/  
-    sizeof(Port),                  /*tp_basicsize*/
-    0,                             /*tp_itemsize*/
-    (destructor)Port_dealloc,      /*tp_dealloc*/
-    0,                             /*tp_print*/
-    0,                             /*tp_getattr*/
-    0,                             /*tp_setattr*/
-    0,                             /*tp_compare*/
-    0,                             /*tp_repr*/
-    0,                             /*tp_as_number*/
-    0,                             /*tp_as_sequence*/
-    0,                             /*tp_as_mapping*/
-    0,                             /*tp_hash */
-    0,                             /*tp_call*/
-    0,                             /*tp_str*/
-    0,                             /*tp_getattro*/
-    0,                             /*tp_setattro*/
-    0,                             /*tp_as_buffer*/
-    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, /*tp_flags*/
-    "Represents an JACK port",     /* tp_doc */
-    0,		                         /* tp_traverse */
-    0,		                         /* tp_clear */
-    0,		                         /* tp_richcompare */
-    0,		                         /* tp_weaklistoffset */
-    0,		                         /* tp_iter */
-    0,		                         /* tp_iternext */
-    Port_methods,                  /* tp_methods */
-    Port_members,                  /* tp_members */
-    0,                             /* tp_getset */
-    0,                             /* tp_base */
-    0,                             /* tp_dict */
-    0,                             /* tp_descr_get */
-    0,                             /* tp_descr_set */
-    0,                             /* tp_dictoffset */
-    (initproc)Port_init,           /* tp_init */
-    0,                             /* tp_alloc */
-    Port_new,                      /* tp_new */
+static PyType_Slot ClientGroup_slots[] = {
+  {Py_tp_dealloc, (destructor)ClientGroup_dealloc},
+  {Py_tp_traverse, (traverseproc)ClientGroup_traverse},
+  {Py_tp_doc, "Spreads ports across several JACK clients"},
+  {Py_tp_methods, ClientGroup_methods},
+  {Py_tp_members, ClientGroup_members},
+  {Py_tp_getset, ClientGroup_getset},
+  {Py_tp_init, (initproc)ClientGroup_init},
+  {Py_tp_new, ClientGroup_new},
+  {0, NULL}
+};
+
+static PyType_Spec ClientGroup_spec = {
+  "jackpatch.ClientGroup",     /* name */
+  sizeof(ClientGroup),         /* basicsize */
+  0,                           /* itemsize */
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /* flags */
+  ClientGroup_slots            /* slots */
 };
 
 // MODULE *********************************************************************
@@ -1172,50 +9076,117 @@ static PyMethodDef jackpatch_methods[] = {
     {NULL, NULL, 0, NULL}        /* Sentinel */
 };
 
+// create one of the module's types and add it to the module, returning 
+//  -1 on failure
+static int
+_module_add_type(PyObject *m, PyType_Spec *spec, PyTypeObject **type) {
+  *type = (PyTypeObject *)PyType_FromModuleAndSpec(m, spec, NULL);
+  if (*type == NULL) return(-1);
+  return(PyModule_AddType(m, *type));
+}
+
+static int
+jackpatch_exec(PyObject *m) {
+  ModuleState *state = (ModuleState *)PyModule_GetState(m);
+
+  state->JackError = PyErr_NewException("jackpatch.JackError", NULL, NULL);
+  if ((state->JackError == NULL) || 
+      (PyModule_AddObjectRef(m, "JackError", state->JackError) < 0))
+    return(-1);
+
+  // add constants
+  if ((PyModule_AddIntConstant(m, "JackPortIsInput", JackPortIsInput) < 0) || 
+      (PyModule_AddIntConstant(m, "JackPortIsOutput", JackPortIsOutput) < 0) || 
+      (PyModule_AddIntConstant(m, "JackPortIsPhysical", 
+                               JackPortIsPhysical) < 0) || 
+      (PyModule_AddIntConstant(m, "JackPortCanMonitor", 
+                               JackPortCanMonitor) < 0) || 
+      (PyModule_AddIntConstant(m, "JackPortIsTerminal", 
+                               JackPortIsTerminal) < 0))
+    return(-1);
+  // add overflow policies for sending
+  if ((PyModule_AddIntConstant(m, "OverflowDefer", OVERFLOW_DEFER) < 0) || 
+      (PyModule_AddIntConstant(m, "OverflowDropOldest", 
+                               OVERFLOW_DROP_OLDEST) < 0) || 
+      (PyModule_AddIntConstant(m, "OverflowCoalesce", OVERFLOW_COALESCE) < 0))
+    return(-1);
+
+  // add classes
+  if ((_module_add_type(m, &Client_spec, &(state->ClientType)) < 0) || 
+      (_module_add_type(m, &Transport_spec, &(state->TransportType)) < 0) || 
+      (_module_add_type(m, &Port_spec, &(state->PortType)) < 0) || 
+      (_module_add_type(m, &MidiEvent_spec, &(state->MidiEventType)) < 0) || 
+      (_module_add_type(m, &Player_spec, &(state->PlayerType)) < 0) || 
+      (_module_add_type(m, &Recorder_spec, &(state->RecorderType)) < 0) || 
+      (_module_add_type(m, &Clock_spec, &(state->ClockType)) < 0) || 
+      (_module_add_type(m, &ClientGroup_spec, 
+                        &(state->ClientGroupType)) < 0))
+    return(-1);
+  return(0);
+}
+
+static int
+jackpatch_traverse(PyObject *m, visitproc visit, void *arg) {
+  ModuleState *state = (ModuleState *)PyModule_GetState(m);
+  Py_VISIT(state->JackError);
+  Py_VISIT(state->ClientType);
+  Py_VISIT(state->TransportType);
+  Py_VISIT(state->PortType);
+  Py_VISIT(state->MidiEventType);
+  Py_VISIT(state->PlayerType);
+  Py_VISIT(state->RecorderType);
+  Py_VISIT(state->ClockType);
+  Py_VISIT(state->ClientGroupType);
+  return(0);
+}
+
+static int
+jackpatch_clear(PyObject *m) {
+  ModuleState *state = (ModuleState *)PyModule_GetState(m);
+  Py_CLEAR(state->JackError);
+  Py_CLEAR(state->ClientType);
+  Py_CLEAR(state->TransportType);
+  Py_CLEAR(state->PortType);
+  Py_CLEAR(state->MidiEventType);
+  Py_CLEAR(state->PlayerType);
+  Py_CLEAR(state->RecorderType);
+  Py_CLEAR(state->ClockType);
+  Py_CLEAR(state->ClientGroupType);
+  return(0);
+}
+
+static void
+jackpatch_free(void *m) {
+  jackpatch_clear((PyObject *)m);
+}
+
+static PyModuleDef_Slot jackpatch_slots[] = {
+  {Py_mod_exec, jackpatch_exec},
+  // nothing is shared between interpreters, and everything the GIL 
+  //  protected has a lock of its own on free-threaded builds
+#ifdef Py_mod_multiple_interpreters
+  {Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
+#endif
+#ifdef Py_mod_gil
+  {Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+  {0, NULL}
+};
+
 static struct PyModuleDef jackpatch =
 {
   PyModuleDef_HEAD_INIT,
   "jackpatch", /* name of module */
   NULL, /* module documentation, may be NULL */
-  -1,   /* size of per-interpreter state of the module, or -1 if the module keeps state in global variables. */
-  jackpatch_methods
+  sizeof(ModuleState), /* size of per-interpreter state of the module */
+  jackpatch_methods,
+  jackpatch_slots,
+  jackpatch_traverse,
+  jackpatch_clear,
+  jackpatch_free
 };
 
-#ifndef PyMODINIT_FUNC	/* declarations for DLL import/export */
-#define PyMODINIT_FUNC void
-#endif
 PyMODINIT_FUNC
-initjackpatch(void) {
-  PyObject* m;
-
-  PortType.tp_new = PyType_GenericNew;
-  if (PyType_Ready(&ClientType) < 0)
-      return NULL;
-  if (PyType_Ready(&TransportType) < 0)
-      return NULL;
-  if (PyType_Ready(&PortType) < 0)
-      return NULL;
-
-  m = PyModule_Create(&jackpatch);
-  if (m == NULL)
-    return NULL;
-
-  JackError = PyErr_NewException("jackpatch.JackError", NULL, NULL);
-  Py_INCREF(JackError);
-  PyModule_AddObject(m, "JackError", JackError);
-
-  // add constants
-  PyModule_AddIntConstant(m, "JackPortIsInput", JackPortIsInput);
-  PyModule_AddIntConstant(m, "JackPortIsOutput", JackPortIsOutput);
-  PyModule_AddIntConstant(m, "JackPortIsPhysical", JackPortIsPhysical);
-  PyModule_AddIntConstant(m, "JackPortCanMonitor", JackPortCanMonitor);
-  PyModule_AddIntConstant(m, "JackPortIsTerminal", JackPortIsTerminal);
-
-  // add classes
-  Py_INCREF(&ClientType);
-  PyModule_AddObject(m, "Client", (PyObject *)&ClientType);
-  Py_INCREF(&TransportType);
-  PyModule_AddObject(m, "Transport", (PyObject *)&TransportType);
-  Py_INCREF(&PortType);
-  PyModule_AddObject(m, "Port", (PyObject *)&PortType);
+PyInit_jackpatch(void) {
+  return(PyModuleDef_Init(&jackpatch));
 }
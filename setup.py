@@ -12,11 +12,45 @@ import time
 
 version = '0.1.1'
 
+try:
+	from setuptools import Command
+except ImportError:
+	from distutils.cmd import Command
+
+# run the benchmarks against the extension built in place
+class bench(Command):
+	description = 'run the MIDI send/receive benchmarks'
+	user_options = [
+		('output=', 'o', 'where to write the results as JSON'),
+		('baseline=', 'b', 'results to compare against for regressions'),
+		('tolerance=', 't', 'the fraction a metric can get worse by'),
+		('start-server', 's', 'start a JACK server with the dummy backend') ]
+	boolean_options = [ 'start-server' ]
+	def initialize_options(self):
+		self.output = 'benchmark-results.json'
+		self.baseline = None
+		self.tolerance = None
+		self.start_server = False
+	def finalize_options(self):
+		pass
+	def run(self):
+		self.reinitialize_command('build_ext', inplace=1)
+		self.run_command('build_ext')
+		sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+		import benchmarks.__main__
+		argv = [ '--output', self.output ]
+		if self.baseline: argv.extend([ '--baseline', self.baseline ])
+		if self.tolerance: argv.extend([ '--tolerance', str(self.tolerance) ])
+		if self.start_server: argv.append('--start-server')
+		if benchmarks.__main__.main(argv) != 0:
+			sys.exit(1)
+
 kwargs = dict()
 if has_setuptools:
 	kwargs = dict(
 			include_package_data = True,
 			install_requires = ['setuptools'],
+			python_requires = '>=3.11',
 			zip_safe = False)
 
 setup(
@@ -39,5 +73,6 @@ setup(
 	classifiers=[ "Development Status :: 3 - Alpha",
             "Topic :: Multimedia :: Sound/Audio :: MIDI" ],
 	package_dir = {'': '.',},
+	cmdclass = { 'bench': bench },
 	**kwargs
 )